@@ -2,6 +2,8 @@
 #include "board.h"
 #include "display.h"
 #include "system_info.h"
+#include "cpu_profiler.h"
+#include "heap_monitor.h"
 #include "audio_codec.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
@@ -64,14 +66,20 @@ void Application::Initialize() {
 
     // Setup the display
     auto display = board.GetDisplay();
-    display->SetupUI();
+    {
+        HeapTagScope heap_scope(kHeapTagDisplay);
+        display->SetupUI();
+    }
     // Print board name/version info
     display->SetChatMessage("system", SystemInfo::GetUserAgent().c_str());
 
     // Setup the audio service
     auto codec = board.GetAudioCodec();
-    audio_service_.Initialize(codec);
-    audio_service_.Start();
+    {
+        HeapTagScope heap_scope(kHeapTagAudio);
+        audio_service_.Initialize(codec);
+        audio_service_.Start();
+    }
 
     AudioServiceCallbacks callbacks;
     callbacks.on_send_queue_available = [this]() {
@@ -83,6 +91,11 @@ void Application::Initialize() {
     callbacks.on_vad_change = [this](bool speaking) {
         xEventGroupSetBits(event_group_, MAIN_EVENT_VAD_CHANGE);
     };
+    // The subtitles not shown yet are dropped with their audio
+    subtitle_player_ = std::make_unique<SubtitlePlayer>(audio_service_, display);
+    callbacks.on_decoder_reset = [this]() {
+        subtitle_player_->Clear();
+    };
     audio_service_.SetCallbacks(callbacks);
 
     // Add state change listeners
@@ -93,10 +106,16 @@ void Application::Initialize() {
     // Start the clock timer to update the status bar
     esp_timer_start_periodic(clock_timer_handle_, 1000000);
 
+    // Sample the CPU usage of the tasks in the background if enabled in Kconfig or by the MCP tool
+    CpuProfiler::GetInstance().Start();
+
     // Add MCP common tools (only once during initialization)
     auto& mcp_server = McpServer::GetInstance();
-    mcp_server.AddCommonTools();
-    mcp_server.AddUserOnlyTools();
+    {
+        HeapTagScope heap_scope(kHeapTagMcp);
+        mcp_server.AddCommonTools();
+        mcp_server.AddUserOnlyTools();
+    }
 
     // Set network event callback for UI updates and network state handling
     board.SetNetworkEventCallback([this](NetworkEvent event, const std::string& data) {
@@ -219,9 +238,11 @@ void Application::Run() {
 
         if (bits & MAIN_EVENT_SEND_AUDIO) {
             while (auto packet = audio_service_.PopPacketFromSendQueue()) {
+                auto capture_time_us = packet->capture_time_us;
                 if (protocol_ && !protocol_->SendAudio(std::move(packet))) {
                     break;
                 }
+                audio_service_.RecordSendLatency(capture_time_us);
             }
         }
 
@@ -253,6 +274,21 @@ void Application::Run() {
             // Print debug info every 10 seconds
             if (clock_ticks_ % 10 == 0) {
                 SystemInfo::PrintHeapStats();
+#if CONFIG_PRINT_MCP_TOOL_STATS
+                McpServer::GetInstance().PrintToolStats();
+#endif
+            }
+
+            // Follow the trend of the free memory for the leak and fragmentation report
+            if (clock_ticks_ % 60 == 0) {
+                HeapMonitor::GetInstance().TakeSample();
+            }
+
+            // Probe the round trip time every 5 seconds while the audio channel is opened,
+            // and let the encoder follow the link quality measured by the previous probes
+            if (clock_ticks_ % 5 == 0 && protocol_ && protocol_->IsAudioChannelOpened()) {
+                audio_service_.UpdateLinkQuality(protocol_->GetStatistics());
+                protocol_->SendPing();
             }
         }
     }
@@ -390,7 +426,10 @@ void Application::CheckAssetsVersion() {
     }
 
     // Apply assets
-    assets.Apply();
+    {
+        HeapTagScope heap_scope(kHeapTagAssets);
+        assets.Apply();
+    }
     display->SetChatMessage("system", "");
     display->SetEmotion("microchip_ai");
 }
@@ -486,6 +525,8 @@ void Application::InitializeProtocol() {
         protocol_ = std::make_unique<MqttProtocol>();
     }
 
+    protocol_->SetFrameDuration(audio_service_.GetPreferredFrameDuration());
+
     protocol_->OnConnected([this]() {
         DismissAlert();
     });
@@ -507,6 +548,8 @@ void Application::InitializeProtocol() {
             ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
+        // The downlink frame duration is the server's, the uplink one is negotiated on its own
+        audio_service_.SetFrameDuration(protocol_->uplink_frame_duration());
     });
     
     protocol_->OnAudioChannelClosed([this, &board]() {
@@ -529,7 +572,8 @@ void Application::InitializeProtocol() {
                     SetDeviceState(kDeviceStateSpeaking);
                 });
             } else if (strcmp(state->valuestring, "stop") == 0) {
-                Schedule([this]() {
+                Schedule([this, end_ms = audio_service_.GetQueuedPosition()]() {
+                    subtitle_player_->Finish(end_ms);
                     if (GetDeviceState() == kDeviceStateSpeaking) {
                         if (listening_mode_ == kListeningModeManualStop) {
                             SetDeviceState(kDeviceStateIdle);
@@ -542,8 +586,10 @@ void Application::InitializeProtocol() {
                 auto text = cJSON_GetObjectItem(root, "text");
                 if (cJSON_IsString(text)) {
                     ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
+                    // The audio of the sentence follows its text, it is played after the audio queued so far.
+                    // Scheduled after the state change to speaking, which resets the decoder.
+                    Schedule([this, message = std::string(text->valuestring), start_ms = audio_service_.GetQueuedPosition()]() {
+                        subtitle_player_->AddSentence(message, start_ms);
                     });
                 }
             }
@@ -564,7 +610,7 @@ void Application::InitializeProtocol() {
             }
         } else if (strcmp(type->valuestring, "mcp") == 0) {
             auto payload = cJSON_GetObjectItem(root, "payload");
-            if (cJSON_IsObject(payload)) {
+            if (cJSON_IsObject(payload) || cJSON_IsArray(payload)) {
                 McpServer::GetInstance().ParseMessage(payload);
             }
         } else if (strcmp(type->valuestring, "system") == 0) {
@@ -606,6 +652,7 @@ void Application::InitializeProtocol() {
         }
     });
     
+    HeapTagScope heap_scope(kHeapTagProtocol);
     protocol_->Start();
 }
 
@@ -1063,7 +1110,7 @@ bool Application::CanEnterSleepMode() {
     return true;
 }
 
-void Application::SendMcpMessage(const std::string& payload) {
+void Application::SendMcpMessage(std::string payload) {
     // Always schedule to run in main task for thread safety
     Schedule([this, payload = std::move(payload)]() {
         if (protocol_) {
@@ -1072,6 +1119,14 @@ void Application::SendMcpMessage(const std::string& payload) {
     });
 }
 
+void Application::SendMcpMessage(std::string payload, std::string data, size_t data_offset) {
+    Schedule([this, payload = std::move(payload), data = std::move(data), data_offset]() {
+        if (protocol_) {
+            protocol_->SendMcpMessage(payload, data, data_offset);
+        }
+    });
+}
+
 void Application::SetAecMode(AecMode mode) {
     aec_mode_ = mode;
     Schedule([this]() {
@@ -1099,10 +1154,68 @@ void Application::SetAecMode(AecMode mode) {
     });
 }
 
+bool Application::SetFrameDuration(int frame_duration) {
+    if (!audio_service_.SetPreferredFrameDuration(frame_duration)) {
+        return false;
+    }
+    Schedule([this, frame_duration]() {
+        if (protocol_) {
+            // Proposed in the next hello, the open audio channel keeps the current frame duration
+            protocol_->SetFrameDuration(frame_duration);
+        }
+    });
+    return true;
+}
+
 void Application::PlaySound(const std::string_view& sound) {
     audio_service_.PlaySound(sound);
 }
 
+bool Application::GetProtocolStatistics(ProtocolStatistics& statistics) {
+    if (!protocol_) {
+        return false;
+    }
+    statistics = protocol_->GetStatistics();
+    return true;
+}
+
+bool Application::ReopenAudioChannel() {
+    auto state = GetDeviceState();
+    if (!protocol_ || (state != kDeviceStateListening && state != kDeviceStateSpeaking)) {
+        return true;
+    }
+
+    ESP_LOGW(TAG, "Reopening the audio channel over the new network interface");
+    auto start_time = esp_timer_get_time();
+    if (!protocol_->ReopenAudioChannel()) {
+        // The old channel was dropped without a close event, end the conversation like a lost channel
+        ESP_LOGE(TAG, "Failed to reopen the audio channel, back to idle");
+        Schedule([this]() {
+            if (protocol_->IsAudioChannelOpened()) {
+                protocol_->CloseAudioChannel(false);
+            }
+            Board::GetInstance().SetPowerSaveLevel(PowerSaveLevel::LOW_POWER);
+            auto display = Board::GetInstance().GetDisplay();
+            display->SetChatMessage("system", "");
+            SetDeviceState(kDeviceStateIdle);
+        });
+        return false;
+    }
+    ESP_LOGI(TAG, "Audio channel reopened in %d ms", (int)((esp_timer_get_time() - start_time) / 1000));
+
+    // The rest of the reply was lost with the old session, continue listening in the new one
+    bool processor_running = audio_service_.IsAudioProcessorRunning();
+    if (state == kDeviceStateSpeaking) {
+        audio_service_.ResetDecoder();
+        SetDeviceState(kDeviceStateListening);
+    }
+    // Entering the listening state only announces it when the audio processor was stopped
+    if (processor_running) {
+        protocol_->SendStartListening(listening_mode_);
+    }
+    return true;
+}
+
 void Application::ResetProtocol() {
     Schedule([this]() {
         // Close audio channel if opened
@@ -16,6 +16,7 @@
 #include "audio_service.h"
 #include "device_state.h"
 #include "device_state_machine.h"
+#include "subtitle_player.h"
 
 // Main event bits
 #define MAIN_EVENT_SCHEDULE             (1 << 0)
@@ -107,11 +108,15 @@ public:
     void WakeWordInvoke(const std::string& wake_word);
     bool UpgradeFirmware(const std::string& url, const std::string& version = "");
     bool CanEnterSleepMode();
-    void SendMcpMessage(const std::string& payload);
+    void SendMcpMessage(std::string payload);
+    // Send a MCP payload with binary data that the protocol base64 encodes into it at data_offset
+    void SendMcpMessage(std::string payload, std::string data, size_t data_offset);
     void SetAecMode(AecMode mode);
     AecMode GetAecMode() const { return aec_mode_; }
+    bool SetFrameDuration(int frame_duration);
     void PlaySound(const std::string_view& sound);
     AudioService& GetAudioService() { return audio_service_; }
+    bool GetProtocolStatistics(ProtocolStatistics& statistics);
     
     /**
      * Reset protocol resources (thread-safe)
@@ -120,6 +125,12 @@ public:
      */
     void ResetProtocol();
 
+    /**
+     * Reopen the audio channel of the ongoing conversation after the network interface changed
+     * Must be called in the main task, returns false if the channel could not be reopened
+     */
+    bool ReopenAudioChannel();
+
 private:
     Application();
     ~Application();
@@ -134,6 +145,7 @@ private:
     AecMode aec_mode_ = kAecOff;
     std::string last_error_message_;
     AudioService audio_service_;
+    std::unique_ptr<SubtitlePlayer> subtitle_player_;
     std::unique_ptr<Ota> ota_;
 
     bool has_server_time_ = false;
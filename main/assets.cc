@@ -2,6 +2,7 @@
 #include "board.h"
 #include "display.h"
 #include "application.h"
+#include "heap_monitor.h"
 #include "lvgl_theme.h"
 #include "emote_display.h"
 #include "expression_emote.h"
@@ -341,11 +342,16 @@ bool Assets::LvglStrategy::Apply(Assets* assets, bool refresh_display_theme) {
             display->SetTheme(current_theme);
         }
 
+        // Decode the most frequent emojis of the new collection before they are shown
+        auto lcd_display = dynamic_cast<LcdDisplay*>(display);
+        if (lcd_display != nullptr && cJSON_IsArray(emoji_collection)) {
+            lcd_display->WarmUpEmojiCache();
+        }
+
         // Parse hide_subtitle configuration
         cJSON* hide_subtitle = cJSON_GetObjectItem(root, "hide_subtitle");
         if (cJSON_IsBool(hide_subtitle)) {
             bool hide = cJSON_IsTrue(hide_subtitle);
-            auto lcd_display = dynamic_cast<LcdDisplay*>(display);
             if (lcd_display != nullptr) {
                 lcd_display->SetHideSubtitle(hide);
                 ESP_LOGI(TAG, "Set hide_subtitle to %s", hide ? "true" : "false");
@@ -469,9 +475,11 @@ bool Assets::Download(std::string url, std::function<void(int progress, size_t s
     // 写入新的资源文件到分区，一边erase一边写入
     char* buffer = (char*)heap_caps_malloc(SECTOR_SIZE, MALLOC_CAP_INTERNAL);
     if (buffer == nullptr) {
-        ESP_LOGE(TAG, "Failed to allocate buffer");
+        ESP_LOGE(TAG, "Failed to allocate buffer, largest free internal block: %u",
+                 heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
         return false;
     }
+    HeapTrackGuard heap_track(kHeapTagAssets, SECTOR_SIZE);
     size_t total_written = 0;
     size_t recent_written = 0;
     size_t current_sector = 0;
@@ -1,6 +1,9 @@
 #include "audio_service.h"
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
+#include "settings.h"
+#include "event_trace.h"
 
 #define RATE_CVT_CFG(_src_rate, _dest_rate, _channel)        \
     (esp_ae_rate_cvt_cfg_t)                                  \
@@ -37,6 +40,41 @@
 
 #define TAG "AudioService"
 
+static bool IsSupportedFrameDuration(int frame_duration_ms) {
+    return frame_duration_ms == 10 || frame_duration_ms == 20 || frame_duration_ms == 40 || frame_duration_ms == 60;
+}
+
+static size_t GetQueueLimit(int max_duration_ms, int frame_duration_ms) {
+    if (frame_duration_ms <= 0) {
+        frame_duration_ms = OPUS_FRAME_DURATION_MS;
+    }
+    return std::max(1, max_duration_ms / frame_duration_ms);
+}
+
+// Get the duration of an Opus packet from its TOC byte (RFC 6716, section 3.1)
+static int GetOpusPacketDuration(const std::vector<uint8_t>& payload) {
+    if (payload.empty()) {
+        return 0;
+    }
+    static const int kFrameDurationUs[32] = {
+        10000, 20000, 40000, 60000, 10000, 20000, 40000, 60000, 10000, 20000, 40000, 60000,
+        10000, 20000, 10000, 20000,
+        2500, 5000, 10000, 20000, 2500, 5000, 10000, 20000, 2500, 5000, 10000, 20000, 2500, 5000, 10000, 20000,
+    };
+    int frame_duration_us = kFrameDurationUs[payload[0] >> 3];
+    int frames = 1;
+    switch (payload[0] & 0x03) {
+    case 1:
+    case 2:
+        frames = 2;
+        break;
+    case 3:
+        frames = payload.size() > 1 ? (payload[1] & 0x3F) : 0;
+        break;
+    }
+    return frame_duration_us * frames / 1000;
+}
+
 AudioService::AudioService() {
     event_group_ = xEventGroupCreate();
 }
@@ -63,6 +101,12 @@ void AudioService::Initialize(AudioCodec* codec) {
     codec_ = codec;
     codec_->Start();
 
+    Settings settings("audio", false);
+    preferred_frame_duration_ms_ = settings.GetInt("frame_duration", OPUS_FRAME_DURATION_MS);
+    if (!IsSupportedFrameDuration(preferred_frame_duration_ms_)) {
+        preferred_frame_duration_ms_ = OPUS_FRAME_DURATION_MS;
+    }
+
     esp_opus_dec_cfg_t opus_dec_cfg = OPUS_DEC_CFG(codec->output_sample_rate(), OPUS_FRAME_DURATION_MS);
     auto ret = esp_opus_dec_open(&opus_dec_cfg, sizeof(esp_opus_dec_cfg_t), &opus_decoder_);
     if (opus_decoder_ == nullptr) {
@@ -99,6 +143,7 @@ void AudioService::Initialize(AudioCodec* codec) {
 #endif
 
     audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
+        TRACE_INSTANT("audio.processed", data.size());
         PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data));
     });
 
@@ -182,6 +227,7 @@ void AudioService::Stop() {
 }
 
 bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
+    TRACE_SCOPE("audio.read", samples);
     if (!codec_->input_enabled()) {
         esp_timer_stop(audio_power_timer_);
         esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
@@ -244,13 +290,13 @@ void AudioService::AudioInputTask() {
 
         /* Used for audio testing in NetworkConfiguring mode by clicking the BOOT button */
         if (bits & AS_EVENT_AUDIO_TESTING_RUNNING) {
-            if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+            if (audio_testing_queue_.size() >= GetQueueLimit(AUDIO_TESTING_MAX_DURATION_MS, frame_duration_ms_)) {
                 ESP_LOGW(TAG, "Audio testing queue is full, stopping audio testing");
                 EnableAudioTesting(false);
                 continue;
             }
             std::vector<int16_t> data;
-            int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
+            int samples = frame_duration_ms_ * 16000 / 1000;
             if (ReadAudioData(data, 16000, samples)) {
                 // If input channels is 2, we need to fetch the left channel data
                 if (codec_->input_channels() == 2) {
@@ -271,10 +317,14 @@ void AudioService::AudioInputTask() {
             std::vector<int16_t> data;
             if (ReadAudioData(data, 16000, samples)) {
                 if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
+                    TRACE_BEGIN("wake_word.feed");
                     wake_word_->Feed(data);
+                    TRACE_END("wake_word.feed");
                 }
                 if (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING) {
+                    TRACE_BEGIN("audio_processor.feed");
                     audio_processor_->Feed(std::move(data));
+                    TRACE_END("audio_processor.feed");
                 }
                 continue;
             }
@@ -306,16 +356,20 @@ void AudioService::AudioOutputTask() {
             codec_->EnableOutput(true);
         }
 
+        TRACE_BEGIN("audio.output");
         codec_->OutputData(task->pcm);
+        TRACE_END("audio.output");
 
         /* Update the last output time */
         last_output_time_ = std::chrono::steady_clock::now();
         debug_statistics_.playback_count++;
 
+        lock.lock();
+        /* Advance the playback position, the subtitles are timed against it */
+        playback_position_ms_ = std::max(playback_position_ms_, task->playback_position_ms);
 #if CONFIG_USE_SERVER_AEC
         /* Record the timestamp for server AEC */
         if (task->timestamp > 0) {
-            lock.lock();
             timestamp_queue_.push_back(task->timestamp);
         }
 #endif
@@ -327,17 +381,23 @@ void AudioService::AudioOutputTask() {
 void AudioService::OpusCodecTask() {
     while (true) {
         std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() {
+        auto ready = [this]() {
             return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
-                (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
-        });
+                (!audio_encode_queue_.empty() && audio_send_queue_.size() < GetQueueLimit(MAX_SEND_QUEUE_DURATION_MS, encoder_duration_ms_)) ||
+                (audio_playback_queue_.size() < GetQueueLimit(MAX_PLAYBACK_QUEUE_DURATION_MS, decoder_duration_ms_) && IsDecodeReady());
+        };
+        if (decode_buffering_ && !audio_decode_queue_.empty()) {
+            // The jitter buffer may fill up by waiting, not only by a new packet
+            audio_queue_cv_.wait_for(lock, std::chrono::milliseconds(JITTER_BUFFER_POLL_MS), ready);
+        } else {
+            audio_queue_cv_.wait(lock, ready);
+        }
         if (service_stopped_) {
             break;
         }
 
         /* Decode the audio from decode queue */
-        if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
+        if (audio_playback_queue_.size() < GetQueueLimit(MAX_PLAYBACK_QUEUE_DURATION_MS, decoder_duration_ms_) && IsDecodeReady()) {
             auto packet = std::move(audio_decode_queue_.front());
             audio_decode_queue_.pop_front();
             audio_queue_cv_.notify_all();
@@ -346,6 +406,7 @@ void AudioService::OpusCodecTask() {
             auto task = std::make_unique<AudioTask>();
             task->type = kAudioTaskTypeDecodeToPlaybackQueue;
             task->timestamp = packet->timestamp;
+            task->playback_position_ms = packet->playback_position_ms;
 
             SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
             if (opus_decoder_ != nullptr) {
@@ -362,9 +423,11 @@ void AudioService::OpusCodecTask() {
                     .decoded_size = 0,
                 };
                 esp_audio_dec_info_t dec_info = {};
+                TRACE_BEGIN("opus.decode");
                 std::unique_lock<std::mutex> decoder_lock(decoder_mutex_);
                 auto ret = esp_opus_dec_decode(opus_decoder_, &raw, &out_frame, &dec_info);
                 decoder_lock.unlock();
+                TRACE_END("opus.decode");
                 if (ret == ESP_AUDIO_ERR_OK) {
                     task->pcm.resize(out_frame.decoded_size / sizeof(int16_t));
                     if (decoder_sample_rate_ != codec_->output_sample_rate() && output_resampler_ != nullptr) {
@@ -392,17 +455,20 @@ void AudioService::OpusCodecTask() {
             debug_statistics_.decode_count++;
         }
         /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
+        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < GetQueueLimit(MAX_SEND_QUEUE_DURATION_MS, encoder_duration_ms_)) {
             auto task = std::move(audio_encode_queue_.front());
             audio_encode_queue_.pop_front();
             audio_queue_cv_.notify_all();
             lock.unlock();
 
+            // The encoder follows the frame size produced by the audio processor
+            ApplyPendingEncoderSettings(task->pcm.size() * 1000 / encoder_sample_rate_);
+
             auto packet = std::make_unique<AudioStreamPacket>();
-            packet->frame_duration = OPUS_FRAME_DURATION_MS;
+            packet->frame_duration = encoder_duration_ms_;
             packet->sample_rate = 16000;
             packet->timestamp = task->timestamp;
-
+            packet->capture_time_us = task->capture_time_us;
             if (opus_encoder_ != nullptr && task->pcm.size() == encoder_frame_size_) {
                 std::vector<uint8_t> buf(encoder_outbuf_size_);
                 esp_audio_enc_in_frame_t in = {
@@ -414,7 +480,15 @@ void AudioService::OpusCodecTask() {
                     .len = (uint32_t)encoder_outbuf_size_,
                     .encoded_bytes = 0,
                 };
+                auto encode_start_time = esp_timer_get_time();
+                TRACE_BEGIN("opus.encode");
                 auto ret = esp_opus_enc_process(opus_encoder_, &in, &out);
+                TRACE_END("opus.encode");
+                {
+                    std::lock_guard<std::mutex> control_lock(encoder_control_mutex_);
+                    encode_time_us_ += esp_timer_get_time() - encode_start_time;
+                    encode_frames_++;
+                }
                 if (ret == ESP_AUDIO_ERR_OK) {
                     packet->payload.assign(buf.data(), buf.data() + out.encoded_bytes);
 
@@ -481,10 +555,175 @@ void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
     }
 }
 
+void AudioService::UpdateLinkQuality(const ProtocolStatistics& statistics) {
+    {
+        // The playout delay covers the downlink jitter, the next burst uses the new depth
+        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+        int depth = std::min(statistics.jitter_ms * JITTER_BUFFER_JITTER_FACTOR, JITTER_BUFFER_MAX_MS);
+        if (depth != jitter_buffer_ms_) {
+            ESP_LOGD(TAG, "Jitter buffer %d ms, jitter %d ms", depth, statistics.jitter_ms);
+            jitter_buffer_ms_ = depth;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(encoder_control_mutex_);
+
+    // Prefer the loss reported by the server, otherwise count the probes without a pong over a window of probes
+    int loss = encoder_status_.packet_loss;
+    if (statistics.server_packet_loss >= 0) {
+        loss = statistics.server_packet_loss;
+    } else {
+        uint32_t sent = statistics.pings_sent - last_link_statistics_.pings_sent;
+        uint32_t received = statistics.pongs_received - last_link_statistics_.pongs_received;
+        probe_window_sent_ += sent;
+        probe_window_lost_ += sent > received ? sent - received : 0;
+        if (probe_window_sent_ >= LINK_PROBE_WINDOW) {
+            loss = probe_window_lost_ >= LINK_PROBE_MIN_LOST ? probe_window_lost_ * 100 / probe_window_sent_ : 0;
+            probe_window_sent_ = 0;
+            probe_window_lost_ = 0;
+        }
+    }
+    last_link_statistics_ = statistics;
+    encoder_status_.packet_loss = loss;
+
+    // Step the link level with hysteresis, and keep each level for a minimum time so it does not flap
+    int rtt = statistics.rtt_ms;
+    auto level = encoder_status_.link_level;
+    bool worse = (level == kLinkGood && (loss >= OPUS_FEC_ENABLE_LOSS_PERCENT || rtt > OPUS_LOW_BITRATE_RTT_MS)) ||
+        (level == kLinkFec && (loss >= OPUS_LOW_BITRATE_LOSS_PERCENT || rtt > OPUS_LOW_BITRATE_RTT_MS));
+    bool better = (level == kLinkFec && loss <= OPUS_FEC_DISABLE_LOSS_PERCENT && rtt <= OPUS_LOW_BITRATE_RTT_MS) ||
+        (level == kLinkLowBitrate && loss < OPUS_LOW_BITRATE_EXIT_LOSS_PERCENT && rtt < OPUS_LOW_BITRATE_EXIT_RTT_MS);
+    int64_t now = esp_timer_get_time();
+    if ((worse || better) && now - link_level_time_us_ >= LINK_QUALITY_MIN_DWELL_MS * 1000LL) {
+        level = static_cast<LinkLevel>(level + (worse ? 1 : -1));
+        encoder_status_.link_level = level;
+        link_level_time_us_ = now;
+        ESP_LOGI(TAG, "Link level %d: loss=%d%% rtt=%dms", level, loss, rtt);
+    }
+
+    auto settings = encoder_settings_pending_ ? pending_encoder_settings_ : encoder_status_.settings;
+    // Leave room for the redundant data, and back off further on a bad link
+    settings.enable_fec = level >= kLinkFec;
+    if (level == kLinkLowBitrate) {
+        settings.bitrate = OPUS_LOW_BITRATE;
+    } else if (level == kLinkFec) {
+        settings.bitrate = OPUS_FEC_BITRATE;
+    } else {
+        settings.bitrate = ESP_OPUS_BITRATE_AUTO;
+    }
+
+    // Spend the spare CPU time on quality, only when frames were encoded in this window
+    if (encode_frames_ > 0) {
+        encoder_status_.encode_load = (int)(encode_time_us_ / encode_frames_ * 100 / (encoder_duration_ms_ * 1000));
+        encode_time_us_ = 0;
+        encode_frames_ = 0;
+        if (encoder_status_.encode_load > 50 && settings.complexity > 0) {
+            settings.complexity--;
+        } else if (encoder_status_.encode_load < 25 && settings.complexity < OPUS_MAX_ADAPTIVE_COMPLEXITY) {
+            settings.complexity++;
+        }
+    }
+
+    if (!(settings == encoder_status_.settings)) {
+        ESP_LOGI(TAG, "Encoder update: loss=%d%% rtt=%dms load=%d%% -> bitrate=%d complexity=%d fec=%d",
+            loss, statistics.rtt_ms, encoder_status_.encode_load, settings.bitrate, settings.complexity, settings.enable_fec);
+        pending_encoder_settings_ = settings;
+        encoder_settings_pending_ = true;
+    } else {
+        encoder_settings_pending_ = false;
+    }
+}
+
+OpusEncoderStatus AudioService::GetEncoderStatus() {
+    std::lock_guard<std::mutex> lock(encoder_control_mutex_);
+    return encoder_status_;
+}
+
+void AudioService::ApplyPendingEncoderSettings(int frame_duration_ms) {
+    std::lock_guard<std::mutex> lock(encoder_control_mutex_);
+    if (!IsSupportedFrameDuration(frame_duration_ms)) {
+        frame_duration_ms = encoder_duration_ms_;
+    }
+    if (!encoder_settings_pending_ && frame_duration_ms == encoder_duration_ms_) {
+        return;
+    }
+    auto settings = encoder_settings_pending_ ? pending_encoder_settings_ : encoder_status_.settings;
+    encoder_settings_pending_ = false;
+
+    // Reopen the encoder between two frames, so no frame is dropped
+    esp_opus_enc_config_t opus_enc_cfg = AS_OPUS_ENC_CONFIG();
+    opus_enc_cfg.bitrate = settings.bitrate;
+    opus_enc_cfg.complexity = settings.complexity;
+    opus_enc_cfg.enable_fec = settings.enable_fec;
+    opus_enc_cfg.frame_duration = (esp_opus_enc_frame_duration_t)AS_OPUS_GET_FRAME_DRU_ENUM(frame_duration_ms);
+    void* encoder = nullptr;
+    auto ret = esp_opus_enc_open(&opus_enc_cfg, sizeof(esp_opus_enc_config_t), &encoder);
+    if (encoder == nullptr) {
+        ESP_LOGE(TAG, "Failed to reconfigure audio encoder, error code: %d", ret);
+        encoder_status_.reconfigure_failures++;
+        return;
+    }
+    if (opus_encoder_ != nullptr) {
+        esp_opus_enc_close(opus_encoder_);
+    }
+    opus_encoder_ = encoder;
+    esp_opus_enc_get_frame_size(opus_encoder_, &encoder_frame_size_, &encoder_outbuf_size_);
+    encoder_frame_size_ = encoder_frame_size_ / sizeof(int16_t);
+    encoder_status_.settings = settings;
+    encoder_status_.reconfigurations++;
+    if (encoder_duration_ms_ != frame_duration_ms) {
+        ESP_LOGI(TAG, "Encoder frame duration changed from %d ms to %d ms", encoder_duration_ms_, frame_duration_ms);
+        encoder_duration_ms_ = frame_duration_ms;
+        encoder_status_.frame_duration = frame_duration_ms;
+        encoder_status_.latency_frames = 0;
+        encoder_status_.latency_average_ms = 0;
+        encoder_status_.latency_max_ms = 0;
+    }
+}
+
+void AudioService::RecordSendLatency(int64_t capture_time_us) {
+    if (capture_time_us <= 0) {
+        return;
+    }
+    int latency_ms = (esp_timer_get_time() - capture_time_us) / 1000;
+    std::lock_guard<std::mutex> lock(encoder_control_mutex_);
+    auto& status = encoder_status_;
+    status.latency_frames++;
+    status.latency_average_ms += (latency_ms - status.latency_average_ms) / (int)std::min<uint32_t>(status.latency_frames, 16);
+    status.latency_max_ms = std::max(status.latency_max_ms, latency_ms);
+}
+
+void AudioService::SetFrameDuration(int frame_duration_ms) {
+    if (!IsSupportedFrameDuration(frame_duration_ms)) {
+        ESP_LOGW(TAG, "Unsupported frame duration %d ms, using %d ms", frame_duration_ms, OPUS_FRAME_DURATION_MS);
+        frame_duration_ms = OPUS_FRAME_DURATION_MS;
+    }
+    if (frame_duration_ms == frame_duration_ms_) {
+        return;
+    }
+    ESP_LOGI(TAG, "Set frame duration to %d ms", frame_duration_ms);
+    frame_duration_ms_ = frame_duration_ms;
+    if (audio_processor_initialized_) {
+        audio_processor_->SetFrameDuration(frame_duration_ms_);
+    }
+}
+
+bool AudioService::SetPreferredFrameDuration(int frame_duration_ms) {
+    if (!IsSupportedFrameDuration(frame_duration_ms)) {
+        return false;
+    }
+    preferred_frame_duration_ms_ = frame_duration_ms;
+    Settings settings("audio", true);
+    settings.SetInt("frame_duration", frame_duration_ms);
+    return true;
+}
+
 void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
     auto task = std::make_unique<AudioTask>();
     task->type = type;
     task->pcm = std::move(pcm);
+    /* The first sample of the frame was captured one frame duration ago */
+    task->capture_time_us = esp_timer_get_time() - frame_duration_ms_ * 1000;
     /* Push the task to the encode queue */
     std::unique_lock<std::mutex> lock(audio_queue_mutex_);
 
@@ -498,25 +737,55 @@ void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t
         timestamp_queue_.pop_front();
     }
 
-    audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
+    audio_queue_cv_.wait(lock, [this]() {
+        return audio_encode_queue_.size() < GetQueueLimit(MAX_ENCODE_QUEUE_DURATION_MS, frame_duration_ms_);
+    });
     audio_encode_queue_.push_back(std::move(task));
     audio_queue_cv_.notify_all();
 }
 
 bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
     std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
+    auto max_packets = GetQueueLimit(MAX_DECODE_QUEUE_DURATION_MS, packet->frame_duration);
+    if (audio_decode_queue_.size() >= max_packets) {
         if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
+            audio_queue_cv_.wait(lock, [this, max_packets]() { return audio_decode_queue_.size() < max_packets; });
         } else {
             return false;
         }
     }
+    if (!wait && jitter_buffer_ms_ > 0 && audio_decode_queue_.empty() && audio_playback_queue_.empty()) {
+        // A new burst from the server, local sounds are played at once
+        decode_buffering_ = true;
+        decode_buffering_start_us_ = esp_timer_get_time();
+    }
+    queued_position_ms_ += packet->frame_duration;
+    packet->playback_position_ms = queued_position_ms_;
     audio_decode_queue_.push_back(std::move(packet));
     audio_queue_cv_.notify_all();
     return true;
 }
 
+bool AudioService::IsDecodeReady() {
+    if (audio_decode_queue_.empty()) {
+        return false;
+    }
+    if (!decode_buffering_) {
+        return true;
+    }
+    int queued_ms = audio_decode_queue_.size() * audio_decode_queue_.front()->frame_duration;
+    if (queued_ms >= jitter_buffer_ms_ || esp_timer_get_time() - decode_buffering_start_us_ >= jitter_buffer_ms_ * 1000LL) {
+        decode_buffering_ = false;
+        return true;
+    }
+    return false;
+}
+
+int AudioService::GetJitterBufferDepth() {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    return jitter_buffer_ms_;
+}
+
 std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
     std::lock_guard<std::mutex> lock(audio_queue_mutex_);
     if (audio_send_queue_.empty()) {
@@ -580,7 +849,7 @@ void AudioService::EnableVoiceProcessing(bool enable) {
     ESP_LOGD(TAG, "%s voice processing", enable ? "Enabling" : "Disabling");
     if (enable) {
         if (!audio_processor_initialized_) {
-            audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+            audio_processor_->Initialize(codec_, frame_duration_ms_, models_list_);
             audio_processor_initialized_ = true;
         }
 
@@ -619,7 +888,7 @@ void AudioService::EnableAudioTesting(bool enable) {
 void AudioService::EnableDeviceAec(bool enable) {
     ESP_LOGI(TAG, "%s device AEC", enable ? "Enabling" : "Disabling");
     if (!audio_processor_initialized_) {
-        audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+        audio_processor_->Initialize(codec_, frame_duration_ms_, models_list_);
         audio_processor_initialized_ = true;
     }
 
@@ -644,9 +913,12 @@ void AudioService::PlaySound(const std::string_view& ogg) {
     demuxer->OnDemuxerFinished([this](const uint8_t* data, int sample_rate, size_t size){
         auto packet = std::make_unique<AudioStreamPacket>();
         packet->sample_rate = sample_rate;
-        packet->frame_duration = 60;
         packet->payload.resize(size);
         std::memcpy(packet->payload.data(), data, size);
+        packet->frame_duration = GetOpusPacketDuration(packet->payload);
+        if (!IsSupportedFrameDuration(packet->frame_duration)) {
+            packet->frame_duration = OPUS_FRAME_DURATION_MS;
+        }
         PushPacketToDecodeQueue(std::move(packet), true);
     });
     demuxer->Reset();
@@ -666,7 +938,7 @@ void AudioService::WaitForPlaybackQueueEmpty() {
 }
 
 void AudioService::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
     std::unique_lock<std::mutex> decoder_lock(decoder_mutex_);
     if (opus_decoder_ != nullptr) {
         esp_opus_dec_reset(opus_decoder_);
@@ -676,7 +948,24 @@ void AudioService::ResetDecoder() {
     audio_decode_queue_.clear();
     audio_playback_queue_.clear();
     audio_testing_queue_.clear();
+    // The dropped audio is skipped
+    playback_position_ms_ = queued_position_ms_;
     audio_queue_cv_.notify_all();
+    lock.unlock();
+
+    if (callbacks_.on_decoder_reset) {
+        callbacks_.on_decoder_reset();
+    }
+}
+
+int64_t AudioService::GetQueuedPosition() {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    return queued_position_ms_;
+}
+
+int64_t AudioService::GetPlaybackPosition() {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    return playback_position_ms_;
 }
 
 void AudioService::CheckAndUpdateAudioPowerState() {
@@ -6,6 +6,7 @@
 #include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -36,13 +37,37 @@
  * 
  */
 
+// Default frame duration, the actual one (10/20/40/60 ms) is negotiated in the hello
 #define OPUS_FRAME_DURATION_MS 60
-#define MAX_ENCODE_TASKS_IN_QUEUE 2
-#define MAX_PLAYBACK_TASKS_IN_QUEUE 2
-#define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
-#define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+// Queue limits are in milliseconds of audio, so they hold for any frame duration
+#define MAX_ENCODE_QUEUE_DURATION_MS 120
+#define MAX_PLAYBACK_QUEUE_DURATION_MS 120
+#define MAX_DECODE_QUEUE_DURATION_MS 2400
+#define MAX_SEND_QUEUE_DURATION_MS 2400
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
 #define MAX_TIMESTAMPS_IN_QUEUE 3
+// Incoming audio is held at the start of each burst until this many times the measured downlink jitter is queued,
+// or for as long when the burst is shorter
+#define JITTER_BUFFER_JITTER_FACTOR 2
+#define JITTER_BUFFER_MAX_MS 300
+#define JITTER_BUFFER_POLL_MS 10
+
+// Runtime encoder control driven by the measured uplink quality, each level has an enter and an exit threshold
+#define OPUS_FEC_ENABLE_LOSS_PERCENT 3
+#define OPUS_FEC_DISABLE_LOSS_PERCENT 1
+#define OPUS_LOW_BITRATE_LOSS_PERCENT 10
+#define OPUS_LOW_BITRATE_EXIT_LOSS_PERCENT 5
+#define OPUS_LOW_BITRATE_RTT_MS 800
+#define OPUS_LOW_BITRATE_EXIT_RTT_MS 600
+// The link level changes by one step at most, after it was kept for this long
+#define LINK_QUALITY_MIN_DWELL_MS 30000
+// Without a loss reported by the server, the loss is measured over this many probes (one every 5 seconds),
+// and a single probe without a pong is ignored: on a TCP link it is a stall rather than a lost packet
+#define LINK_PROBE_WINDOW 12
+#define LINK_PROBE_MIN_LOST 2
+#define OPUS_FEC_BITRATE 24000
+#define OPUS_LOW_BITRATE 16000
+#define OPUS_MAX_ADAPTIVE_COMPLEXITY 5
 
 #define AUDIO_POWER_TIMEOUT_MS 15000
 #define AUDIO_POWER_CHECK_INTERVAL_MS 1000
@@ -80,6 +105,7 @@ struct AudioServiceCallbacks {
     std::function<void(const std::string&)> on_wake_word_detected;
     std::function<void(bool)> on_vad_change;
     std::function<void(void)> on_audio_testing_queue_full;
+    std::function<void(void)> on_decoder_reset;
 };
 
 
@@ -93,6 +119,8 @@ struct AudioTask {
     AudioTaskType type;
     std::vector<int16_t> pcm;
     uint32_t timestamp;
+    int64_t capture_time_us = 0;
+    int64_t playback_position_ms = 0;
 };
 
 struct DebugStatistics {
@@ -102,6 +130,36 @@ struct DebugStatistics {
     uint32_t playback_count = 0;
 };
 
+struct OpusEncoderSettings {
+    int bitrate = ESP_OPUS_BITRATE_AUTO;
+    int complexity = 0;
+    bool enable_fec = false;
+
+    bool operator==(const OpusEncoderSettings& other) const {
+        return bitrate == other.bitrate && complexity == other.complexity && enable_fec == other.enable_fec;
+    }
+};
+
+enum LinkLevel {
+    kLinkGood,
+    kLinkFec,           // Redundant data for the lost packets
+    kLinkLowBitrate,    // FEC and a lower bitrate
+};
+
+struct OpusEncoderStatus {
+    OpusEncoderSettings settings;   // Settings of the running encoder
+    int packet_loss = 0;            // Estimated uplink packet loss in percent
+    LinkLevel link_level = kLinkGood;
+    int encode_load = 0;            // Average encode time in percent of the frame duration
+    uint32_t reconfigurations = 0;
+    uint32_t reconfigure_failures = 0;
+    int frame_duration = OPUS_FRAME_DURATION_MS;
+    // Mic-to-wire latency of the frames sent with the current frame duration
+    uint32_t latency_frames = 0;
+    int latency_average_ms = 0;
+    int latency_max_ms = 0;
+};
+
 class AudioService {
 public:
     AudioService();
@@ -128,11 +186,25 @@ public:
     void SetCallbacks(AudioServiceCallbacks& callbacks);
 
     bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
+    // Playout delay added at the start of each burst of incoming audio, follows the jitter in UpdateLinkQuality()
+    int GetJitterBufferDepth();
     std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
     void PlaySound(const std::string_view& sound);
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
+    // Positions in the playback stream, in ms of audio: the end of the audio queued for decoding and the end
+    // of the audio written to the codec. Dropped audio counts as played, the positions never go back.
+    int64_t GetQueuedPosition();
+    int64_t GetPlaybackPosition();
     void SetModelsList(srmodel_list_t* models_list);
+    void UpdateLinkQuality(const ProtocolStatistics& statistics);
+    OpusEncoderStatus GetEncoderStatus();
+    void RecordSendLatency(int64_t capture_time_us);
+
+    int GetFrameDuration() const { return frame_duration_ms_.load(); }
+    void SetFrameDuration(int frame_duration_ms);
+    int GetPreferredFrameDuration() const { return preferred_frame_duration_ms_; }
+    bool SetPreferredFrameDuration(int frame_duration_ms);
 
 private:
     AudioCodec* codec_ = nullptr;
@@ -158,6 +230,23 @@ private:
     DebugStatistics debug_statistics_;
     srmodel_list_t* models_list_ = nullptr;
 
+    // Frame duration of the audio processor output, the encoder follows it
+    // Set on the main task when the audio channel opens, read by the audio tasks
+    std::atomic<int> frame_duration_ms_ = OPUS_FRAME_DURATION_MS;
+    int preferred_frame_duration_ms_ = OPUS_FRAME_DURATION_MS;
+
+    // Encoder control, the settings are applied by the codec task between two frames
+    std::mutex encoder_control_mutex_;
+    OpusEncoderStatus encoder_status_;
+    OpusEncoderSettings pending_encoder_settings_;
+    bool encoder_settings_pending_ = false;
+    ProtocolStatistics last_link_statistics_;
+    uint32_t probe_window_sent_ = 0;
+    uint32_t probe_window_lost_ = 0;
+    int64_t link_level_time_us_ = 0;
+    int64_t encode_time_us_ = 0;
+    uint32_t encode_frames_ = 0;
+
     EventGroupHandle_t event_group_;
 
     // Audio encode / decode
@@ -173,6 +262,12 @@ private:
     std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
     // For server AEC
     std::deque<uint32_t> timestamp_queue_;
+    int64_t queued_position_ms_ = 0;
+    int64_t playback_position_ms_ = 0;
+    // Jitter buffer, guarded by audio_queue_mutex_
+    int jitter_buffer_ms_ = 0;
+    bool decode_buffering_ = false;
+    int64_t decode_buffering_start_us_ = 0;
 
     bool wake_word_initialized_ = false;
     bool audio_processor_initialized_ = false;
@@ -189,6 +284,9 @@ private:
     void OpusCodecTask();
     void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
+    // With audio_queue_mutex_ held, false while the jitter buffer is filling
+    bool IsDecodeReady();
+    void ApplyPendingEncoderSettings(int frame_duration_ms);
     void CheckAndUpdateAudioPowerState();
 };
 
@@ -165,21 +165,22 @@ void AfeAudioProcessor::AudioProcessorTask() {
 
         if (output_callback_) {
             size_t samples = res->data_size / sizeof(int16_t);
+            size_t frame_samples = frame_samples_;
             
             // Add data to buffer
             output_buffer_.insert(output_buffer_.end(), res->data, res->data + samples);
             
             // Output complete frames when buffer has enough data
-            while (output_buffer_.size() >= frame_samples_) {
-                if (output_buffer_.size() == frame_samples_) {
+            while (output_buffer_.size() >= frame_samples) {
+                if (output_buffer_.size() == frame_samples) {
                     // If buffer size equals frame size, move the entire buffer
                     output_callback_(std::move(output_buffer_));
                     output_buffer_.clear();
-                    output_buffer_.reserve(frame_samples_);
+                    output_buffer_.reserve(frame_samples);
                 } else {
                     // If buffer size exceeds frame size, copy one frame and remove it
-                    output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples_));
-                    output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
+                    output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples));
+                    output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples);
                 }
             }
         }
@@ -199,3 +200,8 @@ void AfeAudioProcessor::EnableDeviceAec(bool enable) {
         afe_iface_->enable_vad(afe_data_);
     }
 }
+
+void AfeAudioProcessor::SetFrameDuration(int frame_duration_ms) {
+    // Only the output framing changes, the AFE keeps its own chunk size
+    frame_samples_ = frame_duration_ms * 16000 / 1000;
+}
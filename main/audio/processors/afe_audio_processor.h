@@ -10,6 +10,7 @@
 #include <vector>
 #include <functional>
 #include <mutex>
+#include <atomic>
 
 #include "audio_processor.h"
 #include "audio_codec.h"
@@ -28,6 +29,7 @@ public:
     void OnVadStateChange(std::function<void(bool speaking)> callback) override;
     size_t GetFeedSize() override;
     void EnableDeviceAec(bool enable) override;
+    void SetFrameDuration(int frame_duration_ms) override;
 
 private:
     EventGroupHandle_t event_group_ = nullptr;
@@ -36,7 +38,7 @@ private:
     std::function<void(std::vector<int16_t>&& data)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     AudioCodec* codec_ = nullptr;
-    int frame_samples_ = 0;
+    std::atomic<int> frame_samples_ = 0;
     bool is_speaking_ = false;
     std::vector<int16_t> input_buffer_;
     std::mutex input_buffer_mutex_;
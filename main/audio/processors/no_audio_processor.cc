@@ -23,15 +23,19 @@ void NoAudioProcessor::Feed(std::vector<int16_t>&& data) {
         output_buffer_.insert(output_buffer_.end(), data.begin(), data.end());
     }
 
-    // Output complete frames when buffer has enough data
-    while (output_buffer_.size() >= (size_t)frame_samples_) {
-        if (output_buffer_.size() == (size_t)frame_samples_) {
+    // Output complete frames when buffer has enough data, with the frame size read once per feed
+    size_t frame_samples = frame_samples_;
+    if (frame_samples == 0) {
+        return;
+    }
+    while (output_buffer_.size() >= frame_samples) {
+        if (output_buffer_.size() == frame_samples) {
             output_callback_(std::move(output_buffer_));
             output_buffer_.clear();
-            output_buffer_.reserve(frame_samples_);
+            output_buffer_.reserve(frame_samples);
         } else {
-            output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples_));
-            output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
+            output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples));
+            output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples);
         }
     }
 }
@@ -69,3 +73,7 @@ void NoAudioProcessor::EnableDeviceAec(bool enable) {
         ESP_LOGE(TAG, "Device AEC is not supported");
     }
 }
+
+void NoAudioProcessor::SetFrameDuration(int frame_duration_ms) {
+    frame_samples_ = frame_duration_ms * 16000 / 1000;
+}
@@ -22,10 +22,11 @@ public:
     void OnVadStateChange(std::function<void(bool speaking)> callback) override;
     size_t GetFeedSize() override;
     void EnableDeviceAec(bool enable) override;
+    void SetFrameDuration(int frame_duration_ms) override;
 
 private:
     AudioCodec* codec_ = nullptr;
-    int frame_samples_ = 0;
+    std::atomic<int> frame_samples_ = 0;    // Set by SetFrameDuration() while the input task feeds
     std::vector<int16_t> output_buffer_;
     std::function<void(std::vector<int16_t>&& data)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
@@ -3,10 +3,26 @@
 #include "display.h"
 #include "assets/lang_config.h"
 #include "settings.h"
+#include "mcp_server.h"
 #include <esp_log.h>
+#include <ssid_manager.h>
 
 static const char *TAG = "DualNetworkBoard";
 
+// Interval of the link health probe, and the number of failed probes in a row before failing over
+static constexpr int HEALTH_PROBE_INTERVAL_MS = 5000;
+static constexpr int FAILOVER_FAILED_PROBES = 2;
+
+static const char* GetNetworkName(NetworkType type) {
+    return type == NetworkType::ML307 ? "ML307" : "WiFi";
+}
+
+static void SetWifiStandby(Board* board, NetworkType type, bool standby) {
+    if (type == NetworkType::WIFI) {
+        static_cast<WifiBoard*>(board)->SetStandby(standby);
+    }
+}
+
 DualNetworkBoard::DualNetworkBoard(gpio_num_t ml307_tx_pin, gpio_num_t ml307_rx_pin, gpio_num_t ml307_dtr_pin, int32_t default_net_type) 
     : Board(), 
       ml307_tx_pin_(ml307_tx_pin), 
@@ -18,6 +34,37 @@ DualNetworkBoard::DualNetworkBoard(gpio_num_t ml307_tx_pin, gpio_num_t ml307_rx_
     
     // 只初始化当前网络类型对应的板卡
     InitializeCurrentBoard();
+
+    Settings settings("network", false);
+    failover_enabled_ = settings.GetInt("failover", 0) != 0;
+    if (failover_enabled_) {
+        // 备用网络在后台保持连接，当前网络故障时无需重新启动
+        auto standby_type = network_type_ == NetworkType::ML307 ? NetworkType::WIFI : NetworkType::ML307;
+        standby_board_ = CreateBoard(standby_type);
+        SetWifiStandby(standby_board_.get(), standby_type, true);
+
+        esp_timer_create_args_t probe_timer_args = {
+            .callback = [](void* arg) {
+                auto board = static_cast<DualNetworkBoard*>(arg);
+                Application::GetInstance().Schedule([board]() {
+                    board->CheckLinkHealth();
+                });
+            },
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "link_probe",
+            .skip_unhandled_events = true,
+        };
+        esp_timer_create(&probe_timer_args, &probe_timer_);
+    }
+    InitializeFailoverTools();
+}
+
+DualNetworkBoard::~DualNetworkBoard() {
+    if (probe_timer_ != nullptr) {
+        esp_timer_stop(probe_timer_);
+        esp_timer_delete(probe_timer_);
+    }
 }
 
 NetworkType DualNetworkBoard::LoadNetworkTypeFromSettings(int32_t default_net_type) {
@@ -33,12 +80,160 @@ void DualNetworkBoard::SaveNetworkTypeToSettings(NetworkType type) {
 }
 
 void DualNetworkBoard::InitializeCurrentBoard() {
-    if (network_type_ == NetworkType::ML307) {
+    current_board_ = CreateBoard(network_type_);
+    active_board_ = current_board_.get();
+}
+
+std::unique_ptr<Board> DualNetworkBoard::CreateBoard(NetworkType type) {
+    if (type == NetworkType::ML307) {
         ESP_LOGI(TAG, "Initialize ML307 board");
-        current_board_ = std::make_unique<Ml307Board>(ml307_tx_pin_, ml307_rx_pin_, ml307_dtr_pin_);
+        return std::make_unique<Ml307Board>(ml307_tx_pin_, ml307_rx_pin_, ml307_dtr_pin_);
     } else {
         ESP_LOGI(TAG, "Initialize WiFi board");
-        current_board_ = std::make_unique<WifiBoard>();
+        return std::make_unique<WifiBoard>();
+    }
+}
+
+void DualNetworkBoard::OnBoardNetworkEvent(NetworkType type, NetworkEvent event, const std::string& data) {
+    bool is_current = type == network_type_;
+    if (event == NetworkEvent::Connected || event == NetworkEvent::Disconnected) {
+        bool connected = event == NetworkEvent::Connected;
+        if (is_current) {
+            current_connected_ = connected;
+        } else {
+            standby_connected_ = connected;
+            ESP_LOGI(TAG, "Standby %s network %s", GetNetworkName(type), connected ? "connected" : "disconnected");
+        }
+    }
+
+    if (!is_current) {
+        // Events of the standby network are not shown to the user
+        return;
+    }
+
+    if (event == NetworkEvent::Disconnected && standby_board_ && standby_connected_) {
+        // Keep the conversation, the standby network takes over
+        Application::GetInstance().Schedule([this]() {
+            Failover("link down");
+        });
+        return;
+    }
+
+    if (network_event_callback_) {
+        network_event_callback_(event, data);
+    }
+}
+
+void DualNetworkBoard::CheckLinkHealth() {
+    ProtocolStatistics statistics;
+    if (!Application::GetInstance().GetProtocolStatistics(statistics)) {
+        return;
+    }
+
+    // A probe window fails when pings got no pong or packets could not be sent
+    uint32_t pings = statistics.pings_sent - last_statistics_.pings_sent;
+    uint32_t pongs = statistics.pongs_received - last_statistics_.pongs_received;
+    uint32_t tx_failures = statistics.tx_failures - last_statistics_.tx_failures;
+    last_statistics_ = statistics;
+
+    if ((pings > 0 && pongs == 0) || tx_failures > 0) {
+        failed_probes_++;
+        ESP_LOGW(TAG, "Link probe failed (%d/%d), pings=%lu pongs=%lu tx_failures=%lu rtt=%dms", failed_probes_,
+            FAILOVER_FAILED_PROBES, pings, pongs, tx_failures, statistics.rtt_ms);
+    } else if (pongs > 0) {
+        failed_probes_ = 0;
+    }
+
+    if (failed_probes_ >= FAILOVER_FAILED_PROBES) {
+        Failover("probe timeout");
+    }
+}
+
+void DualNetworkBoard::Failover(const char* reason) {
+    if (!standby_board_ || !standby_connected_) {
+        ESP_LOGW(TAG, "Cannot fail over (%s), standby network is not connected", reason);
+        return;
+    }
+
+    auto start_time = esp_timer_get_time();
+    auto new_type = network_type_ == NetworkType::ML307 ? NetworkType::WIFI : NetworkType::ML307;
+    ESP_LOGW(TAG, "Fail over from %s to %s: %s", GetNetworkName(network_type_), GetNetworkName(new_type), reason);
+
+    // The demoted WiFi board keeps retrying in the background, the promoted one may enter config mode again
+    SetWifiStandby(current_board_.get(), network_type_, true);
+    SetWifiStandby(standby_board_.get(), new_type, false);
+    std::swap(current_board_, standby_board_);
+    std::swap(current_connected_, standby_connected_);
+    // Both boards stay alive, readers on other tasks see either the old or the new one
+    active_board_ = current_board_.get();
+    network_type_ = new_type;
+    failed_probes_ = 0;
+    failovers_++;
+
+    auto display = Board::GetInstance().GetDisplay();
+    display->ShowNotification(new_type == NetworkType::ML307 ? Lang::Strings::SWITCH_TO_4G_NETWORK : Lang::Strings::SWITCH_TO_WIFI_NETWORK);
+    display->UpdateStatusBar(true);
+
+    auto& app = Application::GetInstance();
+    if (!app.ReopenAudioChannel()) {
+        // The application has gone back to idle, the next conversation opens a channel on the new network
+        ESP_LOGE(TAG, "Failed to reopen the audio channel on %s", GetNetworkName(new_type));
+        return;
+    }
+    last_switchover_ms_ = (int)((esp_timer_get_time() - start_time) / 1000);
+    ESP_LOGI(TAG, "Switched over to %s in %d ms", GetNetworkName(new_type), last_switchover_ms_);
+}
+
+std::string DualNetworkBoard::GetFailoverStatusJson() {
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "network", GetNetworkName(network_type_));
+    cJSON_AddBoolToObject(json, "failover_enabled", failover_enabled_);
+    cJSON_AddBoolToObject(json, "connected", current_connected_);
+    cJSON_AddBoolToObject(json, "standby_connected", standby_connected_);
+    cJSON_AddNumberToObject(json, "failed_probes", failed_probes_);
+    cJSON_AddNumberToObject(json, "failovers", failovers_);
+    cJSON_AddNumberToObject(json, "last_switchover_ms", last_switchover_ms_);
+    auto json_str = cJSON_PrintUnformatted(json);
+    std::string result(json_str);
+    cJSON_free(json_str);
+    cJSON_Delete(json);
+    return result;
+}
+
+void DualNetworkBoard::InitializeFailoverTools() {
+    auto& mcp_server = McpServer::GetInstance();
+    mcp_server.AddUserOnlyTool("self.network.get_failover_status",
+        "Get the active network, the standby network state and the failover counters",
+        PropertyList(),
+        [this](const PropertyList& properties) -> ReturnValue {
+            return GetFailoverStatusJson();
+        });
+
+    mcp_server.AddUserOnlyTool("self.network.set_failover",
+        "Enable or disable keeping the other network connected as a standby link for automatic failover. "
+        "Takes effect after reboot.",
+        PropertyList({
+            Property("enabled", kPropertyTypeBoolean)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            Settings settings("network", true);
+            settings.SetInt("failover", properties["enabled"].value<bool>() ? 1 : 0);
+            return true;
+        });
+
+    if (failover_enabled_) {
+        mcp_server.AddUserOnlyTool("self.network.simulate_failure",
+            "Simulate a failure of the active network to test the failover to the standby network",
+            PropertyList(),
+            [this](const PropertyList& properties) -> ReturnValue {
+                if (!standby_connected_) {
+                    throw std::runtime_error("Standby network is not connected");
+                }
+                Application::GetInstance().Schedule([this]() {
+                    Failover("simulated failure");
+                });
+                return true;
+            });
     }
 }
 
@@ -58,7 +253,7 @@ void DualNetworkBoard::SwitchNetworkType() {
 
  
 std::string DualNetworkBoard::GetBoardType() {
-    return current_board_->GetBoardType();
+    return active_board_.load()->GetBoardType();
 }
 
 void DualNetworkBoard::StartNetwork() {
@@ -70,29 +265,51 @@ void DualNetworkBoard::StartNetwork() {
         display->SetStatus(Lang::Strings::DETECTING_MODULE);
     }
     current_board_->StartNetwork();
+
+    if (standby_board_) {
+        auto standby_type = network_type_ == NetworkType::ML307 ? NetworkType::WIFI : NetworkType::ML307;
+        if (standby_type == NetworkType::WIFI && SsidManager::GetInstance().GetSsidList().empty()) {
+            ESP_LOGW(TAG, "No WiFi configured, failover is not available");
+            standby_board_.reset();
+        } else {
+            ESP_LOGI(TAG, "Start standby %s network", GetNetworkName(standby_type));
+            standby_board_->StartNetwork();
+            esp_timer_start_periodic(probe_timer_, HEALTH_PROBE_INTERVAL_MS * 1000);
+        }
+    }
 }
 
 void DualNetworkBoard::SetNetworkEventCallback(NetworkEventCallback callback) {
-    // Forward the callback to the current board
-    current_board_->SetNetworkEventCallback(std::move(callback));
+    // Route the events through the dual network board, so the standby network can be tracked
+    network_event_callback_ = std::move(callback);
+    NetworkType current_type = network_type_;
+    auto standby_type = network_type_ == NetworkType::ML307 ? NetworkType::WIFI : NetworkType::ML307;
+    current_board_->SetNetworkEventCallback([this, current_type](NetworkEvent event, const std::string& data) {
+        OnBoardNetworkEvent(current_type, event, data);
+    });
+    if (standby_board_) {
+        standby_board_->SetNetworkEventCallback([this, standby_type](NetworkEvent event, const std::string& data) {
+            OnBoardNetworkEvent(standby_type, event, data);
+        });
+    }
 }
 
 NetworkInterface* DualNetworkBoard::GetNetwork() {
-    return current_board_->GetNetwork();
+    return active_board_.load()->GetNetwork();
 }
 
 const char* DualNetworkBoard::GetNetworkStateIcon() {
-    return current_board_->GetNetworkStateIcon();
+    return active_board_.load()->GetNetworkStateIcon();
 }
 
 void DualNetworkBoard::SetPowerSaveLevel(PowerSaveLevel level) {
-    current_board_->SetPowerSaveLevel(level);
+    active_board_.load()->SetPowerSaveLevel(level);
 }
 
 std::string DualNetworkBoard::GetBoardJson() {   
-    return current_board_->GetBoardJson();
+    return active_board_.load()->GetBoardJson();
 }
 
 std::string DualNetworkBoard::GetDeviceStatusJson() {
-    return current_board_->GetDeviceStatusJson();
+    return active_board_.load()->GetDeviceStatusJson();
 }
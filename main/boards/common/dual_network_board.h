@@ -4,7 +4,10 @@
 #include "board.h"
 #include "wifi_board.h"
 #include "ml307_board.h"
+#include "protocol.h"
+#include <esp_timer.h>
 #include <memory>
+#include <atomic>
 
 //enum NetworkType
 enum class NetworkType {
@@ -17,7 +20,21 @@ class DualNetworkBoard : public Board {
 private:
     // 使用基类指针存储当前活动的板卡
     std::unique_ptr<Board> current_board_;
-    NetworkType network_type_ = NetworkType::ML307;  // Default to ML307
+    // 其他任务通过它读取当前板卡，故障切换时两块板卡都不会被释放
+    std::atomic<Board*> active_board_ = nullptr;
+    std::atomic<NetworkType> network_type_ = NetworkType::ML307;  // Default to ML307
+
+    // 故障切换：备用网络保持连接，当前网络探测失败时切换到备用网络
+    std::unique_ptr<Board> standby_board_;
+    bool failover_enabled_ = false;
+    bool current_connected_ = false;
+    bool standby_connected_ = false;
+    NetworkEventCallback network_event_callback_;
+    esp_timer_handle_t probe_timer_ = nullptr;
+    ProtocolStatistics last_statistics_;
+    int failed_probes_ = 0;
+    uint32_t failovers_ = 0;
+    int last_switchover_ms_ = -1;
 
     // ML307的引脚配置
     gpio_num_t ml307_tx_pin_;
@@ -32,19 +49,28 @@ private:
 
     // 初始化当前网络类型对应的板卡
     void InitializeCurrentBoard();
+
+    std::unique_ptr<Board> CreateBoard(NetworkType type);
+    void OnBoardNetworkEvent(NetworkType type, NetworkEvent event, const std::string& data);
+    void CheckLinkHealth();
+    void Failover(const char* reason);
+    void InitializeFailoverTools();
  
 public:
     DualNetworkBoard(gpio_num_t ml307_tx_pin, gpio_num_t ml307_rx_pin, gpio_num_t ml307_dtr_pin = GPIO_NUM_NC, int32_t default_net_type = 1);
-    virtual ~DualNetworkBoard() = default;
+    virtual ~DualNetworkBoard();
  
     // 切换网络类型
     void SwitchNetworkType();
     
     // 获取当前网络类型
     NetworkType GetNetworkType() const { return network_type_; }
+
+    // 获取故障切换状态
+    std::string GetFailoverStatusJson();
     
     // 获取当前活动的板卡引用
-    Board& GetCurrentBoard() const { return *current_board_; }
+    Board& GetCurrentBoard() const { return *active_board_.load(); }
     
     // 重写Board接口
     virtual std::string GetBoardType() override;
@@ -13,6 +13,8 @@
 #include "mcp_server.h"
 #include "system_info.h"
 #include "jpg/image_to_jpeg.h"
+#include "jpg/jpeg_to_image.h"
+#include "pixel_convert.h"
 #include "esp_timer.h"
 
 #define TAG "Esp32Camera"
@@ -97,12 +99,8 @@ bool Esp32Camera::Capture() {
         }
 
         // Copy data to encode buffer with optional byte swapping
-        uint16_t *src = (uint16_t *)current_fb_->buf;
-        uint16_t *dst = (uint16_t *)encode_buf_;
         if (swap_bytes_enabled_) {
-            for (size_t i = 0; i < pixel_count; i++) {
-                dst[i] = __builtin_bswap16(src[i]);
-            }
+            pixel_swap16(encode_buf_, current_fb_->buf, pixel_count);
         } else {
             memcpy(encode_buf_, current_fb_->buf, data_size);
         }
@@ -119,8 +117,23 @@ bool Esp32Camera::Capture() {
             }
         }
     } else if (current_fb_->format == PIXFORMAT_JPEG) {
+#ifndef CONFIG_IDF_TARGET_ESP32
+        // Decode the preview to the screen size, the IDCT scaling skips most of the work on large frames
+        auto display = dynamic_cast<LvglDisplay *>(Board::GetInstance().GetDisplay());
+        if (display != nullptr) {
+            uint8_t *preview_data = nullptr;
+            size_t preview_len, width, height, stride;
+            if (jpeg_to_image_scaled(current_fb_->buf, current_fb_->len, display->width(), display->height(), false,
+                                     &preview_data, &preview_len, &width, &height, &stride) == ESP_OK) {
+                display->SetPreviewImage(std::make_unique<LvglAllocatedImage>(preview_data, preview_len, width, height, stride, LV_COLOR_FORMAT_RGB565));
+            } else {
+                ESP_LOGW(TAG, "JPEG capture success, len=%zu, but the preview failed to decode", current_fb_->len);
+            }
+        }
+#else
         // JPEG format preview usually requires decoding, skip preview display for now, just log
         ESP_LOGW(TAG, "JPEG capture success, len=%zu, but not supported for preview", current_fb_->len);
+#endif
     }
 
     ESP_LOGI(TAG, "Captured frame: %dx%d, len=%zu, format=%d",
@@ -21,6 +21,7 @@
 #include "esp_jpeg_common.h"
 #include "jpg/image_to_jpeg.h"
 #include "jpg/jpeg_to_image.h"
+#include "pixel_convert.h"
 #include "lvgl_display.h"
 #include "mcp_server.h"
 #include "system_info.h"
@@ -439,14 +440,7 @@ bool EspVideo::Capture() {
                 case V4L2_PIX_FMT_JPEG:
 #endif  // CONFIG_XIAOZHI_CAMERA_ALLOW_JPEG_INPUT
 #ifdef CONFIG_XIAOZHI_ENABLE_CAMERA_ENDIANNESS_SWAP
-                {
-                    auto src16 = (uint16_t*)mmap_buffers_[buf.index].start;
-                    auto dst16 = (uint16_t*)frame_.data;
-                    size_t count = (size_t)mmap_buffers_[buf.index].length / 2;
-                    for (size_t i = 0; i < count; i++) {
-                        dst16[i] = __builtin_bswap16(src16[i]);
-                    }
-                }
+                    pixel_swap16(frame_.data, mmap_buffers_[buf.index].start, (size_t)mmap_buffers_[buf.index].length / 2);
 #else
                     memcpy(frame_.data, mmap_buffers_[buf.index].start,
                            MIN(mmap_buffers_[buf.index].length, frame_.len));
@@ -457,14 +451,7 @@ bool EspVideo::Capture() {
                     // 这个格式是 422 YUYV，不是 planer
                     frame_.format = V4L2_PIX_FMT_YUYV;
 #ifdef CONFIG_XIAOZHI_ENABLE_CAMERA_ENDIANNESS_SWAP
-                    {
-                        auto src16 = (uint16_t*)mmap_buffers_[buf.index].start;
-                        auto dst16 = (uint16_t*)frame_.data;
-                        size_t count = (size_t)mmap_buffers_[buf.index].length / 2;
-                        for (size_t i = 0; i < count; i++) {
-                            dst16[i] = __builtin_bswap16(src16[i]);
-                        }
-                    }
+                    pixel_swap16(frame_.data, mmap_buffers_[buf.index].start, (size_t)mmap_buffers_[buf.index].length / 2);
 #else
                     memcpy(frame_.data, mmap_buffers_[buf.index].start,
                            MIN(mmap_buffers_[buf.index].length, frame_.len));
@@ -474,12 +461,7 @@ bool EspVideo::Capture() {
                 case V4L2_PIX_FMT_RGB565X: {
                     // 大端序的 RGB565 需要转换为小端序
                     // 目前 esp_video 的大小端都会返回格式为 RGB565，不会返回格式为 RGB565X，此 case 用于未来版本兼容
-                    auto src16 = (uint16_t*)mmap_buffers_[buf.index].start;
-                    auto dst16 = (uint16_t*)frame_.data;
-                    size_t pixel_count = (size_t)frame_.width * (size_t)frame_.height;
-                    for (size_t i = 0; i < pixel_count; i++) {
-                        dst16[i] = __builtin_bswap16(src16[i]);
-                    }
+                    pixel_swap16(frame_.data, mmap_buffers_[buf.index].start, (size_t)frame_.width * (size_t)frame_.height);
                     frame_.format = V4L2_PIX_FMT_RGB565;
                     break;
                 }
@@ -595,16 +577,9 @@ bool EspVideo::Capture() {
                         }
                         return false;
                     }
-                    esp_imgfx_color_convert_cfg_t convert_cfg = {
-                        .in_res = {.width = static_cast<int16_t>(frame_.width),
-                                   .height = static_cast<int16_t>(frame_.height)},
-                        .in_pixel_fmt = ESP_IMGFX_PIXEL_FMT_YUYV,
-                        .out_pixel_fmt = ESP_IMGFX_PIXEL_FMT_RGB888,
-                    };
-                    esp_imgfx_color_convert_handle_t convert_handle = nullptr;
-                    esp_imgfx_err_t err = esp_imgfx_color_convert_open(&convert_cfg, &convert_handle);
-                    if (err != ESP_IMGFX_ERR_OK || convert_handle == nullptr) {
-                        ESP_LOGE(TAG, "esp_imgfx_color_convert_open failed");
+                    if (!pixel_convert_imgfx(frame_.data, frame_.len, ESP_IMGFX_PIXEL_FMT_YUYV, rotate_src,
+                                             frame_.width * frame_.height * 3, ESP_IMGFX_PIXEL_FMT_RGB888,
+                                             frame_.width, frame_.height)) {
                         heap_caps_free(rotate_src);
                         rotate_src = nullptr;
                         if (ioctl(video_fd_, VIDIOC_QBUF, &buf) != 0) {
@@ -612,28 +587,6 @@ bool EspVideo::Capture() {
                         }
                         return false;
                     }
-                    esp_imgfx_data_t convert_input_data = {
-                        .data = frame_.data,
-                        .data_len = frame_.len,
-                    };
-                    esp_imgfx_data_t convert_output_data = {
-                        .data = rotate_src,
-                        .data_len = static_cast<uint32_t>(frame_.width * frame_.height * 3),
-                    };
-                    err = esp_imgfx_color_convert_process(convert_handle, &convert_input_data, &convert_output_data);
-                    if (err != ESP_IMGFX_ERR_OK) {
-                        ESP_LOGE(TAG, "esp_imgfx_color_convert_process failed");
-                        heap_caps_free(rotate_src);
-                        rotate_src = nullptr;
-                        esp_imgfx_color_convert_close(convert_handle);
-                        convert_handle = nullptr;
-                        if (ioctl(video_fd_, VIDIOC_QBUF, &buf) != 0) {
-                            ESP_LOGE(TAG, "Cleanup: VIDIOC_QBUF failed");
-                        }
-                        return false;
-                    }
-                    esp_imgfx_color_convert_close(convert_handle);
-                    convert_handle = nullptr;
                     ppa_color_mode = PPA_SRM_COLOR_MODE_RGB888;
                     heap_caps_free(frame_.data);
                     frame_.data = rotate_src;
@@ -754,40 +707,12 @@ bool EspVideo::Capture() {
                     ESP_LOGE(TAG, "Failed to allocate memory for preview image");
                     return false;
                 }
-                esp_imgfx_color_convert_cfg_t convert_cfg = {
-                    .in_res = {.width = static_cast<int16_t>(frame_.width),
-                               .height = static_cast<int16_t>(frame_.height)},
-                    .in_pixel_fmt = static_cast<esp_imgfx_pixel_fmt_t>(frame_.format),
-                    .out_pixel_fmt = ESP_IMGFX_PIXEL_FMT_RGB565_LE,
-                    .color_space_std = ESP_IMGFX_COLOR_SPACE_STD_BT601,
-                };
-                esp_imgfx_color_convert_handle_t convert_handle = nullptr;
-                esp_imgfx_err_t err = esp_imgfx_color_convert_open(&convert_cfg, &convert_handle);
-                if (err != ESP_IMGFX_ERR_OK || convert_handle == nullptr) {
-                    ESP_LOGE(TAG, "esp_imgfx_color_convert_open failed");
-                    heap_caps_free(data);
-                    data = nullptr;
-                    return false;
-                }
-                esp_imgfx_data_t convert_input_data = {
-                    .data = frame_.data,
-                    .data_len = frame_.len,
-                };
-                esp_imgfx_data_t convert_output_data = {
-                    .data = data,
-                    .data_len = static_cast<uint32_t>(w * h * 2),
-                };
-                err = esp_imgfx_color_convert_process(convert_handle, &convert_input_data, &convert_output_data);
-                if (err != ESP_IMGFX_ERR_OK) {
-                    ESP_LOGE(TAG, "esp_imgfx_color_convert_process failed");
+                if (!pixel_convert_imgfx(frame_.data, frame_.len, static_cast<esp_imgfx_pixel_fmt_t>(frame_.format), data,
+                                         w * h * 2, ESP_IMGFX_PIXEL_FMT_RGB565_LE, frame_.width, frame_.height)) {
                     heap_caps_free(data);
                     data = nullptr;
-                    esp_imgfx_color_convert_close(convert_handle);
-                    convert_handle = nullptr;
                     return false;
                 }
-                esp_imgfx_color_convert_close(convert_handle);
-                convert_handle = nullptr;
                 lvgl_image_size = w * h * 2;
                 break;
             }
@@ -810,8 +735,9 @@ bool EspVideo::Capture() {
                 size_t out_height = 0;
                 size_t out_stride = 0;
 
-                esp_err_t ret =
-                    jpeg_to_image(frame_.data, frame_.len, &out_data, &out_len, &out_width, &out_height, &out_stride);
+                // 直接解码到屏幕大小，大图不再占用整幅的解码缓冲区
+                esp_err_t ret = jpeg_to_image_scaled(frame_.data, frame_.len, display->width(), display->height(), false,
+                                                     &out_data, &out_len, &out_width, &out_height, &out_stride);
                 if (ret != ESP_OK) {
                     ESP_LOGE(TAG, "Failed to decode JPEG image: %d (%s)", (int)ret, esp_err_to_name(ret));
                     if (out_data) {
@@ -4,6 +4,7 @@
 
 #define TAG "I2cDevice"
 
+std::atomic<uint32_t> I2cDevice::transaction_count_ = 0;
 
 I2cDevice::I2cDevice(i2c_master_bus_handle_t i2c_bus, uint8_t addr) {
     i2c_device_config_t i2c_device_cfg = {
@@ -21,15 +22,18 @@ I2cDevice::I2cDevice(i2c_master_bus_handle_t i2c_bus, uint8_t addr) {
 
 void I2cDevice::WriteReg(uint8_t reg, uint8_t value) {
     uint8_t buffer[2] = {reg, value};
+    transaction_count_++;
     ESP_ERROR_CHECK(i2c_master_transmit(i2c_device_, buffer, 2, 100));
 }
 
 uint8_t I2cDevice::ReadReg(uint8_t reg) {
     uint8_t buffer[1];
+    transaction_count_++;
     ESP_ERROR_CHECK(i2c_master_transmit_receive(i2c_device_, &reg, 1, buffer, 1, 100));
     return buffer[0];
 }
 
 void I2cDevice::ReadRegs(uint8_t reg, uint8_t* buffer, size_t length) {
+    transaction_count_++;
     ESP_ERROR_CHECK(i2c_master_transmit_receive(i2c_device_, &reg, 1, buffer, length, 100));
 }
\ No newline at end of file
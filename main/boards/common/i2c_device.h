@@ -2,17 +2,24 @@
 #define I2C_DEVICE_H
 
 #include <driver/i2c_master.h>
+#include <atomic>
 
 class I2cDevice {
 public:
     I2cDevice(i2c_master_bus_handle_t i2c_bus, uint8_t addr);
 
+    // Register reads and writes of all the devices since boot
+    static uint32_t GetTransactionCount() { return transaction_count_; }
+
 protected:
     i2c_master_dev_handle_t i2c_device_;
 
     void WriteReg(uint8_t reg, uint8_t value);
     uint8_t ReadReg(uint8_t reg);
     void ReadRegs(uint8_t reg, uint8_t* buffer, size_t length);
+
+private:
+    static std::atomic<uint32_t> transaction_count_;
 };
 
 #endif // I2C_DEVICE_H
@@ -95,6 +95,8 @@ void WifiBoard::TryWifiConnect() {
         ESP_LOGI(TAG, "Starting WiFi connection attempt");
         esp_timer_start_once(connect_timer_, CONNECT_TIMEOUT_SEC * 1000000ULL);
         WifiManager::GetInstance().StartStation();
+    } else if (standby_) {
+        ESP_LOGW(TAG, "No SSID configured, WiFi standby link is not available");
     } else {
         // No SSID configured, enter config mode
         // Wait for the board version to be shown
@@ -150,6 +152,10 @@ void WifiBoard::SetNetworkEventCallback(NetworkEventCallback callback) {
 
 void WifiBoard::OnWifiConnectTimeout(void* arg) {
     auto* board = static_cast<WifiBoard*>(arg);
+    if (board->standby_) {
+        ESP_LOGW(TAG, "WiFi standby connection timeout, keep retrying");
+        return;
+    }
     ESP_LOGW(TAG, "WiFi connection timeout, entering config mode");
 
     WifiManager::GetInstance().StopStation();
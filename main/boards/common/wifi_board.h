@@ -5,11 +5,13 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <esp_timer.h>
+#include <atomic>
 
 class WifiBoard : public Board {
 protected:
     esp_timer_handle_t connect_timer_ = nullptr;
     bool in_config_mode_ = false;
+    std::atomic<bool> standby_ = false;    // Changed on failover while the connect timer runs
     NetworkEventCallback network_event_callback_ = nullptr;
 
     virtual std::string GetBoardJson() override;
@@ -64,6 +66,12 @@ public:
      * Check if in WiFi config mode
      */
     bool IsInWifiConfigMode() const;
+
+    /**
+     * Standby mode is used when WiFi is the backup link of another network,
+     * the connection keeps retrying and never falls back to config mode
+     */
+    void SetStandby(bool standby) { standby_ = standby; }
 };
 
 #endif // WIFI_BOARD_H
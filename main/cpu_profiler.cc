@@ -0,0 +1,177 @@
+#include "cpu_profiler.h"
+#include "application.h"
+#include "device_state_machine.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "CpuProfiler"
+
+CpuProfiler::CpuProfiler() {
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            static_cast<CpuProfiler*>(arg)->TakeSample();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "cpu_profiler",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&timer_args, &timer_);
+}
+
+CpuProfiler::~CpuProfiler() {
+    if (timer_ != nullptr) {
+        esp_timer_stop(timer_);
+        esp_timer_delete(timer_);
+    }
+}
+
+void CpuProfiler::Start() {
+    Settings settings("profiler", false);
+    int period_ms = settings.GetInt("period_ms", CPU_PROFILER_DEFAULT_PERIOD_MS);
+    if (period_ms > 0) {
+        StartTimer(period_ms);
+    }
+}
+
+bool CpuProfiler::SetPeriod(int period_ms) {
+    if (period_ms != 0 && (period_ms < CPU_PROFILER_MIN_PERIOD_MS || period_ms > CPU_PROFILER_MAX_PERIOD_MS)) {
+        ESP_LOGE(TAG, "Invalid period: %d ms", period_ms);
+        return false;
+    }
+    Settings settings("profiler", true);
+    settings.SetInt("period_ms", period_ms);
+    StartTimer(period_ms);
+    return true;
+}
+
+void CpuProfiler::StartTimer(int period_ms) {
+    esp_timer_stop(timer_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    period_ms_ = period_ms > 0 ? period_ms : 0;
+    if (period_ms_ == 0) {
+        ESP_LOGI(TAG, "CPU profiler stopped");
+        return;
+    }
+
+    // Allocate once, sampling must not allocate
+    if (samples_.empty()) {
+        previous_tasks_.resize(CPU_PROFILER_MAX_TASKS);
+        current_tasks_.resize(CPU_PROFILER_MAX_TASKS);
+        samples_.resize(CPU_PROFILER_HISTORY);
+    }
+    // The first sample after a restart only records the run time counters
+    previous_task_count_ = 0;
+    esp_timer_start_periodic(timer_, (uint64_t)period_ms_ * 1000);
+    ESP_LOGI(TAG, "CPU profiler started, period %d ms", period_ms_);
+}
+
+void CpuProfiler::TakeSample() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (period_ms_ == 0) {
+        return;
+    }
+    auto start_time = esp_timer_get_time();
+    configRUN_TIME_COUNTER_TYPE run_time = 0;
+    UBaseType_t task_count = uxTaskGetSystemState(current_tasks_.data(), current_tasks_.size(), &run_time);
+    if (task_count == 0) {
+        ESP_LOGW(TAG, "More than %d tasks, sample skipped", CPU_PROFILER_MAX_TASKS);
+        return;
+    }
+
+    bool has_previous = previous_task_count_ > 0 && run_time > previous_run_time_;
+    uint64_t total_time = (uint64_t)(run_time - previous_run_time_) * CONFIG_FREERTOS_NUMBER_OF_CORES;
+    CpuProfilerSample sample = {};
+    uint64_t busy_time = 0;
+    if (has_previous) {
+        sample.time_us = start_time;
+        sample.device_state = Application::GetInstance().GetDeviceState();
+        for (UBaseType_t i = 0; i < task_count; i++) {
+            auto& task = current_tasks_[i];
+            // A task created since the previous sample ran for its whole counter
+            uint64_t task_time = task.ulRunTimeCounter;
+            for (UBaseType_t j = 0; j < previous_task_count_; j++) {
+                if (previous_tasks_[j].xHandle == task.xHandle) {
+                    task_time = task.ulRunTimeCounter - previous_tasks_[j].ulRunTimeCounter;
+                    break;
+                }
+            }
+            if (strncmp(task.pcTaskName, "IDLE", 4) == 0) {
+                continue;
+            }
+            busy_time += task_time;
+
+            // Keep the busiest tasks, sorted by CPU usage
+            uint8_t cpu_percent = std::min<uint64_t>(task_time * 100 / total_time, 100);
+            int position = sample.task_count;
+            while (position > 0 && sample.tasks[position - 1].cpu_percent < cpu_percent) {
+                position--;
+            }
+            if (position >= CPU_PROFILER_TOP_TASKS) {
+                continue;
+            }
+            int last = std::min(sample.task_count, (uint8_t)(CPU_PROFILER_TOP_TASKS - 1));
+            for (int k = last; k > position; k--) {
+                sample.tasks[k] = sample.tasks[k - 1];
+            }
+            auto& top_task = sample.tasks[position];
+            strncpy(top_task.name, task.pcTaskName, sizeof(top_task.name) - 1);
+            top_task.name[sizeof(top_task.name) - 1] = '\0';
+            top_task.cpu_percent = cpu_percent;
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+            top_task.core = task.xCoreID < CONFIG_FREERTOS_NUMBER_OF_CORES ? task.xCoreID : -1;
+#else
+            top_task.core = -1;
+#endif
+            top_task.stack_free = task.usStackHighWaterMark;
+            if (sample.task_count < CPU_PROFILER_TOP_TASKS) {
+                sample.task_count++;
+            }
+        }
+        sample.busy_percent = std::min<uint64_t>(busy_time * 100 / total_time, 100);
+    }
+
+    std::swap(previous_tasks_, current_tasks_);
+    previous_task_count_ = task_count;
+    previous_run_time_ = run_time;
+
+    if (has_previous) {
+        samples_[next_sample_] = sample;
+        next_sample_ = (next_sample_ + 1) % samples_.size();
+        sample_count_ = std::min(sample_count_ + 1, samples_.size());
+    }
+    sampling_time_us_ = esp_timer_get_time() - start_time;
+}
+
+cJSON* CpuProfiler::GetSamplesJson(int count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "period_ms", period_ms_);
+    cJSON_AddNumberToObject(json, "sampling_time_us", sampling_time_us_);
+    cJSON* samples = cJSON_CreateArray();
+    size_t sample_count = std::min((size_t)std::max(count, 0), sample_count_);
+    for (size_t i = 0; i < sample_count; i++) {
+        auto& sample = samples_[(next_sample_ + samples_.size() - sample_count + i) % samples_.size()];
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "time_ms", sample.time_us / 1000);
+        cJSON_AddStringToObject(item, "state", DeviceStateMachine::GetStateName((DeviceState)sample.device_state));
+        cJSON_AddNumberToObject(item, "busy", sample.busy_percent);
+        cJSON* tasks = cJSON_CreateArray();
+        for (int j = 0; j < sample.task_count; j++) {
+            auto& task = sample.tasks[j];
+            cJSON* task_json = cJSON_CreateObject();
+            cJSON_AddStringToObject(task_json, "name", task.name);
+            cJSON_AddNumberToObject(task_json, "cpu", task.cpu_percent);
+            cJSON_AddNumberToObject(task_json, "core", task.core);
+            cJSON_AddNumberToObject(task_json, "stack_free", task.stack_free);
+            cJSON_AddItemToArray(tasks, task_json);
+        }
+        cJSON_AddItemToObject(item, "tasks", tasks);
+        cJSON_AddItemToArray(samples, item);
+    }
+    cJSON_AddItemToObject(json, "samples", samples);
+    return json;
+}
@@ -0,0 +1,83 @@
+#ifndef CPU_PROFILER_H
+#define CPU_PROFILER_H
+
+#include <vector>
+#include <mutex>
+
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+
+// Period used until the MCP tool sets one, the profiler stays stopped by default
+#ifdef CONFIG_CPU_PROFILER_START_ON_BOOT
+#define CPU_PROFILER_DEFAULT_PERIOD_MS 1000
+#else
+#define CPU_PROFILER_DEFAULT_PERIOD_MS 0
+#endif
+#define CPU_PROFILER_MIN_PERIOD_MS 100
+#define CPU_PROFILER_MAX_PERIOD_MS 10000
+// Tasks compared between two samples, the others are ignored
+#define CPU_PROFILER_MAX_TASKS 48
+// Busiest tasks kept in each sample
+#define CPU_PROFILER_TOP_TASKS 8
+// Samples kept in the ring buffer
+#define CPU_PROFILER_HISTORY 32
+
+struct CpuProfilerTask {
+    char name[configMAX_TASK_NAME_LEN];
+    uint8_t cpu_percent;        // Of all cores
+    int8_t core;                // -1 if the task is not pinned or the core is unknown
+    uint32_t stack_free;        // Stack high water mark in bytes
+};
+
+struct CpuProfilerSample {
+    int64_t time_us;
+    uint8_t device_state;
+    uint8_t busy_percent;       // All tasks except the idle tasks
+    uint8_t task_count;
+    CpuProfilerTask tasks[CPU_PROFILER_TOP_TASKS];
+};
+
+// Samples the CPU usage of the tasks in the background, in the esp_timer task
+class CpuProfiler {
+public:
+    static CpuProfiler& GetInstance() {
+        static CpuProfiler instance;
+        return instance;
+    }
+    // Delete copy constructor and assignment operator
+    CpuProfiler(const CpuProfiler&) = delete;
+    CpuProfiler& operator=(const CpuProfiler&) = delete;
+
+    // Start with the period saved in the settings or the default one, 0 keeps the profiler stopped
+    void Start();
+    // Change the sampling period and save it, 0 stops the profiler
+    bool SetPeriod(int period_ms);
+    int period_ms() const { return period_ms_; }
+
+    // The most recent samples, oldest first
+    cJSON* GetSamplesJson(int count);
+
+private:
+    CpuProfiler();
+    ~CpuProfiler();
+
+    std::mutex mutex_;
+    esp_timer_handle_t timer_ = nullptr;
+    int period_ms_ = 0;
+    std::vector<TaskStatus_t> previous_tasks_;
+    std::vector<TaskStatus_t> current_tasks_;
+    UBaseType_t previous_task_count_ = 0;
+    configRUN_TIME_COUNTER_TYPE previous_run_time_ = 0;
+    std::vector<CpuProfilerSample> samples_;
+    size_t next_sample_ = 0;
+    size_t sample_count_ = 0;
+    // Time spent in the last sampling, to check the overhead
+    int64_t sampling_time_us_ = 0;
+
+    void StartTimer(int period_ms);
+    void TakeSample();
+};
+
+#endif // CPU_PROFILER_H
@@ -1,4 +1,5 @@
 #include "device_state_machine.h"
+#include "event_trace.h"
 
 #include <algorithm>
 #include <esp_log.h>
@@ -124,6 +125,7 @@ bool DeviceStateMachine::TransitionTo(DeviceState new_state) {
     current_state_.store(new_state);
     ESP_LOGI(TAG, "State: %s -> %s",
              GetStateName(old_state), GetStateName(new_state));
+    TRACE_INSTANT(GetStateName(new_state), new_state);
 
     // Notify callback
     NotifyStateChange(old_state, new_state);
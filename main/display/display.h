@@ -35,6 +35,10 @@ public:
     virtual void ShowNotification(const std::string &notification, int duration_ms = 3000);
     virtual void SetEmotion(const char* emotion);
     virtual void SetChatMessage(const char* role, const char* content);
+    // Extend the last message, the first shown_length bytes of content are already shown
+    virtual void AppendChatMessage(const char* role, const char* content, size_t shown_length);
+    // Whether AppendChatMessage updates the message in place, otherwise it sets the whole text again
+    virtual bool SupportsAppendChatMessage() const { return false; }
     virtual void ClearChatMessages();
     virtual void SetTheme(Theme* theme);
     virtual Theme* GetTheme() { return current_theme_; }
@@ -3,6 +3,7 @@
 #include "settings.h"
 #include "lvgl_theme.h"
 #include "assets/lang_config.h"
+#include "event_trace.h"
 
 #include <vector>
 #include <algorithm>
@@ -12,6 +13,7 @@
 #include <esp_lvgl_port.h>
 #include <esp_psram.h>
 #include <cstring>
+#include <string_view>
 #include <src/misc/cache/lv_cache.h>
 
 #include "board.h"
@@ -90,7 +92,8 @@ LcdDisplay::LcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_
 }
 
 SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
-                           int width, int height, int offset_x, int offset_y, bool mirror_x, bool mirror_y, bool swap_xy)
+                           int width, int height, int offset_x, int offset_y, bool mirror_x, bool mirror_y, bool swap_xy,
+                           const LcdDisplayProfile& profile)
     : LcdDisplay(panel_io, panel, width, height) {
 
     // draw white
@@ -127,20 +130,21 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
 
     ESP_LOGI(TAG, "Initialize LVGL port");
     lvgl_port_cfg_t port_cfg = ESP_LVGL_PORT_INIT_CONFIG();
-    port_cfg.task_priority = 1;
-#if CONFIG_SOC_CPU_CORES_NUM > 1
-    port_cfg.task_affinity = 1;
-#endif
+    port_cfg.task_priority = profile.task_priority;
+    port_cfg.task_affinity = profile.task_core;
+    port_cfg.timer_period_ms = profile.timer_period_ms;
     lvgl_port_init(&port_cfg);
 
-    ESP_LOGI(TAG, "Adding LCD display");
+    ESP_LOGI(TAG, "Adding LCD display, %d lines%s in %s, LVGL task priority %d on core %d", profile.buffer_lines,
+        profile.double_buffer ? " x2" : "", profile.buffer_in_psram ? "PSRAM" : "DMA memory",
+        profile.task_priority, profile.task_core);
     const lvgl_port_display_cfg_t display_cfg = {
         .io_handle = panel_io_,
         .panel_handle = panel_,
         .control_handle = nullptr,
-        .buffer_size = static_cast<uint32_t>(width_ * 20),
-        .double_buffer = false,
-        .trans_size = 0,
+        .buffer_size = static_cast<uint32_t>(width_ * profile.buffer_lines),
+        .double_buffer = profile.double_buffer,
+        .trans_size = profile.buffer_in_psram ? static_cast<uint32_t>(width_ * profile.trans_lines) : 0,
         .hres = static_cast<uint32_t>(width_),
         .vres = static_cast<uint32_t>(height_),
         .monochrome = false,
@@ -151,8 +155,8 @@ SpiLcdDisplay::SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_h
         },
         .color_format = LV_COLOR_FORMAT_RGB565,
         .flags = {
-            .buff_dma = 1,
-            .buff_spiram = 0,
+            .buff_dma = !profile.buffer_in_psram,
+            .buff_spiram = profile.buffer_in_psram,
             .sw_rotate = 0,
             .swap_bytes = 1,
             .full_refresh = 0,
@@ -350,6 +354,23 @@ void LcdDisplay::Unlock() {
     lvgl_port_unlock();
 }
 
+bool LcdDisplay::CanAppendChatMessage(lv_obj_t* label, const char* content, size_t shown_length) {
+    const char* shown = lv_label_get_text(label);
+    return shown != nullptr && strlen(shown) == shown_length && strncmp(shown, content, shown_length) == 0;
+}
+
+void LcdDisplay::RecordChatMessageTime(int64_t lock_time_us) {
+    performance_.chat_message_updates++;
+    performance_.chat_message_time_us += lock_time_us;
+    performance_.max_chat_message_time_us = std::max(performance_.max_chat_message_time_us, lock_time_us);
+    if (lock_time_us > chat_message_max_time_us_) {
+        chat_message_max_time_us_ = lock_time_us;
+        ESP_LOGI(TAG, "Chat message took %lld us under the display lock (new maximum)", lock_time_us);
+    } else {
+        ESP_LOGD(TAG, "Chat message took %lld us under the display lock", lock_time_us);
+    }
+}
+
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
 void LcdDisplay::SetupUI() {
     // Prevent duplicate calls - if already called, return early
@@ -360,6 +381,7 @@ void LcdDisplay::SetupUI() {
     
     Display::SetupUI();  // Mark SetupUI as called
     DisplayLockGuard lock(this);
+    AddDisplayEvents();
 
     auto lvgl_theme = static_cast<LvglTheme*>(current_theme_);
     auto text_font = lvgl_theme->text_font()->font();
@@ -501,200 +523,181 @@ void LcdDisplay::SetupUI() {
 #else
 #define  MAX_MESSAGES 20
 #endif
-void LcdDisplay::SetChatMessage(const char* role, const char* content) {
-    if (!setup_ui_called_) {
-        ESP_LOGW(TAG, "SetChatMessage('%s', '%s') called before SetupUI() - message will be lost!", role, content);
-    }
-    DisplayLockGuard lock(this);
-    if (content_ == nullptr) {
-        if (setup_ui_called_) {
-            ESP_LOGW(TAG, "SetChatMessage('%s', '%s') failed: content_ is nullptr (SetupUI() was called but container not created)", role, content);
-        }
-        return;
+// Bubble types, also saved as the user data of the bubbles for SetTheme()
+static const char* GetBubbleType(const char* role) {
+    if (strcmp(role, "user") == 0) {
+        return "user";
+    } else if (strcmp(role, "system") == 0) {
+        return "system";
     }
-    
-    // Check if message count exceeds limit
-    uint32_t child_count = lv_obj_get_child_cnt(content_);
-    if (child_count >= MAX_MESSAGES) {
-        // Delete the oldest message (first child object)
-        lv_obj_t* first_child = lv_obj_get_child(content_, 0);
-        if (first_child != nullptr) {
-            lv_obj_del(first_child);
-            // Refresh child count after deletion
-            child_count = lv_obj_get_child_cnt(content_);
-        }
-        // Scroll to the last message immediately (get last_child after deletion)
-        if (child_count > 0) {
-            lv_obj_t* last_child = lv_obj_get_child(content_, child_count - 1);
-            if (last_child != nullptr && lv_obj_is_valid(last_child)) {
-                lv_obj_scroll_to_view_recursive(last_child, LV_ANIM_OFF);
+    return "assistant";
+}
+
+LcdDisplay::ChatBubble LcdDisplay::AcquireChatBubble() {
+    // Drop the oldest message, an image bubble or a text row
+    if (lv_obj_get_child_cnt(content_) - free_chat_bubbles_.size() >= MAX_MESSAGES) {
+        uint32_t child_count = lv_obj_get_child_cnt(content_);
+        for (uint32_t i = 0; i < child_count; i++) {
+            lv_obj_t* child = lv_obj_get_child(content_, i);
+            if (lv_obj_has_flag(child, LV_OBJ_FLAG_HIDDEN)) {
+                continue;
             }
-        }
-    }
-    
-    // Collapse system messages (if it's a system message, check if the last message is also a system message)
-    if (strcmp(role, "system") == 0) {
-        // Refresh child count to get accurate count after potential deletion above
-        child_count = lv_obj_get_child_cnt(content_);
-        if (child_count > 0) {
-            // Get the last message container
-            lv_obj_t* last_container = lv_obj_get_child(content_, child_count - 1);
-            if (last_container != nullptr && lv_obj_is_valid(last_container) && lv_obj_get_child_cnt(last_container) > 0) {
-                // Get the bubble inside the container
-                lv_obj_t* last_bubble = lv_obj_get_child(last_container, 0);
-                if (last_bubble != nullptr && lv_obj_is_valid(last_bubble)) {
-                    // Check if bubble type is system message
-                    void* bubble_type_ptr = lv_obj_get_user_data(last_bubble);
-                    if (bubble_type_ptr != nullptr && strcmp((const char*)bubble_type_ptr, "system") == 0) {
-                        // If the last message is also a system message, delete it
-                        lv_obj_del(last_container);
-                    }
-                }
+            if (!chat_bubbles_.empty() && child == chat_bubbles_.front().row) {
+                auto bubble = chat_bubbles_.front();
+                chat_bubbles_.pop_front();
+                return bubble;
             }
+            lv_obj_del(child);
+            break;
         }
-    } else {
-        // Hide the centered AI logo
-        lv_obj_add_flag(emoji_label_, LV_OBJ_FLAG_HIDDEN);
     }
-
-    // Avoid empty message boxes
-    if(strlen(content) == 0) {
-        return;
+    if (!free_chat_bubbles_.empty()) {
+        auto bubble = free_chat_bubbles_.back();
+        free_chat_bubbles_.pop_back();
+        lv_obj_remove_flag(bubble.row, LV_OBJ_FLAG_HIDDEN);
+        return bubble;
     }
 
+    // Create and style the objects once, they are reused for the following messages
     auto lvgl_theme = static_cast<LvglTheme*>(current_theme_);
+    ChatBubble bubble = {};
+    bubble.row = lv_obj_create(content_);
+    lv_obj_set_width(bubble.row, LV_HOR_RES);
+    lv_obj_set_height(bubble.row, LV_SIZE_CONTENT);
+    lv_obj_set_style_bg_opa(bubble.row, LV_OPA_TRANSP, 0);
+    lv_obj_set_style_border_width(bubble.row, 0, 0);
+    lv_obj_set_style_pad_all(bubble.row, 0, 0);
+    lv_obj_remove_flag(bubble.row, LV_OBJ_FLAG_SCROLLABLE);
+
+    bubble.bubble = lv_obj_create(bubble.row);
+    lv_obj_set_style_radius(bubble.bubble, 8, 0);
+    lv_obj_set_scrollbar_mode(bubble.bubble, LV_SCROLLBAR_MODE_OFF);
+    lv_obj_set_style_border_width(bubble.bubble, 0, 0);
+    lv_obj_set_style_pad_all(bubble.bubble, lvgl_theme->spacing(4), 0);
+    lv_obj_set_style_bg_opa(bubble.bubble, LV_OPA_70, 0);
+    lv_obj_set_size(bubble.bubble, LV_SIZE_CONTENT, LV_SIZE_CONTENT);
+    lv_obj_set_style_flex_grow(bubble.bubble, 0, 0);
+
+    bubble.label = lv_label_create(bubble.bubble);
+    lv_label_set_long_mode(bubble.label, LV_LABEL_LONG_WRAP);
+    return bubble;
+}
 
-    // Create a message bubble
-    lv_obj_t* msg_bubble = lv_obj_create(content_);
-    lv_obj_set_style_radius(msg_bubble, 8, 0);
-    lv_obj_set_scrollbar_mode(msg_bubble, LV_SCROLLBAR_MODE_OFF);
-    lv_obj_set_style_border_width(msg_bubble, 0, 0);
-    lv_obj_set_style_pad_all(msg_bubble, lvgl_theme->spacing(4), 0);
+#define CHAT_LABEL_MAX_WIDTH (LV_HOR_RES * 85 / 100 - 16)  // 85% of screen width
 
-    // Create the message text
-    lv_obj_t* msg_text = lv_label_create(msg_bubble);
-    lv_label_set_text(msg_text, content);
-    
-    // Calculate bubble width constraints
-    lv_coord_t max_width = LV_HOR_RES * 85 / 100 - 16;  // 85% of screen width
-    lv_coord_t min_width = 20;  
-    
-    // Let LVGL calculate the natural text width first
-    lv_obj_set_width(msg_text, LV_SIZE_CONTENT);
-    lv_obj_update_layout(msg_text);
-    lv_coord_t text_width = lv_obj_get_width(msg_text);
-    
-    // Ensure text width is not less than minimum width
-    if (text_width < min_width) {
-        text_width = min_width;
+void LcdDisplay::SetChatLabelWidth(lv_obj_t* label, const char* content) {
+    // Measure the natural text width instead of updating the layout of the label
+    lv_point_t text_size;
+    lv_text_get_size(&text_size, content, lv_obj_get_style_text_font(label, LV_PART_MAIN),
+        lv_obj_get_style_text_letter_space(label, LV_PART_MAIN),
+        lv_obj_get_style_text_line_space(label, LV_PART_MAIN), LV_COORD_MAX, LV_TEXT_FLAG_NONE);
+    lv_coord_t min_width = 20;
+    lv_obj_set_width(label, std::clamp<lv_coord_t>(text_size.x, min_width, CHAT_LABEL_MAX_WIDTH));
+}
+
+void LcdDisplay::ShowChatMessage(const char* role, const char* content) {
+    const char* type = GetBubbleType(role);
+    bool is_system = type == std::string_view("system");
+
+    // Collapse system messages, the last system message is replaced by the new one
+    ChatBubble bubble = {};
+    if (is_system && !chat_bubbles_.empty() && chat_bubbles_.back().type == type &&
+        lv_obj_get_child(content_, -1) == chat_bubbles_.back().row) {
+        bubble = chat_bubbles_.back();
+        chat_bubbles_.pop_back();
+        if (strlen(content) == 0) {
+            lv_obj_add_flag(bubble.row, LV_OBJ_FLAG_HIDDEN);
+            free_chat_bubbles_.push_back(bubble);
+            return;
+        }
+    } else {
+        if (!is_system) {
+            // Hide the centered AI logo
+            lv_obj_add_flag(emoji_label_, LV_OBJ_FLAG_HIDDEN);
+        }
+        // Avoid empty message boxes
+        if (strlen(content) == 0) {
+            return;
+        }
+        bubble = AcquireChatBubble();
+        lv_obj_move_to_index(bubble.row, -1);
+    }
+
+    lv_label_set_text(bubble.label, content);
+    SetChatLabelWidth(bubble.label, content);
+
+    // Restyle only when the bubble changes its type
+    if (bubble.type != type) {
+        auto lvgl_theme = static_cast<LvglTheme*>(current_theme_);
+        bubble.type = type;
+        lv_obj_set_user_data(bubble.bubble, (void*)type);
+        if (type == std::string_view("user")) {
+            // User messages are right-aligned with green background
+            lv_obj_set_style_bg_color(bubble.bubble, lvgl_theme->user_bubble_color(), 0);
+            lv_obj_set_style_text_color(bubble.label, lvgl_theme->text_color(), 0);
+            lv_obj_align(bubble.bubble, LV_ALIGN_RIGHT_MID, -25, 0);
+        } else if (is_system) {
+            // System messages are center-aligned with light gray background
+            lv_obj_set_style_bg_color(bubble.bubble, lvgl_theme->system_bubble_color(), 0);
+            lv_obj_set_style_text_color(bubble.label, lvgl_theme->system_text_color(), 0);
+            lv_obj_align(bubble.bubble, LV_ALIGN_CENTER, 0, 0);
+        } else {
+            // Assistant messages are left-aligned with white background
+            lv_obj_set_style_bg_color(bubble.bubble, lvgl_theme->assistant_bubble_color(), 0);
+            lv_obj_set_style_text_color(bubble.label, lvgl_theme->text_color(), 0);
+            lv_obj_align(bubble.bubble, LV_ALIGN_LEFT_MID, 0, 0);
+        }
     }
+    chat_bubbles_.push_back(bubble);
 
-    // Constrain to max width
-    lv_coord_t bubble_width = (text_width < max_width) ? text_width : max_width;
-    
-    // Set message text width
-    lv_obj_set_width(msg_text, bubble_width);
-    lv_label_set_long_mode(msg_text, LV_LABEL_LONG_WRAP);
+    // Only the chat area scrolls, no need to walk up the parents
+    lv_obj_scroll_to_view(bubble.row, LV_ANIM_ON);
 
-    // Set bubble width
-    lv_obj_set_width(msg_bubble, bubble_width);
-    lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
+    // Store reference to the latest message label
+    chat_message_label_ = bubble.label;
+}
 
-    // Set alignment and style based on message role
-    if (strcmp(role, "user") == 0) {
-        // User messages are right-aligned with green background
-        lv_obj_set_style_bg_color(msg_bubble, lvgl_theme->user_bubble_color(), 0);
-        lv_obj_set_style_bg_opa(msg_bubble, LV_OPA_70, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, lvgl_theme->text_color(), 0);
-        
-        // Set custom attribute to mark bubble type
-        lv_obj_set_user_data(msg_bubble, (void*)"user");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    } else if (strcmp(role, "assistant") == 0) {
-        // Assistant messages are left-aligned with white background
-        lv_obj_set_style_bg_color(msg_bubble, lvgl_theme->assistant_bubble_color(), 0);
-        lv_obj_set_style_bg_opa(msg_bubble, LV_OPA_70, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, lvgl_theme->text_color(), 0);
-        
-        // Set custom attribute to mark bubble type
-        lv_obj_set_user_data(msg_bubble, (void*)"assistant");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
-    } else if (strcmp(role, "system") == 0) {
-        // System messages are center-aligned with light gray background
-        lv_obj_set_style_bg_color(msg_bubble, lvgl_theme->system_bubble_color(), 0);
-        lv_obj_set_style_bg_opa(msg_bubble, LV_OPA_70, 0);
-        // Set text color for contrast
-        lv_obj_set_style_text_color(msg_text, lvgl_theme->system_text_color(), 0);
-        
-        // Set custom attribute to mark bubble type
-        lv_obj_set_user_data(msg_bubble, (void*)"system");
-        
-        // Set appropriate width for content
-        lv_obj_set_width(msg_bubble, LV_SIZE_CONTENT);
-        lv_obj_set_height(msg_bubble, LV_SIZE_CONTENT);
-        
-        // Don't grow
-        lv_obj_set_style_flex_grow(msg_bubble, 0, 0);
+void LcdDisplay::SetChatMessage(const char* role, const char* content) {
+    if (!setup_ui_called_) {
+        ESP_LOGW(TAG, "SetChatMessage('%s', '%s') called before SetupUI() - message will be lost!", role, content);
+    }
+    DisplayLockGuard lock(this);
+    if (content_ == nullptr) {
+        if (setup_ui_called_) {
+            ESP_LOGW(TAG, "SetChatMessage('%s', '%s') failed: content_ is nullptr (SetupUI() was called but container not created)", role, content);
+        }
+        return;
+    }
+
+    TRACE_SCOPE("display.chat_message", strlen(content));
+    auto start_time = esp_timer_get_time();
+    ShowChatMessage(role, content);
+    RecordChatMessageTime(esp_timer_get_time() - start_time);
+}
+
+void LcdDisplay::AppendChatMessage(const char* role, const char* content, size_t shown_length) {
+    DisplayLockGuard lock(this);
+    if (content_ == nullptr) {
+        return;
     }
-    
-    // Create a full-width container for user messages to ensure right alignment
-    if (strcmp(role, "user") == 0) {
-        // Create a full-width container
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        // Make container transparent and borderless
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        // Move the message bubble into this container
-        lv_obj_set_parent(msg_bubble, container);
-        
-        // Right align the bubble in the container
-        lv_obj_align(msg_bubble, LV_ALIGN_RIGHT_MID, -25, 0);
-        
-        // Auto-scroll to this container
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
-    } else if (strcmp(role, "system") == 0) {
-        // Create full-width container for system messages to ensure center alignment
-        lv_obj_t* container = lv_obj_create(content_);
-        lv_obj_set_width(container, LV_HOR_RES);
-        lv_obj_set_height(container, LV_SIZE_CONTENT);
-        
-        lv_obj_set_style_bg_opa(container, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(container, 0, 0);
-        lv_obj_set_style_pad_all(container, 0, 0);
-        
-        lv_obj_set_parent(msg_bubble, container);
-        lv_obj_align(msg_bubble, LV_ALIGN_CENTER, 0, 0);
-        lv_obj_scroll_to_view_recursive(container, LV_ANIM_ON);
-    } else {
-        // For assistant messages
-        // Left align assistant messages
-        lv_obj_align(msg_bubble, LV_ALIGN_LEFT_MID, 0, 0);
 
-        // Auto-scroll to the message bubble
-        lv_obj_scroll_to_view_recursive(msg_bubble, LV_ANIM_ON);
+    TRACE_SCOPE("display.chat_message", strlen(content) - shown_length);
+    auto start_time = esp_timer_get_time();
+    // Only the last message can grow, otherwise the text is shown as a new message
+    if (chat_bubbles_.empty() || chat_bubbles_.back().type != GetBubbleType(role) ||
+        lv_obj_get_child(content_, -1) != chat_bubbles_.back().row ||
+        !CanAppendChatMessage(chat_bubbles_.back().label, content, shown_length)) {
+        ShowChatMessage(role, content);
+    } else {
+        auto& bubble = chat_bubbles_.back();
+        lv_label_ins_text(bubble.label, LV_LABEL_POS_LAST, content + shown_length);
+        // The bubble only gets wider until the text wraps
+        if (lv_obj_get_style_width(bubble.label, LV_PART_MAIN) < CHAT_LABEL_MAX_WIDTH) {
+            SetChatLabelWidth(bubble.label, content);
+        }
+        lv_obj_scroll_to_view(bubble.row, LV_ANIM_ON);
     }
-    
-    // Store reference to the latest message label
-    chat_message_label_ = msg_text;
+    RecordChatMessageTime(esp_timer_get_time() - start_time);
 }
 
 void LcdDisplay::SetPreviewImage(std::unique_ptr<LvglImage> image) {
@@ -787,10 +790,18 @@ void LcdDisplay::ClearChatMessages() {
         return;
     }
     
-    // Use lv_obj_clean to delete all children of content_ (chat message bubbles)
-    lv_obj_clean(content_);
-    
-    // Reset chat_message_label_ as it has been deleted
+    // Hide the text rows for reuse and delete the image bubbles
+    for (auto& bubble : chat_bubbles_) {
+        lv_obj_add_flag(bubble.row, LV_OBJ_FLAG_HIDDEN);
+        free_chat_bubbles_.push_back(bubble);
+    }
+    chat_bubbles_.clear();
+    for (int i = lv_obj_get_child_cnt(content_) - 1; i >= 0; i--) {
+        lv_obj_t* child = lv_obj_get_child(content_, i);
+        if (!lv_obj_has_flag(child, LV_OBJ_FLAG_HIDDEN)) {
+            lv_obj_del(child);
+        }
+    }
     chat_message_label_ = nullptr;
     
     // Show the centered AI logo (emoji_label_) again
@@ -810,6 +821,7 @@ void LcdDisplay::SetupUI() {
     
     Display::SetupUI();  // Mark SetupUI as called
     DisplayLockGuard lock(this);
+    AddDisplayEvents();
     LvglTheme* lvgl_theme = static_cast<LvglTheme*>(current_theme_);
     auto text_font = lvgl_theme->text_font()->font();
     auto icon_font = lvgl_theme->icon_font()->font();
@@ -1041,6 +1053,7 @@ void LcdDisplay::SetChatMessage(const char* role, const char* content) {
         }
         return;
     }
+    auto start_time = esp_timer_get_time();
     lv_label_set_text(chat_message_label_, content);
     // Show bottom_bar_ only when there is content (and subtitle is not globally hidden)
     if (bottom_bar_ != nullptr) {
@@ -1057,6 +1070,28 @@ void LcdDisplay::SetChatMessage(const char* role, const char* content) {
         lv_obj_align(bottom_bar_, LV_ALIGN_BOTTOM_MID, 0, 0);
     }
 #endif
+    RecordChatMessageTime(esp_timer_get_time() - start_time);
+}
+
+void LcdDisplay::AppendChatMessage(const char* role, const char* content, size_t shown_length) {
+    DisplayLockGuard lock(this);
+    if (chat_message_label_ == nullptr) {
+        return;
+    }
+    // Another message may have replaced the text in the meantime
+    if (!CanAppendChatMessage(chat_message_label_, content, shown_length)) {
+        SetChatMessage(role, content);
+        return;
+    }
+
+    auto start_time = esp_timer_get_time();
+    lv_label_ins_text(chat_message_label_, LV_LABEL_POS_LAST, content + shown_length);
+#if CONFIG_USE_MULTILINE_CHAT_MESSAGE
+    if (bottom_bar_ != nullptr) {
+        lv_obj_align(bottom_bar_, LV_ALIGN_BOTTOM_MID, 0, 0);
+    }
+#endif
+    RecordChatMessageTime(esp_timer_get_time() - start_time);
 }
 
 void LcdDisplay::ClearChatMessages() {
@@ -1082,12 +1117,20 @@ void LcdDisplay::SetEmotion(const char* emotion) {
         return;
     }
 
-    auto emoji_collection = static_cast<LvglTheme*>(current_theme_)->emoji_collection();
-    auto image = emoji_collection != nullptr ? emoji_collection->GetEmojiImage(emotion) : nullptr;
+    TRACE_SCOPE("display.set_emotion", 0);
+    int64_t start_time = esp_timer_get_time();
+    std::shared_ptr<EmojiCollection> emoji_collection;
+    {
+        DisplayLockGuard lock(this);
+        emoji_collection = static_cast<LvglTheme*>(current_theme_)->emoji_collection();
+    }
+    // Decoded on first use without the display lock, emojis larger than the screen are shrunk to fit
+    auto image = emoji_collection != nullptr ? emoji_collection->GetDecodedImage(emotion, width_, height_) : nullptr;
+
+    DisplayLockGuard lock(this);
     if (image == nullptr) {
         const char* utf8 = font_awesome_get_utf8(emotion);
         if (utf8 != nullptr && emoji_label_ != nullptr) {
-            DisplayLockGuard lock(this);
             if (gif_controller_) {
                 gif_controller_->Stop();
                 gif_controller_.reset();
@@ -1099,7 +1142,8 @@ void LcdDisplay::SetEmotion(const char* emotion) {
         return;
     }
 
-    DisplayLockGuard lock(this);
+    const void* previous_src = lv_image_get_src(emoji_image_);
+    bool was_hidden = lv_obj_has_flag(emoji_image_, LV_OBJ_FLAG_HIDDEN);
     // Stop any running GIF animation in the same lock scope as setting new image
     // to prevent LVGL from accessing freed image data between operations
     if (gif_controller_) {
@@ -1132,6 +1176,8 @@ void LcdDisplay::SetEmotion(const char* emotion) {
         lv_obj_add_flag(emoji_label_, LV_OBJ_FLAG_HIDDEN);
         lv_obj_remove_flag(emoji_image_, LV_OBJ_FLAG_HIDDEN);
     }
+    // The previous image may have been evicted from the cache, it is released once replaced
+    current_emoji_image_ = image;
 
 #if CONFIG_USE_WECHAT_MESSAGE_STYLE
     // In WeChat message style, if emotion is neutral, don't display it
@@ -1147,6 +1193,51 @@ void LcdDisplay::SetEmotion(const char* emotion) {
         lv_obj_add_flag(emoji_label_, LV_OBJ_FLAG_HIDDEN);
     }
 #endif
+
+    // Time to show is measured until the refresh drawing the new emoji, the same emoji is not redrawn
+    if (!lv_obj_has_flag(emoji_image_, LV_OBJ_FLAG_HIDDEN) &&
+        (was_hidden || lv_image_get_src(emoji_image_) != previous_src)) {
+        emotion_start_us_ = start_time;
+    }
+}
+
+void LcdDisplay::WarmUpEmojiCache() {
+#ifdef CONFIG_EMOJI_IMAGE_CACHE_WARMUP
+    std::string names = CONFIG_EMOJI_IMAGE_CACHE_WARMUP;
+    if (names.empty()) {
+        return;
+    }
+    // Decode in the background, the display lock is only taken to read the theme
+    xTaskCreate([](void* arg) {
+        auto display = static_cast<LcdDisplay*>(arg);
+        std::string names = CONFIG_EMOJI_IMAGE_CACHE_WARMUP;
+        int64_t start_time = esp_timer_get_time();
+        int count = 0;
+        size_t begin = 0;
+        while (begin < names.size()) {
+            size_t end = names.find(',', begin);
+            if (end == std::string::npos) {
+                end = names.size();
+            }
+            std::string name = names.substr(begin, end - begin);
+            begin = end + 1;
+            if (name.empty()) {
+                continue;
+            }
+            std::shared_ptr<EmojiCollection> emoji_collection;
+            {
+                // Taken again for every emoji, the theme may have changed
+                DisplayLockGuard lock(display);
+                emoji_collection = static_cast<LvglTheme*>(display->current_theme_)->emoji_collection();
+            }
+            if (emoji_collection != nullptr && emoji_collection->GetDecodedImage(name.c_str(), display->width_, display->height_) != nullptr) {
+                count++;
+            }
+        }
+        ESP_LOGI(TAG, "Warmed up %d emojis in %d ms", count, (int)((esp_timer_get_time() - start_time) / 1000));
+        vTaskDelete(NULL);
+    }, "emoji_warmup", 4096, this, 1, nullptr);
+#endif
 }
 
 void LcdDisplay::SetTheme(Theme* theme) {
@@ -10,9 +10,29 @@
 
 #include <atomic>
 #include <memory>
+#include <deque>
+#include <vector>
 
 #define PREVIEW_IMAGE_DURATION_MS 5000
 
+#if CONFIG_SOC_CPU_CORES_NUM > 1
+#define LCD_DISPLAY_DEFAULT_TASK_CORE 1
+#else
+#define LCD_DISPLAY_DEFAULT_TASK_CORE -1
+#endif
+
+// Rendering settings of a board, tune them with the self.screen.get_performance tool.
+// The defaults suit small panels with little internal RAM.
+struct LcdDisplayProfile {
+    int buffer_lines = 20;          // Lines rendered at once
+    bool double_buffer = false;     // Render into one buffer while the other one is sent to the panel
+    bool buffer_in_psram = false;   // The panel is then sent from an internal DMA buffer of trans_lines lines
+    int trans_lines = 10;
+    int task_priority = 1;          // LVGL task
+    int task_core = LCD_DISPLAY_DEFAULT_TASK_CORE;    // -1 for no affinity
+    int timer_period_ms = 5;        // LVGL timer handler period
+};
+
 
 class LcdDisplay : public LvglDisplay {
 protected:
@@ -30,13 +50,33 @@ protected:
     lv_obj_t* emoji_label_ = nullptr;
     lv_obj_t* emoji_image_ = nullptr;
     std::unique_ptr<LvglGif> gif_controller_ = nullptr;
+    // Keeps the displayed emoji alive when it is evicted from the emoji cache
+    std::shared_ptr<const LvglImage> current_emoji_image_ = nullptr;
     lv_obj_t* emoji_box_ = nullptr;
     lv_obj_t* chat_message_label_ = nullptr;
     esp_timer_handle_t preview_timer_ = nullptr;
     std::unique_ptr<LvglImage> preview_image_cached_ = nullptr;
     bool hide_subtitle_ = false;  // Control whether to hide chat messages/subtitles
 
+    // Chat message rows, created once and reused for the following messages
+    struct ChatBubble {
+        lv_obj_t* row;
+        lv_obj_t* bubble;
+        lv_obj_t* label;
+        const char* type;
+    };
+    std::deque<ChatBubble> chat_bubbles_;           // Shown, oldest first
+    std::vector<ChatBubble> free_chat_bubbles_;     // Hidden, ready to be reused
+    int64_t chat_message_max_time_us_ = 0;
+
     void InitializeLcdThemes();
+    ChatBubble AcquireChatBubble();
+    void ShowChatMessage(const char* role, const char* content);
+    void SetChatLabelWidth(lv_obj_t* label, const char* content);
+    // Whether the label shows the first shown_length bytes of content, so the rest can be appended
+    bool CanAppendChatMessage(lv_obj_t* label, const char* content, size_t shown_length);
+    // Called with the display lock held
+    void RecordChatMessageTime(int64_t lock_time_us);
     virtual bool Lock(int timeout_ms = 0) override;
     virtual void Unlock() override;
 
@@ -48,6 +88,8 @@ public:
     ~LcdDisplay();
     virtual void SetEmotion(const char* emotion) override;
     virtual void SetChatMessage(const char* role, const char* content) override;
+    virtual void AppendChatMessage(const char* role, const char* content, size_t shown_length) override;
+    virtual bool SupportsAppendChatMessage() const override { return true; }
     virtual void ClearChatMessages() override;
     virtual void SetPreviewImage(std::unique_ptr<LvglImage> image) override;
     virtual void SetupUI() override;
@@ -56,6 +98,8 @@ public:
     
     // Set whether to hide chat messages/subtitles
     void SetHideSubtitle(bool hide);
+    // Decode the emojis listed in EMOJI_IMAGE_CACHE_WARMUP in the background
+    void WarmUpEmojiCache();
 };
 
 // SPI LCD display
@@ -63,7 +107,8 @@ class SpiLcdDisplay : public LcdDisplay {
 public:
     SpiLcdDisplay(esp_lcd_panel_io_handle_t panel_io, esp_lcd_panel_handle_t panel,
                   int width, int height, int offset_x, int offset_y,
-                  bool mirror_x, bool mirror_y, bool swap_xy);
+                  bool mirror_x, bool mirror_y, bool swap_xy,
+                  const LcdDisplayProfile& profile = LcdDisplayProfile());
 };
 
 // RGB LCD display
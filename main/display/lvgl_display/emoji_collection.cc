@@ -1,11 +1,67 @@
 #include "emoji_collection.h"
+#include "heap_monitor.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
 #include <unordered_map>
 #include <string>
+#include <cstring>
+#include <algorithm>
 
 #define TAG "EmojiCollection"
 
+#ifdef CONFIG_EMOJI_IMAGE_CACHE_SIZE
+#define IMAGE_CACHE_BUDGET (CONFIG_EMOJI_IMAGE_CACHE_SIZE * 1024)
+#else
+#define IMAGE_CACHE_BUDGET 0
+#endif
+
+// Decoded emoji pixels in PSRAM, attributed to the display while they are alive
+class DecodedEmojiImage : public LvglAllocatedImage {
+public:
+    DecodedEmojiImage(void* data, size_t size, int width, int height, int stride, int color_format)
+        : LvglAllocatedImage(data, size, width, height, stride, color_format),
+          heap_track_(kHeapTagDisplay, size) {}
+
+private:
+    HeapTrackGuard heap_track_;
+};
+
+static bool IsReadableFormat(uint32_t cf) {
+    return cf == LV_COLOR_FORMAT_ARGB8888 || cf == LV_COLOR_FORMAT_XRGB8888 || cf == LV_COLOR_FORMAT_RGB888 ||
+        cf == LV_COLOR_FORMAT_RGB565 || cf == LV_COLOR_FORMAT_RGB565A8;
+}
+
+// Reads a pixel of the decoded image as B, G, R, A
+static void ReadPixel(const lv_draw_buf_t* buffer, int x, int y, uint8_t* bgra) {
+    auto& header = buffer->header;
+    const uint8_t* row = buffer->data + y * header.stride;
+    switch (header.cf) {
+        case LV_COLOR_FORMAT_ARGB8888:
+            memcpy(bgra, row + x * 4, 4);
+            break;
+        case LV_COLOR_FORMAT_XRGB8888:
+            memcpy(bgra, row + x * 4, 3);
+            bgra[3] = 0xFF;
+            break;
+        case LV_COLOR_FORMAT_RGB888:
+            memcpy(bgra, row + x * 3, 3);
+            bgra[3] = 0xFF;
+            break;
+        default: {
+            uint16_t color = ((const uint16_t*)row)[x];
+            bgra[0] = ((color & 0x1F) << 3) | ((color & 0x1F) >> 2);
+            bgra[1] = ((color >> 3) & 0xFC) | ((color >> 9) & 0x03);
+            bgra[2] = ((color >> 8) & 0xF8) | (color >> 13);
+            // The alpha plane of RGB565A8 follows the pixels, with half the stride
+            bgra[3] = header.cf == LV_COLOR_FORMAT_RGB565A8 ?
+                buffer->data[header.h * header.stride + y * (header.stride / 2) + x] : 0xFF;
+            break;
+        }
+    }
+}
+
 void EmojiCollection::AddEmoji(const std::string& name, LvglImage* image) {
     emoji_collection_[name] = image;
 }
@@ -20,6 +76,178 @@ const LvglImage* EmojiCollection::GetEmojiImage(const char* name) {
     return nullptr;
 }
 
+std::shared_ptr<const LvglImage> EmojiCollection::DecodeImage(const char* name, const LvglImage* image, int max_width, int max_height) {
+    lv_image_header_t header;
+    if (lv_image_decoder_get_info(image->image_dsc(), &header) != LV_RESULT_OK || header.w == 0 || header.h == 0) {
+        ESP_LOGW(TAG, "Failed to get the image info of emoji %s", name);
+        return nullptr;
+    }
+    int width = header.w;
+    int height = header.h;
+    if ((max_width > 0 && width > max_width) || (max_height > 0 && height > max_height)) {
+        // Keep the aspect ratio, the limiting side is the one with the smaller ratio
+        if (max_height == 0 || (max_width > 0 && header.w * max_height > header.h * max_width)) {
+            width = max_width;
+            height = std::max(1, (int)(header.h * max_width / header.w));
+        } else {
+            height = max_height;
+            width = std::max(1, (int)(header.w * max_height / header.h));
+        }
+    }
+    // RGB565 plane followed by the alpha plane, the layout of LV_COLOR_FORMAT_RGB565A8
+    size_t size = width * height * 3;
+    if (size > IMAGE_CACHE_BUDGET) {
+        ESP_LOGD(TAG, "Emoji %s (%dx%d) exceeds the image cache budget", name, width, height);
+        return nullptr;
+    }
+
+    lv_image_decoder_dsc_t decoder_dsc;
+    lv_image_decoder_args_t args = {};
+    // The pixels are converted and kept here, not in the LVGL cache
+    args.no_cache = true;
+    if (lv_image_decoder_open(&decoder_dsc, image->image_dsc(), &args) != LV_RESULT_OK) {
+        ESP_LOGW(TAG, "Failed to decode emoji %s", name);
+        return nullptr;
+    }
+    auto decoded = decoder_dsc.decoded;
+    if (decoded == nullptr || !IsReadableFormat(decoded->header.cf)) {
+        ESP_LOGW(TAG, "Emoji %s decoded to unsupported color format %d", name, decoded ? (int)decoded->header.cf : -1);
+        lv_image_decoder_close(&decoder_dsc);
+        return nullptr;
+    }
+    auto data = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (data == nullptr) {
+        ESP_LOGW(TAG, "Failed to allocate %u bytes for emoji %s", size, name);
+        lv_image_decoder_close(&decoder_dsc);
+        return nullptr;
+    }
+
+    // Average the source pixels covered by each pixel, weighted by their alpha
+    int src_width = decoded->header.w;
+    int src_height = decoded->header.h;
+    auto rgb = (uint16_t*)data;
+    auto alpha = data + width * height * 2;
+    uint8_t opaque = 0xFF;
+    for (int y = 0; y < height; y++) {
+        int y0 = y * src_height / height;
+        int y1 = std::max(y0 + 1, (y + 1) * src_height / height);
+        for (int x = 0; x < width; x++) {
+            int x0 = x * src_width / width;
+            int x1 = std::max(x0 + 1, (x + 1) * src_width / width);
+            uint64_t sum[4] = {};
+            uint32_t count = 0;
+            for (int sy = y0; sy < y1; sy++) {
+                for (int sx = x0; sx < x1; sx++) {
+                    uint8_t bgra[4];
+                    ReadPixel(decoded, sx, sy, bgra);
+                    sum[0] += bgra[0] * bgra[3];
+                    sum[1] += bgra[1] * bgra[3];
+                    sum[2] += bgra[2] * bgra[3];
+                    sum[3] += bgra[3];
+                    count++;
+                }
+            }
+            uint8_t b = 0, g = 0, r = 0;
+            if (sum[3] > 0) {
+                b = sum[0] / sum[3];
+                g = sum[1] / sum[3];
+                r = sum[2] / sum[3];
+            }
+            uint8_t a = sum[3] / count;
+            rgb[y * width + x] = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+            alpha[y * width + x] = a;
+            opaque &= a;
+        }
+    }
+    lv_image_decoder_close(&decoder_dsc);
+
+    uint32_t color_format = LV_COLOR_FORMAT_RGB565A8;
+    if (opaque == 0xFF) {
+        // The alpha plane is not needed
+        size = width * height * 2;
+        color_format = LV_COLOR_FORMAT_RGB565;
+        auto shrunk = (uint8_t*)heap_caps_realloc(data, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (shrunk != nullptr) {
+            data = shrunk;
+        }
+    }
+    return std::make_shared<DecodedEmojiImage>(data, size, width, height, width * 2, color_format);
+}
+
+std::shared_ptr<const LvglImage> EmojiCollection::GetDecodedImage(const char* name, int max_width, int max_height) {
+    auto it = emoji_collection_.find(name);
+    if (it == emoji_collection_.end()) {
+        ESP_LOGW(TAG, "Emoji not found: %s", name);
+        return nullptr;
+    }
+    const LvglImage* image = it->second;
+    // Owned by the collection
+    auto source = std::shared_ptr<const LvglImage>(std::shared_ptr<const LvglImage>(), image);
+    // Only the raw images are decoded every time they are drawn, GIFs have their own player
+    auto cf = image->image_dsc()->header.cf;
+    if (IMAGE_CACHE_BUDGET == 0 || image->IsGif() || (cf != LV_COLOR_FORMAT_RAW && cf != LV_COLOR_FORMAT_RAW_ALPHA)) {
+        return source;
+    }
+
+    std::string key = std::string(name) + "@" + std::to_string(max_width) + "x" + std::to_string(max_height);
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        auto cached = cache_index_.find(key);
+        if (cached != cache_index_.end()) {
+            cache_hits_++;
+            cache_.splice(cache_.begin(), cache_, cached->second);
+            return cached->second->image;
+        }
+        cache_misses_++;
+    }
+
+    // The LVGL decoders only read the source image and allocate with the C library, no lock is needed
+    int64_t start_time = esp_timer_get_time();
+    auto decoded = DecodeImage(name, image, max_width, max_height);
+    if (decoded == nullptr) {
+        // Let LVGL decode it when it is drawn
+        return source;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto cached = cache_index_.find(key);
+    if (cached != cache_index_.end()) {
+        // Decoded by another task in the meantime, keep the cached copy
+        cache_.splice(cache_.begin(), cache_, cached->second);
+        return cached->second->image;
+    }
+    size_t size = decoded->image_dsc()->data_size;
+    // Evicted images stay alive as long as they are displayed
+    while (!cache_.empty() && cache_bytes_ + size > IMAGE_CACHE_BUDGET) {
+        auto& last = cache_.back();
+        ESP_LOGD(TAG, "Evict emoji %s", last.key.c_str());
+        cache_bytes_ -= last.size;
+        cache_index_.erase(last.key);
+        cache_.pop_back();
+        cache_evictions_++;
+    }
+    cache_.push_front({key, decoded, size});
+    cache_index_[key] = cache_.begin();
+    cache_bytes_ += size;
+
+    auto header = decoded->image_dsc()->header;
+    ESP_LOGI(TAG, "Decoded emoji %s %dx%d in %d ms, cache %u/%u KB", name, header.w, header.h,
+        (int)((esp_timer_get_time() - start_time) / 1000), cache_bytes_ / 1024, IMAGE_CACHE_BUDGET / 1024);
+    return decoded;
+}
+
+cJSON* EmojiCollection::GetCacheJson() {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "budget_bytes", IMAGE_CACHE_BUDGET);
+    cJSON_AddNumberToObject(json, "bytes", cache_bytes_);
+    cJSON_AddNumberToObject(json, "images", cache_.size());
+    cJSON_AddNumberToObject(json, "hits", cache_hits_);
+    cJSON_AddNumberToObject(json, "misses", cache_misses_);
+    cJSON_AddNumberToObject(json, "evictions", cache_evictions_);
+    return json;
+}
+
 EmojiCollection::~EmojiCollection() {
     for (auto it = emoji_collection_.begin(); it != emoji_collection_.end(); ++it) {
         delete it->second;
@@ -4,10 +4,14 @@
 #include "lvgl_image.h"
 
 #include <lvgl.h>
+#include <cJSON.h>
 
 #include <map>
+#include <list>
+#include <unordered_map>
 #include <string>
 #include <memory>
+#include <mutex>
 
 
 // Define interface for emoji collection
@@ -15,10 +19,34 @@ class EmojiCollection {
 public:
     virtual void AddEmoji(const std::string& name, LvglImage* image);
     virtual const LvglImage* GetEmojiImage(const char* name);
+    // The emoji ready to be drawn, shrunk to fit max_width x max_height (0 for no limit).
+    // Raw images (PNG, JPEG) are decoded once and kept in a LRU cache shared by the themes
+    // using the collection, the other images are returned as they are.
+    // Call it without the display lock, a cache miss decodes the image.
+    std::shared_ptr<const LvglImage> GetDecodedImage(const char* name, int max_width = 0, int max_height = 0);
+    // Hits, misses and memory of the decoded image cache
+    cJSON* GetCacheJson();
     virtual ~EmojiCollection();
 
 private:
     std::map<std::string, LvglImage*> emoji_collection_;
+
+    struct CacheEntry {
+        std::string key;
+        std::shared_ptr<const LvglImage> image;
+        size_t size;
+    };
+    // Guards the cache, the images are decoded outside of it
+    std::mutex cache_mutex_;
+    // Most recently used first
+    std::list<CacheEntry> cache_;
+    std::unordered_map<std::string, std::list<CacheEntry>::iterator> cache_index_;
+    size_t cache_bytes_ = 0;
+    uint32_t cache_hits_ = 0;
+    uint32_t cache_misses_ = 0;
+    uint32_t cache_evictions_ = 0;
+
+    std::shared_ptr<const LvglImage> DecodeImage(const char* name, const LvglImage* image, int max_width, int max_height);
 };
 
 class Twemoji32 : public EmojiCollection {
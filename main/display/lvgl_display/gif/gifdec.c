@@ -10,23 +10,10 @@
 #define MIN(A, B) ((A) < (B) ? (A) : (B))
 #define MAX(A, B) ((A) > (B) ? (A) : (B))
 
-typedef struct Entry {
-    uint16_t length;
-    uint16_t prefix;
-    uint8_t  suffix;
-} Entry;
-
-typedef struct Table {
-    int bulk;
-    int nentries;
-    Entry * entries;
-} Table;
-
-#if LV_GIF_CACHE_DECODE_DATA
 #define LZW_MAXBITS                 12
 #define LZW_TABLE_SIZE              (1 << LZW_MAXBITS)
+/* String stack, suffixes and 16 bit prefixes */
 #define LZW_CACHE_SIZE              (LZW_TABLE_SIZE * 4)
-#endif
 
 static gd_GIF  * gif_open(gd_GIF * gif);
 static bool f_gif_open(gd_GIF * gif, const void * path, bool is_file);
@@ -116,19 +103,11 @@ static gd_GIF * gif_open(gd_GIF * gif_base)
         ESP_LOGW(TAG, "Zero size image");
         goto fail;
     }
-#if LV_GIF_CACHE_DECODE_DATA
     if(0 == (INT_MAX - sizeof(gd_GIF) - LZW_CACHE_SIZE) / width / height / 5){
         ESP_LOGW(TAG, "Image dimensions are too large");
         goto fail;
     } 
     gif = lv_malloc(sizeof(gd_GIF) + 5 * width * height + LZW_CACHE_SIZE);
-#else
-    if(0 == (INT_MAX - sizeof(gd_GIF)) / width / height / 5){
-        ESP_LOGW(TAG, "Image dimensions are too large");
-        goto fail;
-    } 
-    gif = lv_malloc(sizeof(gd_GIF) + 5 * width * height);
-#endif
     if(!gif) goto fail;
     memcpy(gif, gif_base, sizeof(gd_GIF));
     gif->width  = width;
@@ -145,9 +124,7 @@ static gd_GIF * gif_open(gd_GIF * gif_base)
         memset(gif->frame, gif->bgindex, gif->width * gif->height);
     }
     bgcolor = &gif->palette->colors[gif->bgindex * 3];
-    #if LV_GIF_CACHE_DECODE_DATA
     gif->lzw_cache = gif->frame + width * height;
-    #endif
 
 #ifdef GIFDEC_FILL_BG
     GIFDEC_FILL_BG(gif->canvas, gif->width * gif->height, 1, gif->width * gif->height, bgcolor, 0x00);
@@ -299,330 +276,198 @@ read_ext(gd_GIF * gif)
     }
 }
 
-static uint16_t
-get_key(gd_GIF *gif, int key_size, uint8_t *sub_len, uint8_t *shift, uint8_t *byte)
+/* Codes are read from a 32 bit accumulator, refilled a sub-block at a time */
+typedef struct BitReader {
+    uint32_t bits;
+    int nbits;
+    const uint8_t * block;
+    int block_pos, block_len;
+    bool end;
+    uint8_t buffer[255];
+} BitReader;
+
+static bool
+read_sub_block(gd_GIF * gif, BitReader * reader)
 {
-    int bits_read;
-    int rpad;
-    int frag_size;
-    uint16_t key;
-
-    key = 0;
-    for (bits_read = 0; bits_read < key_size; bits_read += frag_size) {
-        rpad = (*shift + bits_read) % 8;
-        if (rpad == 0) {
-            /* Update byte. */
-            if (*sub_len == 0) {
-                f_gif_read(gif, sub_len, 1); /* Must be nonzero! */
-                if (*sub_len == 0) return 0x1000;
+    uint8_t size;
+
+    if(gif->stop) {
+        return false;
+    }
+    f_gif_read(gif, &size, 1);
+    if(size == 0) {
+        reader->end = true;
+        return false;
+    }
+    if(gif->is_file) {
+        f_gif_read(gif, reader->buffer, size);
+        reader->block = reader->buffer;
+    }
+    else {
+        reader->block = (const uint8_t *) &gif->data[gif->f_rw_p];
+        gif->f_rw_p += size;
+    }
+    reader->block_pos = 0;
+    reader->block_len = size;
+    return true;
+}
+
+/* Return the next code or -1 at the end of the image data. */
+static inline int
+read_code(gd_GIF * gif, BitReader * reader, int code_size)
+{
+    int code;
+
+    if(reader->nbits < code_size) {
+        while(reader->nbits <= 24) {
+            if(reader->block_pos == reader->block_len) {
+                if(reader->end || !read_sub_block(gif, reader))
+                    break;
             }
-            f_gif_read(gif, byte, 1);
-            (*sub_len)--;
+            reader->bits |= (uint32_t) reader->block[reader->block_pos++] << reader->nbits;
+            reader->nbits += 8;
         }
-        frag_size = MIN(key_size - bits_read, 8 - rpad);
-        key |= ((uint16_t) ((*byte) >> rpad)) << bits_read;
+        if(reader->nbits < code_size)
+            return -1;
     }
-    /* Clear extra bits to the left. */
-    key &= (1 << key_size) - 1;
-    *shift = (*shift + key_size) % 8;
-    return key;
+    code = reader->bits & ((1 << code_size) - 1);
+    reader->bits >>= code_size;
+    reader->nbits -= code_size;
+    return code;
 }
 
-#if LV_GIF_CACHE_DECODE_DATA
 /* Decompress image pixels.
- * Return 0 on success or -1 on out-of-memory (w.r.t. LZW code table) or parse error. */
+ * Return 0 on success or -1 on parse error. */
 static int
-read_image_data(gd_GIF *gif, int interlace)
+read_image_data(gd_GIF * gif, int interlace)
 {
-    uint8_t sub_len, shift, byte;
-    int ret = 0;
-    int key_size;
-    int y, pass, linesize;
-    uint8_t *ptr = NULL;
-    uint8_t *ptr_row_start = NULL;
-    uint8_t *ptr_base = NULL;
-    size_t start, end;
-    uint16_t key, clear_code, stop_code, curr_code;
-    int frm_off, frm_size,curr_size,top_slot,new_codes,slot;
-    /* The first value of the value sequence corresponding to key */
-    int first_value;
-    int last_key;
-    uint8_t *sp = NULL;
-    uint8_t *p_stack = NULL;
-    uint8_t *p_suffix = NULL;
-    uint16_t *p_prefix = NULL;
-
-    /* get initial key size and clear code, stop code */
+    BitReader reader;
+    uint8_t byte;
+    int min_code_size, code_size, code, in_code, prev_code, first_char;
+    int clear_code, stop_code, first_free, next_free;
+    int remaining, row_left, run, y, pass, ret;
+    uint8_t * stack, * sp, * suffix, * ptr, * row_start, * base;
+    uint16_t * prefix;
+
     f_gif_read(gif, &byte, 1);
-    key_size = (int) byte;
-    clear_code = 1 << key_size;
+    min_code_size = byte;
+    memset(&reader, 0, sizeof(reader));
+    if(min_code_size < 1 || min_code_size >= LZW_MAXBITS) {
+        ESP_LOGW(TAG, "invalid LZW code size: %d", min_code_size);
+        discard_sub_blocks(gif);
+        return -1;
+    }
+    clear_code = 1 << min_code_size;
     stop_code = clear_code + 1;
-    key = 0;
-
-    start = f_gif_seek(gif, 0, LV_FS_SEEK_CUR);
-    discard_sub_blocks(gif);
-    end = f_gif_seek(gif, 0, LV_FS_SEEK_CUR);
-    f_gif_seek(gif, start, LV_FS_SEEK_SET);
-
-    linesize = gif->width;
-    ptr_base = &gif->frame[gif->fy * linesize + gif->fx];
-    ptr_row_start = ptr_base;
-    ptr = ptr_row_start;
-    sub_len = shift = 0;
-    /* decoder */
-    pass = 0;
+    first_free = clear_code + 2;
+    code_size = min_code_size + 1;
+    next_free = first_free;
+    prev_code = -1;
+    first_char = 0;
+
+    stack = gif->lzw_cache;
+    suffix = gif->lzw_cache + LZW_TABLE_SIZE;
+    prefix = (uint16_t *)(gif->lzw_cache + LZW_TABLE_SIZE * 2);
+
+    base = &gif->frame[gif->fy * gif->width + gif->fx];
+    row_start = base;
+    ptr = base;
+    row_left = gif->fw;
+    remaining = gif->fw * gif->fh;
     y = 0;
-    p_stack = gif->lzw_cache;
-    p_suffix = gif->lzw_cache + LZW_TABLE_SIZE;
-    p_prefix = (uint16_t*)(gif->lzw_cache + LZW_TABLE_SIZE * 2);
-    frm_off = 0;
-    frm_size = gif->fw * gif->fh;
-    curr_size = key_size + 1;
-    top_slot = 1 << curr_size;
-    new_codes = clear_code + 2;
-    slot = new_codes;
-    first_value = -1;
-    last_key = -1;
-    sp = p_stack;
-
-    while (frm_off < frm_size) {
-        /* copy data to frame buffer */
-        while (sp > p_stack) {
-            if(frm_off >= frm_size){
-                ESP_LOGW(TAG, "LZW table token overflows the frame buffer");
-                return -1;
-            }
-            *ptr++ = *(--sp);
-            frm_off += 1;
-            /* read one line */
-            if ((ptr - ptr_row_start) == gif->fw) {
-                if (interlace) {
-                    switch(pass) {
-                    case 0:
-                    case 1:
-                        y += 8;
-                        ptr_row_start += linesize * 8;
-                        break;
-                    case 2:
-                        y += 4;
-                        ptr_row_start += linesize * 4;
-                        break;
-                    case 3:
-                        y += 2;
-                        ptr_row_start += linesize * 2;
-                        break;
-                    default:
-                        break;
-                    }
-                    while (y >= gif->fh) {
-                        y  = 4 >> pass;
-                        ptr_row_start = ptr_base + linesize * y;
-                        pass++;
-                    }
-                } else {
-                    ptr_row_start += linesize;
-                }
-                ptr = ptr_row_start;
-            }
-        }
-
-        key = get_key(gif, curr_size, &sub_len, &shift, &byte);
+    pass = 0;
+    ret = 0;
 
-        if (key == stop_code || key >= LZW_TABLE_SIZE)
+    while(remaining > 0) {
+        code = read_code(gif, &reader, code_size);
+        if(code < 0 || code == stop_code)
             break;
-
-        if (key == clear_code) {
-            curr_size = key_size + 1;
-            slot = new_codes;
-            top_slot = 1 << curr_size;
-            first_value = last_key = -1;
-            sp = p_stack;
+        if(code == clear_code) {
+            code_size = min_code_size + 1;
+            next_free = first_free;
+            prev_code = -1;
             continue;
         }
 
-        curr_code = key;
-        /*
-         * If the current code is a code that will be added to the decoding
-         * dictionary, it is composed of the data list corresponding to the
-         * previous key and its first data.
-         * */
-        if (curr_code == slot && first_value >= 0) {
-            *sp++ = first_value;
-            curr_code = last_key;
-        }else if(curr_code >= slot)
-            break;
-
-        while (curr_code >= new_codes) {
-            *sp++ = p_suffix[curr_code];
-            curr_code = p_prefix[curr_code];
-        }
-        *sp++ = curr_code;
-
-        /* Add code to decoding dictionary */
-        if (slot < top_slot && last_key >= 0) {
-            p_suffix[slot] = curr_code;
-            p_prefix[slot++] = last_key;
+        sp = stack;
+        if(prev_code < 0) {
+            /* The first code after a clear is a single pixel */
+            if(code >= clear_code) {
+                ESP_LOGW(TAG, "invalid LZW code: %d", code);
+                ret = -1;
+                break;
+            }
+            first_char = code;
+            *sp++ = code;
         }
-        first_value = curr_code;
-        last_key = key;
-        if (slot >= top_slot) {
-            if (curr_size < LZW_MAXBITS) {
-                top_slot <<= 1;
-                curr_size += 1;
+        else {
+            in_code = code;
+            if(code >= next_free) {
+                /* The string of the previous code followed by its own first pixel */
+                if(code > next_free) {
+                    ESP_LOGW(TAG, "invalid LZW code: %d", code);
+                    ret = -1;
+                    break;
+                }
+                *sp++ = first_char;
+                in_code = prev_code;
+            }
+            while(in_code >= first_free) {
+                *sp++ = suffix[in_code];
+                in_code = prefix[in_code];
+            }
+            first_char = in_code;
+            *sp++ = in_code;
+
+            if(next_free < LZW_TABLE_SIZE) {
+                prefix[next_free] = prev_code;
+                suffix[next_free] = first_char;
+                next_free++;
+                if(next_free == (1 << code_size) && code_size < LZW_MAXBITS)
+                    code_size++;
             }
         }
-    }
-
-    if (key == stop_code) f_gif_read(gif, &sub_len, 1); /* Must be zero! */
-    f_gif_seek(gif, end, LV_FS_SEEK_SET);
-    return ret;
-}
-#else
-static Table *
-new_table(int key_size)
-{
-    int key;
-    int init_bulk = MAX(1 << (key_size + 1), 0x100);
-    Table * table = lv_malloc(sizeof(*table) + sizeof(Entry) * init_bulk);
-    if(table) {
-        table->bulk = init_bulk;
-        table->nentries = (1 << key_size) + 2;
-        table->entries = (Entry *) &table[1];
-        for(key = 0; key < (1 << key_size); key++)
-            table->entries[key] = (Entry) {
-            1, 0xFFF, key
-        };
-    }
-    return table;
-}
-
-/* Add table entry. Return value:
- *  0 on success
- *  +1 if key size must be incremented after this addition
- *  -1 if could not realloc table */
-static int
-add_entry(Table ** tablep, uint16_t length, uint16_t prefix, uint8_t suffix)
-{
-    Table * table = *tablep;
-    if(table->nentries == table->bulk) {
-        table->bulk *= 2;
-        table = lv_realloc(table, sizeof(*table) + sizeof(Entry) * table->bulk);
-        if(!table) return -1;
-        table->entries = (Entry *) &table[1];
-        *tablep = table;
-    }
-    table->entries[table->nentries] = (Entry) {
-        length, prefix, suffix
-    };
-    table->nentries++;
-    if((table->nentries & (table->nentries - 1)) == 0)
-        return 1;
-    return 0;
-}
-
-/* Compute output index of y-th input line, in frame of height h. */
-static int
-interlaced_line_index(int h, int y)
-{
-    int p; /* number of lines in current pass */
-
-    p = (h - 1) / 8 + 1;
-    if(y < p)  /* pass 1 */
-        return y * 8;
-    y -= p;
-    p = (h - 5) / 8 + 1;
-    if(y < p)  /* pass 2 */
-        return y * 8 + 4;
-    y -= p;
-    p = (h - 3) / 4 + 1;
-    if(y < p)  /* pass 3 */
-        return y * 4 + 2;
-    y -= p;
-    /* pass 4 */
-    return y * 2 + 1;
-}
-
-/* Decompress image pixels.
- * Return 0 on success or -1 on out-of-memory (w.r.t. LZW code table) or parse error. */
-static int
-read_image_data(gd_GIF * gif, int interlace)
-{
-    uint8_t sub_len, shift, byte;
-    int init_key_size, key_size, table_is_full = 0;
-    int frm_off, frm_size, str_len = 0, i, p, x, y;
-    uint16_t key, clear, stop;
-    int ret;
-    Table * table;
-    Entry entry = {0};
-    size_t start, end;
+        prev_code = code;
 
-    f_gif_read(gif, &byte, 1);
-    key_size = (int) byte;
-    start = f_gif_seek(gif, 0, LV_FS_SEEK_CUR);
-    discard_sub_blocks(gif);
-    end = f_gif_seek(gif, 0, LV_FS_SEEK_CUR);
-    f_gif_seek(gif, start, LV_FS_SEEK_SET);
-    clear = 1 << key_size;
-    stop = clear + 1;
-    table = new_table(key_size);
-    key_size++;
-    init_key_size = key_size;
-    sub_len = shift = 0;
-    key = get_key(gif, key_size, &sub_len, &shift, &byte); /* clear code */
-    frm_off = 0;
-    ret = 0;
-    frm_size = gif->fw * gif->fh;
-    while(frm_off < frm_size) {
-        if(key == clear) {
-            key_size = init_key_size;
-            table->nentries = (1 << (key_size - 1)) + 2;
-            table_is_full = 0;
+        if(sp - stack > remaining) {
+            ESP_LOGW(TAG, "LZW table token overflows the frame buffer");
+            ret = -1;
+            break;
         }
-        else if(!table_is_full) {
-            ret = add_entry(&table, str_len + 1, key, entry.suffix);
-            if(ret == -1) {
-                lv_free(table);
-                return -1;
+        remaining -= sp - stack;
+
+        /* The string is on the stack in reverse order, copy it a row at a time */
+        while(sp > stack) {
+            run = MIN(sp - stack, row_left);
+            row_left -= run;
+            while(run--)
+                *ptr++ = *--sp;
+            if(row_left > 0)
+                continue;
+            row_left = gif->fw;
+            if(interlace) {
+                y += pass == 3 ? 2 : pass == 2 ? 4 : 8;
+                while(y >= gif->fh && pass < 3) {
+                    pass++;
+                    y = pass == 1 ? 4 : pass == 2 ? 2 : 1;
+                }
+                row_start = base + y * gif->width;
             }
-            if(table->nentries == 0x1000) {
-                ret = 0;
-                table_is_full = 1;
+            else {
+                row_start += gif->width;
             }
+            ptr = row_start;
         }
-        key = get_key(gif, key_size, &sub_len, &shift, &byte);
-        if(key == clear) continue;
-        if(key == stop || key == 0x1000) break;
-        if(ret == 1) key_size++;
-        entry = table->entries[key];
-        str_len = entry.length;
-	if(frm_off + str_len > frm_size){
-		ESP_LOGW(TAG, "LZW table token overflows the frame buffer");
-		lv_free(table);
-		return -1;
-	}
-        for(i = 0; i < str_len; i++) {
-            p = frm_off + entry.length - 1;
-            x = p % gif->fw;
-            y = p / gif->fw;
-            if(interlace)
-                y = interlaced_line_index((int) gif->fh, y);
-            gif->frame[(gif->fy + y) * gif->width + gif->fx + x] = entry.suffix;
-            if(entry.prefix == 0xFFF)
-                break;
-            else
-                entry = table->entries[entry.prefix];
-        }
-        frm_off += str_len;
-        if(key < table->nentries - 1 && !table_is_full)
-            table->entries[table->nentries - 1].suffix = entry.suffix;
-    }
-    lv_free(table);
-    if(key == stop) f_gif_read(gif, &sub_len, 1);  /* Must be zero! */
-    f_gif_seek(gif, end, LV_FS_SEEK_SET);
-    return 0;
-}
+    }
 
-#endif
+    /* The frame is incomplete, the caller rewinds or closes the GIF */
+    if(gif->stop)
+        return -1;
+    /* Skip the padding and everything after a stop code or an error */
+    if(!reader.end)
+        discard_sub_blocks(gif);
+    return ret;
+}
 
 /* Read image.
  * Return 0 on success or -1 on out-of-memory (w.r.t. LZW code table) or parse error. */
@@ -666,18 +511,30 @@ render_frame_rect(gd_GIF * gif, uint8_t * buffer)
                         &gif->frame[i], gif->palette->colors,
                         gif->gce.transparency ? gif->gce.tindex : 0x100);
 #else
-    int j, k;
-    uint8_t index, * color;
+    uint32_t * palette = gif->palette32;
+    uint32_t * dst;
+    const uint8_t * src;
+    const uint8_t * color;
+    int j, k, tindex;
+
+    /* The canvas is B, G, R, A in memory, i.e. little endian 0xAARRGGBB */
+    for(j = 0; j < 0x100; j++) {
+        color = &gif->palette->colors[j * 3];
+        palette[j] = 0xFF000000 | ((uint32_t) color[0] << 16) | ((uint32_t) color[1] << 8) | color[2];
+    }
+    tindex = gif->gce.transparency ? gif->gce.tindex : 0x100;
 
     for(j = 0; j < gif->fh; j++) {
-        for(k = 0; k < gif->fw; k++) {
-            index = gif->frame[(gif->fy + j) * gif->width + gif->fx + k];
-            color = &gif->palette->colors[index * 3];
-            if(!gif->gce.transparency || index != gif->gce.tindex) {
-                buffer[(i + k) * 4 + 0] = *(color + 2);
-                buffer[(i + k) * 4 + 1] = *(color + 1);
-                buffer[(i + k) * 4 + 2] = *(color + 0);
-                buffer[(i + k) * 4 + 3] = 0xFF;
+        dst = (uint32_t *) &buffer[i * 4];
+        src = &gif->frame[i];
+        if(tindex > 0xFF) {
+            for(k = 0; k < gif->fw; k++)
+                dst[k] = palette[src[k]];
+        }
+        else {
+            for(k = 0; k < gif->fw; k++) {
+                if(src[k] != tindex)
+                    dst[k] = palette[src[k]];
             }
         }
         i += gif->width;
@@ -701,14 +558,13 @@ dispose(gd_GIF * gif)
 #ifdef GIFDEC_FILL_BG
             GIFDEC_FILL_BG(&(gif->canvas[i * 4]), gif->fw, gif->fh, gif->width, bgcolor, opa);
 #else
+            uint32_t fill = ((uint32_t) opa << 24) | ((uint32_t) bgcolor[0] << 16) | ((uint32_t) bgcolor[1] << 8) | bgcolor[2];
+            uint32_t * dst;
             int j, k;
             for(j = 0; j < gif->fh; j++) {
-                for(k = 0; k < gif->fw; k++) {
-                    gif->canvas[(i + k) * 4 + 0] = *(bgcolor + 2);
-                    gif->canvas[(i + k) * 4 + 1] = *(bgcolor + 1);
-                    gif->canvas[(i + k) * 4 + 2] = *(bgcolor + 0);
-                    gif->canvas[(i + k) * 4 + 3] = opa;
-                }
+                dst = (uint32_t *) &gif->canvas[i * 4];
+                for(k = 0; k < gif->fw; k++)
+                    dst[k] = fill;
                 i += gif->width;
             }
 #endif
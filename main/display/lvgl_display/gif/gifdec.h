@@ -36,6 +36,7 @@ typedef struct _gd_GIF {
     gd_GCE gce;
     gd_Palette * palette;
     gd_Palette lct, gct;
+    uint32_t palette32[0x100];  /* Palette in the canvas format, rebuilt for each frame */
     void (*plain_text)(
         struct _gd_GIF * gif, uint16_t tx, uint16_t ty,
         uint16_t tw, uint16_t th, uint8_t cw, uint8_t ch,
@@ -46,9 +47,8 @@ typedef struct _gd_GIF {
     uint16_t fx, fy, fw, fh;
     uint8_t bgindex;
     uint8_t * canvas, * frame;
-#if LV_GIF_CACHE_DECODE_DATA
-    uint8_t *lzw_cache;
-#endif
+    uint8_t * lzw_cache;
+    volatile uint8_t stop;  /* Set by another task to abandon the frame being decoded, gd_get_frame() returns -1 */
 } gd_GIF;
 
 gd_GIF * gd_open_gif_file(const char * fname);
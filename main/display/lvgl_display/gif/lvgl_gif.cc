@@ -1,9 +1,23 @@
 #include "lvgl_gif.h"
+#include "event_trace.h"
+#include "pixel_convert.h"
 #include <esp_log.h>
+#include <esp_heap_caps.h>
 #include <cstring>
 
 #define TAG "LvglGif"
 
+#ifdef CONFIG_GIF_FRAME_CACHE_SIZE
+#define FRAME_CACHE_BUDGET (CONFIG_GIF_FRAME_CACHE_SIZE * 1024)
+#else
+#define FRAME_CACHE_BUDGET 0
+#endif
+
+// Below the LVGL task, decoding ahead must not delay rendering, but above idle so busy idle work cannot starve it
+#define GIF_DECODER_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+// A stopped worker returns within one LZW sub-block, waiting longer than this means it is stuck
+#define GIF_DECODER_STOP_TIMEOUT_MS 500
+
 LvglGif::LvglGif(const lv_img_dsc_t* img_dsc)
     : gif_(nullptr), timer_(nullptr), last_call_(0), playing_(false), loaded_(false),
       loop_delay_ms_(0), loop_waiting_(false), loop_wait_start_(0) {
@@ -66,6 +80,9 @@ void LvglGif::Start() {
     }
 
     if (timer_) {
+        if (!cache_ready_ && !worker_) {
+            StartWorker();
+        }
         playing_ = true;
         loop_waiting_ = false;  // Reset loop waiting state
         last_call_ = lv_tick_get();
@@ -109,7 +126,16 @@ void LvglGif::Stop() {
     // Reset loop waiting state
     loop_waiting_ = false;
 
-    if (gif_) {
+    StopWorker();
+    if (cache_ready_) {
+        gd_rewind(gif_);
+        ShowCachedFrame(0);
+        ESP_LOGD(TAG, "GIF animation stopped and rewound");
+    } else if (gif_) {
+        if (front_.data) {
+            FreePrefetchBuffers();
+            SetImageData(gif_->canvas, LV_COLOR_FORMAT_ARGB8888);
+        }
         gd_rewind(gif_);
         // Render first frame without advancing
         if (gif_->canvas) {
@@ -169,6 +195,10 @@ void LvglGif::SetFrameCallback(std::function<void()> callback) {
     frame_callback_ = callback;
 }
 
+uint32_t LvglGif::GetMissedFrames() const {
+    return missed_frames_;
+}
+
 void LvglGif::NextFrame() {
     if (!loaded_ || !gif_ || !playing_) {
         return;
@@ -184,53 +214,349 @@ void LvglGif::NextFrame() {
         // Loop delay completed, continue playing
         loop_waiting_ = false;
         ESP_LOGD(TAG, "Loop delay completed, continuing GIF");
+        last_call_ = lv_tick_get();
+        ShowPendingFrame();
+        return;
     }
 
     // Check if enough time has passed for the next frame
     uint32_t elapsed = lv_tick_elaps(last_call_);
-    if (elapsed < gif_->gce.delay * 10) {
+    uint32_t delay_ms;
+    if (cache_ready_) {
+        delay_ms = cached_frames_[cached_frame_index_].delay_ms;
+    } else if (worker_) {
+        delay_ms = front_.delay_ms;
+    } else {
+        delay_ms = gif_->gce.delay * 10;
+    }
+    if (elapsed < delay_ms) {
         return;
     }
 
+    bool looped = false;
+    if (cache_ready_) {
+        looped = cached_frame_index_ + 1 == cached_frames_.size();
+    } else if (worker_) {
+        if (!back_ready_.load(std::memory_order_acquire)) {
+            // Count each late frame once
+            if (!deadline_missed_) {
+                deadline_missed_ = true;
+                missed_frames_++;
+                TRACE_INSTANT("gif.missed_frame", missed_frames_);
+            }
+            return;
+        }
+        deadline_missed_ = false;
+        if (back_.end) {
+            playing_ = false;
+            if (timer_) {
+                lv_timer_pause(timer_);
+            }
+            ESP_LOGD(TAG, "GIF animation completed");
+            return;
+        }
+        looped = back_.looped;
+    } else {
+        bool cache_complete = false;
+        if (DecodeNextFrame(looped, cache_complete) == 0) {
+            // Animation truly finished (non-infinite loop)
+            playing_ = false;
+            if (timer_) {
+                lv_timer_pause(timer_);
+            }
+            ESP_LOGD(TAG, "GIF animation completed");
+            return;
+        }
+        if (cache_complete) {
+            ActivateFrameCache();
+        }
+    }
+
     last_call_ = lv_tick_get();
+    if (looped && loop_delay_ms_ > 0) {
+        // The next frame starts a new loop, wait before showing it
+        loop_waiting_ = true;
+        loop_wait_start_ = lv_tick_get();
+        ESP_LOGD(TAG, "GIF completed one cycle, waiting %lu ms before next loop", loop_delay_ms_);
+        return;
+    }
+    ShowPendingFrame();
+}
 
+int LvglGif::DecodeNextFrame(bool& looped, bool& cache_complete) {
+    TRACE_SCOPE("gif.decode", gif_->width * gif_->height);
     // Save file position before getting next frame to detect loop
     uint32_t pos_before = gif_->f_rw_p;
+    if (pos_before == (uint32_t)gif_->anim_start) {
+        StartFrameCache();
+    }
 
-    // Get next frame
     int has_next = gd_get_frame(gif_);
     if (has_next == 0) {
-        // Animation truly finished (non-infinite loop)
-        playing_ = false;
-        if (timer_) {
-            lv_timer_pause(timer_);
-        }
-        ESP_LOGD(TAG, "GIF animation completed");
-        return;
+        return 0;
+    }
+    if (gif_->stop) {
+        // Abandoned by StopWorker(), the frame is incomplete
+        return has_next;
     }
 
     // Detect loop by checking if file position jumped back (rewound to start)
     // This works for looping GIFs regardless of when loop_count is set
-    if (loop_delay_ms_ > 0 && gif_->f_rw_p < pos_before) {
-        // File position decreased, meaning GIF looped back to beginning
-        // Start waiting before rendering this frame
-        loop_waiting_ = true;
-        loop_wait_start_ = lv_tick_get();
-        ESP_LOGD(TAG, "GIF completed one cycle, waiting %lu ms before next loop", loop_delay_ms_);
+    looped = gif_->f_rw_p < pos_before;
+    cache_complete = looped && cache_capturing_ && FinishFrameCache();
+    if (!cache_complete && gif_->canvas) {
+        gd_render_frame(gif_, gif_->canvas);
+        if (cache_capturing_) {
+            CacheFrame();
+        }
+    }
+    return has_next;
+}
+
+void LvglGif::ShowPendingFrame() {
+    if (cache_ready_) {
+        ShowCachedFrame((cached_frame_index_ + 1) % cached_frames_.size());
+    } else if (worker_) {
+        ShowPrefetchedFrame();
+    } else if (frame_callback_) {
+        frame_callback_();
+    }
+}
+
+void LvglGif::SetImageData(const uint8_t* data, lv_color_format_t cf) {
+    size_t pixels = gif_->width * gif_->height;
+    img_dsc_.header.cf = cf;
+    if (cf == LV_COLOR_FORMAT_ARGB8888) {
+        img_dsc_.header.stride = gif_->width * 4;
+        img_dsc_.data_size = pixels * 4;
+    } else {
+        // The alpha plane of RGB565A8 follows the RGB565 plane
+        img_dsc_.header.stride = gif_->width * 2;
+        img_dsc_.data_size = pixels * (cf == LV_COLOR_FORMAT_RGB565A8 ? 3 : 2);
+    }
+    img_dsc_.data = data;
+}
+
+bool LvglGif::ConvertCanvas(uint8_t* dst) {
+    // The canvas is ARGB8888, B, G, R, A in memory
+    return pixel_argb8888_to_rgb565a8(dst, gif_->canvas, gif_->width * gif_->height);
+}
+
+void LvglGif::StartFrameCache() {
+    if (cache_ready_ || cache_disabled_) {
+        return;
+    }
+    if (FRAME_CACHE_BUDGET == 0) {
+        cache_disabled_ = true;
         return;
     }
+    ClearFrameCache();
+    cache_capturing_ = true;
+    cache_opaque_ = true;
+}
 
-    // Render current frame
-    if (gif_->canvas) {
-        gd_render_frame(gif_, gif_->canvas);
-        
-        // Call frame callback if set
-        if (frame_callback_) {
-            frame_callback_();
+void LvglGif::CacheFrame() {
+    // The loop count is known once the first frame is read
+    if (gif_->loop_count != 0) {
+        ClearFrameCache();
+        cache_disabled_ = true;
+        return;
+    }
+    // RGB565 plane followed by the alpha plane, the layout of LV_COLOR_FORMAT_RGB565A8
+    size_t frame_size = gif_->width * gif_->height * 3;
+    if ((cached_frames_.size() + 1) * frame_size > FRAME_CACHE_BUDGET) {
+        ESP_LOGD(TAG, "GIF frames exceed the cache budget, decoding every loop");
+        ClearFrameCache();
+        cache_disabled_ = true;
+        return;
+    }
+    auto data = (uint8_t*)heap_caps_malloc(frame_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (data == nullptr) {
+        ESP_LOGW(TAG, "Failed to allocate GIF frame cache");
+        ClearFrameCache();
+        cache_disabled_ = true;
+        return;
+    }
+    cache_opaque_ = ConvertCanvas(data) && cache_opaque_;
+    cached_frames_.push_back({data, (uint32_t)gif_->gce.delay * 10});
+}
+
+bool LvglGif::FinishFrameCache() {
+    cache_capturing_ = false;
+    // Only infinite loops replay the same frames forever
+    if (gif_->loop_count != 0 || cached_frames_.empty()) {
+        ClearFrameCache();
+        cache_disabled_ = true;
+        return false;
+    }
+
+    if (cache_opaque_) {
+        // Drop the alpha planes
+        size_t rgb_size = gif_->width * gif_->height * 2;
+        for (auto& frame : cached_frames_) {
+            auto data = (uint8_t*)heap_caps_realloc(frame.data, rgb_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            if (data != nullptr) {
+                frame.data = data;
+            }
+        }
+    }
+    return true;
+}
+
+void LvglGif::ActivateFrameCache() {
+    cache_ready_ = true;
+    // The frame shown next is the first one
+    cached_frame_index_ = cached_frames_.size() - 1;
+    SetImageData(cached_frames_[cached_frame_index_].data, cache_opaque_ ? LV_COLOR_FORMAT_RGB565 : LV_COLOR_FORMAT_RGB565A8);
+    ESP_LOGI(TAG, "Cached %u frames of %dx%d GIF, %u bytes", (unsigned)cached_frames_.size(),
+        gif_->width, gif_->height, (unsigned)(cached_frames_.size() * img_dsc_.data_size));
+}
+
+void LvglGif::ClearFrameCache() {
+    // The worker only gets here while the cache is not ready, cache_ready_ belongs to the LVGL task
+    if (cache_ready_) {
+        // Back to the decoder canvas
+        SetImageData(gif_->canvas, LV_COLOR_FORMAT_ARGB8888);
+        cache_ready_ = false;
+    }
+    for (auto& frame : cached_frames_) {
+        heap_caps_free(frame.data);
+    }
+    cached_frames_.clear();
+    cached_frame_index_ = 0;
+    cache_capturing_ = false;
+}
+
+void LvglGif::ShowCachedFrame(size_t index) {
+    cached_frame_index_ = index;
+    img_dsc_.data = cached_frames_[index].data;
+    if (frame_callback_) {
+        frame_callback_();
+    }
+}
+
+bool LvglGif::StartWorker() {
+    size_t frame_size = gif_->width * gif_->height * 3;
+    front_ = PrefetchFrame();
+    back_ = PrefetchFrame();
+    front_.data = (uint8_t*)heap_caps_malloc(frame_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    back_.data = (uint8_t*)heap_caps_malloc(frame_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    worker_done_ = xSemaphoreCreateBinary();
+    if (front_.data == nullptr || back_.data == nullptr || worker_done_ == nullptr) {
+        ESP_LOGD(TAG, "No PSRAM for the GIF frame buffers, decoding in the LVGL task");
+        FreePrefetchBuffers();
+        if (worker_done_) {
+            vSemaphoreDelete(worker_done_);
+            worker_done_ = nullptr;
+        }
+        return false;
+    }
+
+    // The worker composes on the canvas, show a copy of it until the first frame is ready
+    ConvertCanvas(front_.data);
+    SetImageData(front_.data, LV_COLOR_FORMAT_RGB565A8);
+    back_ready_.store(false);
+    worker_stop_.store(false);
+    gif_->stop = 0;
+    // Waiting for the first frame is not a missed deadline
+    deadline_missed_ = true;
+
+    if (xTaskCreate([](void* arg) {
+        LvglGif* gif_obj = static_cast<LvglGif*>(arg);
+        gif_obj->WorkerTask();
+        vTaskDelete(NULL);
+    }, "gif_decoder", 4096, this, GIF_DECODER_TASK_PRIORITY, &worker_) != pdPASS) {
+        ESP_LOGW(TAG, "Failed to create the GIF decoder task");
+        worker_ = nullptr;
+        vSemaphoreDelete(worker_done_);
+        worker_done_ = nullptr;
+        FreePrefetchBuffers();
+        SetImageData(gif_->canvas, LV_COLOR_FORMAT_ARGB8888);
+        return false;
+    }
+    xTaskNotifyGive(worker_);
+    return true;
+}
+
+void LvglGif::StopWorker() {
+    if (!worker_) {
+        return;
+    }
+    // The decoder abandons the frame in progress at the next LZW sub-block, the GIF is rewound or closed after this
+    worker_stop_.store(true);
+    gif_->stop = 1;
+    // The caller may hold the display lock, run the worker at its priority so that it finishes quickly
+    vTaskPrioritySet(worker_, uxTaskPriorityGet(NULL));
+    xTaskNotifyGive(worker_);
+    while (xSemaphoreTake(worker_done_, pdMS_TO_TICKS(GIF_DECODER_STOP_TIMEOUT_MS)) != pdTRUE) {
+        // The worker still uses the GIF and the frame buffers, they cannot be freed before it returns
+        ESP_LOGE(TAG, "GIF decoder task did not stop in %d ms", GIF_DECODER_STOP_TIMEOUT_MS);
+    }
+    vSemaphoreDelete(worker_done_);
+    worker_done_ = nullptr;
+    worker_ = nullptr;
+    gif_->stop = 0;
+    back_ready_.store(false);
+}
+
+void LvglGif::WorkerTask() {
+    bool finished = false;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (worker_stop_.load()) {
+            break;
+        }
+        if (finished || back_ready_.load(std::memory_order_acquire)) {
+            continue;
+        }
+
+        bool looped = false;
+        bool cache_complete = false;
+        int has_next = DecodeNextFrame(looped, cache_complete);
+        if (worker_stop_.load()) {
+            break;
         }
+        back_.delay_ms = gif_->gce.delay * 10;
+        back_.looped = looped;
+        back_.end = has_next == 0;
+        back_.cache_complete = cache_complete;
+        if (!back_.end && !cache_complete) {
+            ConvertCanvas(back_.data);
+        }
+        // Nothing is left to decode after the last frame or once the whole loop is cached
+        finished = back_.end || cache_complete;
+        back_ready_.store(true, std::memory_order_release);
+    }
+    xSemaphoreGive(worker_done_);
+}
+
+void LvglGif::ShowPrefetchedFrame() {
+    if (back_.cache_complete) {
+        // The worker is idle, the cache replaces the frame buffers
+        StopWorker();
+        ActivateFrameCache();
+        FreePrefetchBuffers();
+        ShowCachedFrame(0);
+        return;
+    }
+
+    std::swap(front_, back_);
+    SetImageData(front_.data, LV_COLOR_FORMAT_RGB565A8);
+    // Hand the old front buffer over to the worker
+    back_ready_.store(false, std::memory_order_release);
+    xTaskNotifyGive(worker_);
+    if (frame_callback_) {
+        frame_callback_();
     }
 }
 
+void LvglGif::FreePrefetchBuffers() {
+    heap_caps_free(front_.data);
+    heap_caps_free(back_.data);
+    front_ = PrefetchFrame();
+    back_ = PrefetchFrame();
+}
+
 void LvglGif::Cleanup() {
     // Stop and delete timer
     if (timer_) {
@@ -238,6 +564,16 @@ void LvglGif::Cleanup() {
         timer_ = nullptr;
     }
 
+    // Free the frames before the canvas
+    StopWorker();
+    if (missed_frames_ > 0) {
+        ESP_LOGI(TAG, "GIF frames decoded too late: %lu", missed_frames_);
+    }
+    if (gif_) {
+        FreePrefetchBuffers();
+        ClearFrameCache();
+    }
+
     // Close GIF decoder
     if (gif_) {
         gd_close_gif(gif_);
@@ -3,8 +3,13 @@
 #include "../lvgl_image.h"
 #include "gifdec.h"
 #include <lvgl.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
 #include <memory>
 #include <functional>
+#include <vector>
+#include <atomic>
 
 /**
  * C++ implementation of LVGL GIF widget
@@ -80,6 +85,11 @@ public:
      */
     void SetFrameCallback(std::function<void()> callback);
 
+    /**
+     * Number of frames that were not decoded in time to be shown
+     */
+    uint32_t GetMissedFrames() const;
+
 private:
     // GIF decoder instance
     gd_GIF* gif_;
@@ -104,12 +114,74 @@ private:
     
     // Frame update callback
     std::function<void()> frame_callback_;
+
+    // Composed frames of an infinitely looping GIF, captured during the first loop
+    struct CachedFrame {
+        uint8_t* data;
+        uint32_t delay_ms;
+    };
+    std::vector<CachedFrame> cached_frames_;
+    size_t cached_frame_index_ = 0;
+    bool cache_capturing_ = false;
+    bool cache_ready_ = false;
+    bool cache_disabled_ = false;
+    bool cache_opaque_ = true;
+
+    // The worker task decodes the next frame into the back buffer while the front one is shown.
+    // back_ belongs to the worker while back_ready_ is false, to the LVGL task while it is true.
+    struct PrefetchFrame {
+        uint8_t* data = nullptr;
+        uint32_t delay_ms = 0;
+        bool looped = false;          // First frame of a new loop
+        bool end = false;             // The animation is over, there is no frame
+        bool cache_complete = false;  // The frame cache holds the whole loop now
+    };
+    PrefetchFrame front_;
+    PrefetchFrame back_;
+    std::atomic<bool> back_ready_ = false;
+    std::atomic<bool> worker_stop_ = false;
+    TaskHandle_t worker_ = nullptr;
+    SemaphoreHandle_t worker_done_ = nullptr;
+    bool deadline_missed_ = false;
+    uint32_t missed_frames_ = 0;
     
     /**
      * Update to next frame
      */
     void NextFrame();
     
+    /**
+     * Decode and compose the next frame on the canvas, returns 0 at the end of the animation
+     */
+    int DecodeNextFrame(bool& looped, bool& cache_complete);
+
+    /**
+     * Show the frame decoded last, after the frame delay or the loop delay
+     */
+    void ShowPendingFrame();
+    void SetImageData(const uint8_t* data, lv_color_format_t cf);
+    // Convert the canvas to RGB565A8, returns whether it is opaque
+    bool ConvertCanvas(uint8_t* dst);
+
+    /**
+     * Frame cache: capture the frames of the first loop, then play them without decoding
+     */
+    void StartFrameCache();
+    void CacheFrame();
+    bool FinishFrameCache();
+    void ActivateFrameCache();
+    void ClearFrameCache();
+    void ShowCachedFrame(size_t index);
+
+    /**
+     * Background decoding, falls back to decoding in the LVGL timer without PSRAM for the buffers
+     */
+    bool StartWorker();
+    void StopWorker();
+    void WorkerTask();
+    void ShowPrefetchedFrame();
+    void FreePrefetchBuffers();
+
     /**
      * Cleanup resources
      */
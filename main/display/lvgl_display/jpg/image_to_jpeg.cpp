@@ -7,7 +7,7 @@
 
 #include "esp_jpeg_common.h"
 #include "esp_jpeg_enc.h"
-#include "esp_imgfx_color_convert.h"
+#include "pixel_convert.h"
 
 #if CONFIG_XIAOZHI_ENABLE_HARDWARE_JPEG_ENCODER
 #include "driver/jpeg_encode.h"
@@ -69,20 +69,11 @@ static uint8_t* convert_input_to_encoder_buf(const uint8_t* src, uint16_t width,
     // 当前版本暂时不会出现 UYVY 格式
     if (format == V4L2_PIX_FMT_UYVY) [[unlikely]] {
         int sz = (int)width * (int)height * 2;
-        const uint8_t* s = src;
         uint8_t* buf = (uint8_t*)jpeg_calloc_align(sz, 16);
         if (!buf)
             return NULL;
-        uint8_t* d = buf;
-        for (int i = 0; i < sz; i += 4) {
-            // src: Cb, Y0, Cr, Y1 -> dst: Y0, Cb, Y1, Cr
-            d[0] = s[1];
-            d[1] = s[0];
-            d[2] = s[3];
-            d[3] = s[2];
-            s += 4;
-            d += 4;
-        }
+        // Cb, Y0, Cr, Y1 -> Y0, Cb, Y1, Cr 即交换每个 16 位值的字节
+        pixel_swap16(buf, src, sz / 2);
         if (out_fmt)
             *out_fmt = JPEG_PIXEL_FORMAT_YCbYCr;
         if (out_size)
@@ -94,29 +85,10 @@ static uint8_t* convert_input_to_encoder_buf(const uint8_t* src, uint16_t width,
     // 当前版本暂时不会出现 YUV422P 格式
     if (format == V4L2_PIX_FMT_YUV422P) [[unlikely]] {
         int sz = (int)width * (int)height * 2;
-        const uint8_t* y_plane = src;
-        const uint8_t* u_plane = y_plane + (int)width * (int)height;
-        const uint8_t* v_plane = u_plane + ((int)width / 2) * (int)height;
         uint8_t* buf = (uint8_t*)jpeg_calloc_align(sz, 16);
         if (!buf)
             return NULL;
-        uint8_t* dst = buf;
-        for (int y = 0; y < height; y++) {
-            const uint8_t* y_row = y_plane + y * (int)width;
-            const uint8_t* u_row = u_plane + y * ((int)width / 2);
-            const uint8_t* v_row = v_plane + y * ((int)width / 2);
-            for (int x = 0; x < width; x += 2) {
-                uint8_t y0 = y_row[x + 0];
-                uint8_t y1 = y_row[x + 1];
-                uint8_t cb = u_row[x / 2];
-                uint8_t cr = v_row[x / 2];
-                dst[0] = y0;
-                dst[1] = cb;
-                dst[2] = y1;
-                dst[3] = cr;
-                dst += 4;
-            }
-        }
+        pixel_yuv422p_to_yuyv(buf, src, width, height);
         if (out_fmt)
             *out_fmt = JPEG_PIXEL_FORMAT_YCbYCr;
         if (out_size)
@@ -150,36 +122,10 @@ static uint8_t* convert_input_to_encoder_buf(const uint8_t* src, uint16_t width,
         uint8_t* buf = (uint8_t*)jpeg_calloc_align(sz, 16);
         if (!buf)
             return nullptr;
-        esp_imgfx_color_convert_cfg_t convert_cfg = {
-            .in_res = {.width = static_cast<int16_t>(width),
-                        .height = static_cast<int16_t>(height)},
-            .in_pixel_fmt = in_pixel_fmt,
-            .out_pixel_fmt = ESP_IMGFX_PIXEL_FMT_YUYV,
-            .color_space_std = ESP_IMGFX_COLOR_SPACE_STD_BT601,
-        };
-        esp_imgfx_color_convert_handle_t convert_handle = nullptr;
-        esp_imgfx_err_t err = esp_imgfx_color_convert_open(&convert_cfg, &convert_handle);
-        if (err != ESP_IMGFX_ERR_OK || convert_handle == nullptr) {
-            ESP_LOGE(TAG, "esp_imgfx_color_convert_open failed");
-            jpeg_free_align(buf);
-            return nullptr;
-        }
-        esp_imgfx_data_t convert_input_data = {
-            .data = const_cast<uint8_t*>(src),
-            .data_len = static_cast<uint32_t>(src_len),
-        };
-        esp_imgfx_data_t convert_output_data = {
-            .data = buf,
-            .data_len = static_cast<uint32_t>(sz),
-        };
-        err = esp_imgfx_color_convert_process(convert_handle, &convert_input_data, &convert_output_data);
-        if (err != ESP_IMGFX_ERR_OK) {
-            ESP_LOGE(TAG, "esp_imgfx_color_convert_process failed");
+        if (!pixel_convert_imgfx(src, src_len, in_pixel_fmt, buf, sz, ESP_IMGFX_PIXEL_FMT_YUYV, width, height)) {
             jpeg_free_align(buf);
             return nullptr;
         }
-        esp_imgfx_color_convert_close(convert_handle);
-        convert_handle = nullptr;
         if (out_fmt)
             *out_fmt = JPEG_PIXEL_FORMAT_YCbYCr;
         if (out_size)
@@ -261,10 +207,7 @@ static uint8_t* convert_input_to_hw_encoder_buf(const uint8_t* src, uint16_t wid
         uint16_t* buf = (uint16_t*)malloc_psram(sz);
         if (!buf)
             return NULL;
-        const uint16_t* bsrc = (const uint16_t*)src;
-        for (int i = 0; i < sz / 2; i++) {
-            buf[i] = __builtin_bswap16(bsrc[i]);
-        }
+        pixel_swap16(buf, src, sz / 2);
         if (out_fmt)
             *out_fmt = JPEG_ENCODE_IN_FORMAT_YUV422;
         if (out_size)
@@ -465,3 +408,95 @@ bool image_to_jpeg_cb(uint8_t* src, size_t src_len, uint16_t width, uint16_t hei
 #endif
     return encode_with_esp_new_jpeg(src, src_len, width, height, format, quality, NULL, NULL, cb, arg);
 }
+
+bool image_to_jpeg_stripes_cb(uint16_t width, uint16_t height, uint8_t quality,
+                              jpg_stripe_cb read_cb, void* read_arg, jpg_out_cb cb, void* arg) {
+    if (quality < 1)
+        quality = 1;
+    if (quality > 100)
+        quality = 100;
+
+    jpeg_enc_config_t cfg = DEFAULT_JPEG_ENC_CONFIG();
+    cfg.width = width;
+    cfg.height = height;
+    cfg.src_type = JPEG_PIXEL_FORMAT_YCbYCr;
+    cfg.subsampling = JPEG_SUBSAMPLE_420;
+    cfg.quality = quality;
+    cfg.rotate = JPEG_ROTATE_0D;
+    cfg.task_enable = false;
+
+    jpeg_enc_handle_t h = NULL;
+    jpeg_error_t ret = jpeg_enc_open(&cfg, &h);
+    if (ret != JPEG_ERR_OK) {
+        ESP_LOGE(TAG, "jpeg_enc_open failed: %d", (int)ret);
+        return false;
+    }
+
+    // 一个块是一行 MCU，YUYV 每像素 2 字节
+    int block_size = jpeg_enc_get_block_size(h);
+    int rows = block_size / ((int)width * 2);
+    if (rows <= 0 || block_size != rows * (int)width * 2) {
+        ESP_LOGE(TAG, "unexpected block size %d for width %d", block_size, (int)width);
+        jpeg_enc_close(h);
+        return false;
+    }
+
+    // 一个块的压缩数据不会超过原始数据，另加文件头的空间
+    size_t out_cap = (size_t)block_size + 4096;
+    uint8_t* rgb = (uint8_t*)jpeg_calloc_align(block_size, 16);
+    uint8_t* yuv = (uint8_t*)jpeg_calloc_align(block_size, 16);
+    uint8_t* outbuf = (uint8_t*)malloc_psram(out_cap);
+    bool ok = rgb && yuv && outbuf;
+    if (!ok) {
+        ESP_LOGE(TAG, "alloc stripe buffers failed");
+    }
+    // 所有条带尺寸相同，共用一个转换器
+    // LVGL 的 RGB565 按大端读取，相当于先交换字节再按小端转换
+    pixel_converter_t converter = NULL;
+    if (ok) {
+        converter = pixel_converter_open(ESP_IMGFX_PIXEL_FMT_RGB565_BE, ESP_IMGFX_PIXEL_FMT_YUYV, width, rows);
+        ok = converter != NULL;
+    }
+
+    size_t index = 0;
+    size_t stride = (size_t)width * 2;
+    for (int y = 0; ok && y < height; y += rows) {
+        int n = height - y < rows ? height - y : rows;
+        if (!read_cb(read_arg, (uint16_t)y, (uint16_t)n, rgb)) {
+            ESP_LOGE(TAG, "read stripe %d failed", y);
+            ok = false;
+            break;
+        }
+        // 最后一个条带不足一行 MCU 时重复最后一行
+        for (int i = n; i < rows; i++) {
+            memcpy(rgb + i * stride, rgb + (n - 1) * stride, stride);
+        }
+        if (!pixel_converter_process(converter, rgb, block_size, yuv, block_size)) {
+            ok = false;
+            break;
+        }
+        int out_len = 0;
+        ret = jpeg_enc_process_with_block(h, yuv, block_size, outbuf, (int)out_cap, &out_len);
+        if (ret < JPEG_ERR_OK) {
+            ESP_LOGE(TAG, "jpeg_enc_process_with_block failed: %d", (int)ret);
+            ok = false;
+            break;
+        }
+        if (out_len > 0) {
+            cb(arg, index, outbuf, (size_t)out_len);
+            index += out_len;
+        }
+    }
+    if (ok) {
+        cb(arg, index, NULL, 0);  // 结束信号
+    }
+
+    pixel_converter_close(converter);
+    jpeg_enc_close(h);
+    free(outbuf);
+    if (yuv)
+        jpeg_free_align(yuv);
+    if (rgb)
+        jpeg_free_align(rgb);
+    return ok;
+}
@@ -79,6 +79,32 @@ extern "C"
     bool image_to_jpeg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height,
                           v4l2_pix_fmt_t format, uint8_t quality, jpg_out_cb cb, void *arg);
 
+    // 条带读取回调函数类型
+    // arg: 用户自定义参数, y: 条带的第一行, rows: 条带行数, rgb565: 输出缓冲区 (width * rows 个 LVGL 字节序的 RGB565 像素)
+    // 返回: 成功返回 true
+    typedef bool (*jpg_stripe_cb)(void *arg, uint16_t y, uint16_t rows, uint8_t *rgb565);
+
+    /**
+     * @brief 分条带将 RGB565 图像编码为JPEG（回调版本）
+     *
+     * 按 MCU 行（4:2:0 为 16 行）从回调读取像素并逐块编码，不需要整帧缓冲区：
+     * - 峰值内存只与一个条带的大小相关
+     * - 字节交换在颜色转换中完成，输入为 LVGL 渲染的 RGB565
+     * - 只使用软件编码器
+     *
+     * @param width     图像宽度
+     * @param height    图像高度
+     * @param quality   JPEG质量 (1-100)
+     * @param read_cb   条带读取回调函数
+     * @param read_arg  传递给读取回调函数的用户参数
+     * @param cb        输出回调函数
+     * @param arg       传递给输出回调函数的用户参数
+     *
+     * @return true 成功, false 失败
+     */
+    bool image_to_jpeg_stripes_cb(uint16_t width, uint16_t height, uint8_t quality,
+                                  jpg_stripe_cb read_cb, void *read_arg, jpg_out_cb cb, void *arg);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,12 +1,15 @@
 #include <esp_check.h>
 #include <esp_err.h>
 #include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <string.h>
 #include <sys/param.h>
 
 #include "esp_jpeg_common.h"
 #include "esp_jpeg_dec.h"
 
 #include "jpeg_to_image.h"
+#include "pixel_convert.h"
 
 #ifdef CONFIG_XIAOZHI_ENABLE_CAMERA_DEBUG_MODE
 #undef LOG_LOCAL_LEVEL
@@ -20,9 +23,10 @@
 
 #define TAG "jpeg_to_image"
 
-static esp_err_t decode_with_new_jpeg(const uint8_t* src, size_t src_len, uint8_t** out, size_t* out_len, size_t* width,
-                                      size_t* height, size_t* stride) {
-    ESP_LOGD(TAG, "Decoding JPEG with software decoder");
+// scale_width and scale_height are 0 to decode at full size
+static esp_err_t decode_with_new_jpeg(const uint8_t* src, size_t src_len, int scale_width, int scale_height,
+                                      uint8_t** out, size_t* out_len, size_t* width, size_t* height, size_t* stride) {
+    ESP_LOGD(TAG, "Decoding JPEG with software decoder, scale=%dx%d", scale_width, scale_height);
     esp_err_t ret = ESP_OK;
     jpeg_error_t jpeg_ret = JPEG_ERR_OK;
     uint8_t* out_buf = NULL;
@@ -32,6 +36,9 @@ static esp_err_t decode_with_new_jpeg(const uint8_t* src, size_t src_len, uint8_
     jpeg_dec_config_t config = DEFAULT_JPEG_DEC_CONFIG();
     config.output_type = JPEG_PIXEL_FORMAT_RGB565_LE;
     config.rotate = JPEG_ROTATE_0D;
+    // The IDCT only computes the low frequencies of each block for 1/2, 1/4 and 1/8 of the size
+    config.scale.width = scale_width;
+    config.scale.height = scale_height;
 
     jpeg_dec_handle_t jpeg_dec = NULL;
     jpeg_ret = jpeg_dec_open(&config, &jpeg_dec);
@@ -52,6 +59,10 @@ static esp_err_t decode_with_new_jpeg(const uint8_t* src, size_t src_len, uint8_
     }
 
     ESP_LOGD(TAG, "JPEG header info: width=%d, height=%d", out_info.width, out_info.height);
+    if (scale_width > 0 && scale_height > 0) {
+        out_info.width = scale_width;
+        out_info.height = scale_height;
+    }
 
     out_buf = jpeg_calloc_align(out_info.width * out_info.height * 2, 16);
     if (out_buf == NULL) {
@@ -260,5 +271,127 @@ esp_err_t jpeg_to_image(const uint8_t* src, size_t src_len, uint8_t** out, size_
     ESP_LOGW(TAG, "Failed to decode with hardware JPEG, fallback to software decoder");
     // Fallback to esp_new_jpeg
 #endif
-    return decode_with_new_jpeg(src, src_len, out, out_len, width, height, stride);
+    return decode_with_new_jpeg(src, src_len, 0, 0, out, out_len, width, height, stride);
+}
+
+static esp_err_t get_jpeg_size(const uint8_t* src, size_t src_len, size_t* width, size_t* height) {
+    jpeg_dec_config_t config = DEFAULT_JPEG_DEC_CONFIG();
+    jpeg_dec_handle_t jpeg_dec = NULL;
+    if (jpeg_dec_open(&config, &jpeg_dec) != JPEG_ERR_OK) {
+        ESP_LOGE(TAG, "Failed to open JPEG decoder");
+        return ESP_FAIL;
+    }
+    jpeg_dec_io_t jpeg_io = {
+        .inbuf = (uint8_t*)src,
+        .inbuf_len = (int)src_len,
+    };
+    jpeg_dec_header_info_t info = {0};
+    jpeg_error_t jpeg_ret = jpeg_dec_parse_header(jpeg_dec, &jpeg_io, &info);
+    jpeg_dec_close(jpeg_dec);
+    if (jpeg_ret != JPEG_ERR_OK || info.width == 0 || info.height == 0) {
+        ESP_LOGE(TAG, "Failed to parse JPEG header");
+        return ESP_ERR_INVALID_ARG;
+    }
+    *width = info.width;
+    *height = info.height;
+    return ESP_OK;
+}
+
+// Whether the image shrunk by factor still covers the target: both sides when cropping, one side when fitting inside
+static bool covers_target(size_t width, size_t height, size_t factor, size_t max_width, size_t max_height, bool crop) {
+    if (crop) {
+        return width / factor >= max_width && height / factor >= max_height;
+    }
+    return width / factor >= max_width || height / factor >= max_height;
+}
+
+// Crop the decoded image to the aspect ratio of the target around its center, then shrink it by the
+// integer factor that keeps it at least the target size. Both are done in place in the output buffer.
+static void fit_to_target(uint8_t* buf, size_t* out_len, size_t* width, size_t* height, size_t* stride,
+                          size_t max_width, size_t max_height, bool crop) {
+    size_t w = *width;
+    size_t h = *height;
+    size_t x0 = 0;
+    size_t y0 = 0;
+    if (crop) {
+        if (w * max_height > h * max_width) {
+            size_t crop_width = h * max_width / max_height;
+            x0 = (w - crop_width) / 2;
+            w = crop_width;
+        } else {
+            size_t crop_height = w * max_height / max_width;
+            y0 = (h - crop_height) / 2;
+            h = crop_height;
+        }
+    }
+    size_t factor = 1;
+    while (covers_target(w, h, factor + 1, max_width, max_height, crop)) {
+        factor++;
+    }
+    if (factor == 1 && w == *width && h == *height) {
+        return;
+    }
+
+    const uint16_t* src = (const uint16_t*)(buf + y0 * *stride + x0 * 2);
+    pixel_rgb565_downscale((uint16_t*)buf, src, (int)w, (int)h, (int)*stride, (int)factor);
+    *width = w / factor;
+    *height = h / factor;
+    *stride = *width * 2;
+    *out_len = *width * *height * 2;
+}
+
+esp_err_t jpeg_to_image_scaled(const uint8_t* src, size_t src_len, size_t max_width, size_t max_height, bool crop,
+                               uint8_t** out, size_t* out_len, size_t* width, size_t* height, size_t* stride) {
+    if (src == NULL || src_len == 0 || max_width == 0 || max_height == 0 || out == NULL || out_len == NULL ||
+        width == NULL || height == NULL || stride == NULL) {
+        ESP_LOGE(TAG, "Invalid parameters");
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out = NULL;
+
+    int64_t start_time = esp_timer_get_time();
+    size_t src_width = 0;
+    size_t src_height = 0;
+    esp_err_t ret = get_jpeg_size(src, src_len, &src_width, &src_height);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    size_t factor = 1;
+    while (factor < 8 && src_width % (factor * 2) == 0 && src_height % (factor * 2) == 0 &&
+           covers_target(src_width, src_height, factor * 2, max_width, max_height, crop)) {
+        factor *= 2;
+    }
+
+    ret = ESP_FAIL;
+#ifdef CONFIG_XIAOZHI_ENABLE_HARDWARE_JPEG_DECODER
+    // The hardware decoder cannot scale, it only saves time when the image is decoded at full size
+    if (factor == 1) {
+        ret = decode_with_hardware_jpeg(src, src_len, out, out_len, width, height, stride);
+    }
+#endif
+    while (ret != ESP_OK) {
+        if (factor == 1) {
+            ret = decode_with_new_jpeg(src, src_len, 0, 0, out, out_len, width, height, stride);
+            break;
+        }
+        ret = decode_with_new_jpeg(src, src_len, src_width / factor, src_height / factor, out, out_len, width, height,
+                                   stride);
+        if (ret == ESP_OK || ret == ESP_ERR_NO_MEM) {
+            break;
+        }
+        // The decoder rejects some scaled sizes, e.g. not multiples of 8, the integer downscale makes up for it
+        ESP_LOGW(TAG, "Failed to decode at 1/%u scale, trying 1/%u", factor, factor / 2);
+        factor /= 2;
+    }
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    size_t decoded_len = *out_len;
+    fit_to_target(*out, out_len, width, height, stride, max_width, max_height, crop);
+    ESP_LOGI(TAG, "Decoded %ux%u JPEG to %ux%u (IDCT 1/%u) in %lld us, buffer %u bytes instead of %u", src_width,
+             src_height, *width, *height, factor, esp_timer_get_time() - start_time, decoded_len,
+             src_width * src_height * 2);
+    return ESP_OK;
 }
@@ -2,6 +2,7 @@
 #ifndef CONFIG_IDF_TARGET_ESP32
 
 #include <esp_err.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -55,6 +56,36 @@ extern "C" {
 esp_err_t jpeg_to_image(const uint8_t* src, size_t src_len, uint8_t** out, size_t* out_len, size_t* width,
                         size_t* height, size_t* stride);
 
+/**
+ * @brief Decodes a JPEG image to RGB565 at about the size it is shown at
+ *
+ * The software decoder scales by 1/2, 1/4 or 1/8 in the IDCT, so a large image is never decoded at full size.
+ * The largest reduction is used that keeps the image at least max_width x max_height (cropping) or that keeps
+ * it covering the box in one dimension (fitting inside), then an integer box filter brings it within 2x of
+ * the target. The display scales the rest.
+ *
+ * @param[in] src Pointer to the JPEG bitstream in memory
+ * @param[in] src_len Length of the JPEG bitstream in bytes
+ * @param[in] max_width Width of the area the image is shown in
+ * @param[in] max_height Height of the area the image is shown in
+ * @param[in] crop true to crop the image around its center to the aspect ratio of the area,
+ *            false to keep the whole image
+ * @param[out] out Same as jpeg_to_image(), the buffer MUST be freed with heap_caps_free()
+ * @param[out] out_len Size of the image data in bytes, the buffer may be larger
+ * @param[out] width Image width in pixels
+ * @param[out] height Image height in pixels
+ * @param[out] stride Image stride in bytes
+ *
+ * @return ESP_OK on successful decoding
+ * @return ESP_ERR_INVALID_ARG on invalid parameters or an invalid JPEG header
+ * @return ESP_ERR_NO_MEM on memory allocation failure
+ * @return ESP_FAIL on failure
+ *
+ * @note The hardware decoder cannot scale, it is only used when the image is not reduced in the IDCT.
+ */
+esp_err_t jpeg_to_image_scaled(const uint8_t* src, size_t src_len, size_t max_width, size_t max_height, bool crop,
+                               uint8_t** out, size_t* out_len, size_t* width, size_t* height, size_t* stride);
+
 #ifdef __cplusplus
 }
 #endif
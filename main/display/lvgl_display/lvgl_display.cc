@@ -3,15 +3,23 @@
 #include <string>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include <font_awesome.h>
+#include <src/display/lv_display_private.h>
+#include <src/core/lv_refr_private.h>
 
 #include "lvgl_display.h"
+#include "lvgl_theme.h"
 #include "board.h"
+#include "i2c_device.h"
 #include "application.h"
 #include "audio_codec.h"
 #include "settings.h"
 #include "assets/lang_config.h"
 #include "jpg/image_to_jpeg.h"
+#include "pixel_convert.h"
+#include "event_trace.h"
+#include "heap_monitor.h"
 
 #define TAG "Display"
 
@@ -84,6 +92,8 @@ void LvglDisplay::SetStatus(const char* status) {
     lv_obj_remove_flag(status_label_, LV_OBJ_FLAG_HIDDEN);
     lv_obj_add_flag(notification_label_, LV_OBJ_FLAG_HIDDEN);
 
+    std::lock_guard<std::mutex> status_lock(status_mutex_);
+    clock_text_[0] = '\0';
     last_status_update_time_ = std::chrono::system_clock::now();
 }
 
@@ -115,89 +125,78 @@ void LvglDisplay::UpdateStatusBar(bool update_all) {
     auto& board = Board::GetInstance();
     auto codec = board.GetAudioCodec();
 
-    // Update mute icon
+    // Take a snapshot of what is shown, the display lock is only taken if something changed
+    const char* battery_icon;
+    bool low_battery;
+    const char* network_icon;
+    bool show_clock;
+    bool poll_battery = update_all;
+    bool poll_network = update_all;
     {
-        DisplayLockGuard lock(this);
-        if (mute_label_ == nullptr) {
-            return;
-        }
-
-        // Update icon if mute state changes
-        if (codec->output_volume() == 0 && !muted_) {
-            muted_ = true;
-            lv_label_set_text(mute_label_, FONT_AWESOME_VOLUME_XMARK);
-        } else if (codec->output_volume() > 0 && muted_) {
-            muted_ = false;
-            lv_label_set_text(mute_label_, "");
+        std::lock_guard<std::mutex> status_lock(status_mutex_);
+        battery_icon = battery_icon_;
+        low_battery = low_battery_shown_;
+        network_icon = network_icon_;
+        // A status message stays for 10 seconds before the clock replaces it
+        show_clock = last_status_update_time_ + std::chrono::seconds(10) < std::chrono::system_clock::now();
+        // Poll the sources on their own cadences, update_all is called on the network events
+        if (!update_all) {
+            poll_battery = status_ticks_ % STATUS_BAR_BATTERY_INTERVAL == 0;
+            poll_network = status_ticks_ % STATUS_BAR_NETWORK_INTERVAL == 0;
+            status_ticks_++;
         }
     }
 
+    bool muted = codec->output_volume() == 0;
+
     // Update time
+    char time_str[16] = "";
     if (app.GetDeviceState() == kDeviceStateIdle) {
-        if (last_status_update_time_ + std::chrono::seconds(10) < std::chrono::system_clock::now()) {
+        if (show_clock) {
             // Set status to clock "HH:MM"
             time_t now = time(NULL);
             struct tm* tm = localtime(&now);
             // Check if the we have already set the time
             if (tm->tm_year >= 2025 - 1900) {
-                char time_str[16];
                 strftime(time_str, sizeof(time_str), "%H:%M", tm);
-                SetStatus(time_str);
             } else {
                 ESP_LOGW(TAG, "System time is not set, tm_year: %d", tm->tm_year);
             }
         }
     }
 
-    esp_pm_lock_acquire(pm_lock_);
-    // Update battery icon
-    int battery_level;
-    bool charging, discharging;
-    const char* icon = nullptr;
-    if (board.GetBatteryLevel(battery_level, charging, discharging)) {
-        if (charging) {
-            icon = FONT_AWESOME_BATTERY_BOLT;
-        } else {
-            const char* levels[] = {
-                FONT_AWESOME_BATTERY_EMPTY, // 0-19%
-                FONT_AWESOME_BATTERY_QUARTER,    // 20-39%
-                FONT_AWESOME_BATTERY_HALF,    // 40-59%
-                FONT_AWESOME_BATTERY_THREE_QUARTERS,    // 60-79%
-                FONT_AWESOME_BATTERY_FULL, // 80-99%
-                FONT_AWESOME_BATTERY_FULL, // 100%
-            };
-            icon = levels[battery_level / 20];
-        }
-        DisplayLockGuard lock(this);
-        if (battery_label_ != nullptr && battery_icon_ != icon) {
-            battery_icon_ = icon;
-            lv_label_set_text(battery_label_, battery_icon_);
-        }
-
-        // Check low battery popup only when clock tick event is triggered
-        // Because when initializing, the battery level is not ready yet.
-        if (low_battery_popup_ != nullptr && !update_all) {
-            if (strcmp(icon, FONT_AWESOME_BATTERY_EMPTY) == 0 && discharging) {
-                if (lv_obj_has_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN)) { // Show if low battery popup is hidden
-                    lv_obj_remove_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
-                    app.Schedule([&app]() {
-                        app.PlaySound(Lang::Sounds::OGG_LOW_BATTERY);
-                    });
-                }
+    if (poll_battery || poll_network) {
+        esp_pm_lock_acquire(pm_lock_);
+    }
+    if (poll_battery) {
+        // Update battery icon
+        int battery_level;
+        bool charging, discharging;
+        if (board.GetBatteryLevel(battery_level, charging, discharging)) {
+            if (charging) {
+                battery_icon = FONT_AWESOME_BATTERY_BOLT;
             } else {
-                // Hide the low battery popup when the battery is not empty
-                if (!lv_obj_has_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN)) { // Hide if low battery popup is shown
-                    lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
-                }
+                const char* levels[] = {
+                    FONT_AWESOME_BATTERY_EMPTY, // 0-19%
+                    FONT_AWESOME_BATTERY_QUARTER,    // 20-39%
+                    FONT_AWESOME_BATTERY_HALF,    // 40-59%
+                    FONT_AWESOME_BATTERY_THREE_QUARTERS,    // 60-79%
+                    FONT_AWESOME_BATTERY_FULL, // 80-99%
+                    FONT_AWESOME_BATTERY_FULL, // 100%
+                };
+                battery_icon = levels[battery_level / 20];
+            }
+
+            // Check low battery popup only when clock tick event is triggered
+            // Because when initializing, the battery level is not ready yet.
+            if (!update_all) {
+                low_battery = strcmp(battery_icon, FONT_AWESOME_BATTERY_EMPTY) == 0 && discharging;
             }
         }
     }
-
-    // Update network icon every 10 seconds
-    static int seconds_counter = 0;
-    if (update_all || seconds_counter++ % 10 == 0) {
+    if (poll_network) {
         // Don't read 4G network status during firmware upgrade to avoid occupying UART resources
-        auto device_state = Application::GetInstance().GetDeviceState();
+        auto device_state = app.GetDeviceState();
         static const std::vector<DeviceState> allowed_states = {
             kDeviceStateIdle,
             kDeviceStateStarting,
@@ -206,16 +205,85 @@ void LvglDisplay::UpdateStatusBar(bool update_all) {
             kDeviceStateActivating,
         };
         if (std::find(allowed_states.begin(), allowed_states.end(), device_state) != allowed_states.end()) {
-            icon = board.GetNetworkStateIcon();
-            if (network_label_ != nullptr && icon != nullptr && network_icon_ != icon) {
-                DisplayLockGuard lock(this);
-                network_icon_ = icon;
-                lv_label_set_text(network_label_, network_icon_);
+            auto icon = board.GetNetworkStateIcon();
+            if (icon != nullptr) {
+                network_icon = icon;
             }
         }
     }
+    if (poll_battery || poll_network) {
+        esp_pm_lock_release(pm_lock_);
+    }
 
-    esp_pm_lock_release(pm_lock_);
+    // Most ticks change nothing, they don't take the display lock. The clock changes once a minute
+    {
+        std::lock_guard<std::mutex> status_lock(status_mutex_);
+        if (muted == muted_ && (time_str[0] == '\0' || strcmp(time_str, clock_text_) == 0) &&
+            battery_icon == battery_icon_ && low_battery == low_battery_shown_ && network_icon == network_icon_) {
+            return;
+        }
+    }
+
+    DisplayLockGuard lock(this);
+    if (mute_label_ == nullptr) {
+        return;
+    }
+    int64_t lock_start_us = esp_timer_get_time();
+
+    if (time_str[0] != '\0' && status_label_ != nullptr) {
+        // Before taking the status mutex, SetStatus() takes it too
+        bool clock_changed;
+        {
+            std::lock_guard<std::mutex> status_lock(status_mutex_);
+            clock_changed = strcmp(time_str, clock_text_) != 0;
+        }
+        if (clock_changed) {
+            SetStatus(time_str);
+            std::lock_guard<std::mutex> status_lock(status_mutex_);
+            strcpy(clock_text_, time_str);
+        }
+    }
+
+    std::lock_guard<std::mutex> status_lock(status_mutex_);
+    if (muted != muted_) {
+        muted_ = muted;
+        lv_label_set_text(mute_label_, muted_ ? FONT_AWESOME_VOLUME_XMARK : "");
+    }
+
+    // The cache is updated even without the label, otherwise every tick would take the display lock
+    if (battery_icon != battery_icon_) {
+        battery_icon_ = battery_icon;
+        if (battery_label_ != nullptr) {
+            lv_label_set_text(battery_label_, battery_icon_);
+        }
+    }
+
+    if (low_battery != low_battery_shown_) {
+        low_battery_shown_ = low_battery;
+        if (low_battery_popup_ != nullptr) {
+            if (low_battery_shown_) {
+                lv_obj_remove_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
+                app.Schedule([&app]() {
+                    app.PlaySound(Lang::Sounds::OGG_LOW_BATTERY);
+                });
+            } else {
+                // Hide the low battery popup when the battery is not empty
+                lv_obj_add_flag(low_battery_popup_, LV_OBJ_FLAG_HIDDEN);
+            }
+        }
+    }
+
+    if (network_icon != network_icon_) {
+        network_icon_ = network_icon;
+        if (network_label_ != nullptr) {
+            lv_label_set_text(network_label_, network_icon_);
+        }
+    }
+
+    int64_t lock_time_us = esp_timer_get_time() - lock_start_us;
+    performance_.status_bar_updates++;
+    performance_.status_bar_lock_time_us += lock_time_us;
+    performance_.max_status_bar_lock_time_us = std::max(performance_.max_status_bar_lock_time_us, lock_time_us);
 }
 
 void LvglDisplay::SetPreviewImage(std::unique_ptr<LvglImage> image) {
@@ -231,8 +299,195 @@ void LvglDisplay::SetPowerSaveMode(bool on) {
     }
 }
 
+void LvglDisplay::AddDisplayEvents() {
+    performance_ = {};
+    performance_.start_time_us = esp_timer_get_time();
+    performance_.i2c_transactions_start = I2cDevice::GetTransactionCount();
+    // Refresh covers the rendering and the flushes, flush wait is the time spent waiting for the panel
+    lv_display_add_event_cb(display_, [](lv_event_t* e) {
+        auto self = static_cast<LvglDisplay*>(lv_event_get_user_data(e));
+        auto& performance = self->performance_;
+        int64_t now = esp_timer_get_time();
+        switch (lv_event_get_code(e)) {
+            case LV_EVENT_REFR_START:
+                TRACE_BEGIN("display.refresh");
+                break;
+            case LV_EVENT_REFR_READY:
+                TRACE_END("display.refresh");
+                if (self->emotion_start_us_ != 0) {
+                    int64_t emotion_time = now - self->emotion_start_us_;
+                    self->emotion_start_us_ = 0;
+                    performance.emotion_switches++;
+                    performance.emotion_time_us += emotion_time;
+                    performance.max_emotion_time_us = std::max(performance.max_emotion_time_us, emotion_time);
+                }
+                break;
+            case LV_EVENT_RENDER_START:
+                self->render_start_us_ = now;
+                self->render_start_wait_us_ = performance.flush_wait_time_us;
+                break;
+            case LV_EVENT_RENDER_READY: {
+                // The time spent waiting for the flushes of the previous areas is not rendering
+                int64_t render_time = now - self->render_start_us_ - (performance.flush_wait_time_us - self->render_start_wait_us_);
+                performance.frames++;
+                performance.render_time_us += render_time;
+                performance.max_render_time_us = std::max(performance.max_render_time_us, render_time);
+                break;
+            }
+            case LV_EVENT_FLUSH_START:
+                TRACE_BEGIN("display.flush");
+                self->flush_start_us_ = now;
+                break;
+            case LV_EVENT_FLUSH_FINISH:
+                TRACE_END("display.flush");
+                performance.flushes++;
+                performance.flush_time_us += now - self->flush_start_us_;
+                break;
+            case LV_EVENT_FLUSH_WAIT_START:
+                TRACE_BEGIN("display.flush_wait");
+                self->flush_wait_start_us_ = now;
+                break;
+            case LV_EVENT_FLUSH_WAIT_FINISH:
+                TRACE_END("display.flush_wait");
+                performance.flush_wait_time_us += now - self->flush_wait_start_us_;
+                break;
+            default:
+                break;
+        }
+    }, LV_EVENT_ALL, this);
+}
+
+cJSON* LvglDisplay::GetPerformanceJson(bool reset) {
+    DisplayLockGuard lock(this);
+    if (display_ == nullptr) {
+        return nullptr;
+    }
+    auto& performance = performance_;
+    int64_t window_us = std::max<int64_t>(esp_timer_get_time() - performance.start_time_us, 1);
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "window_ms", window_us / 1000);
+    cJSON_AddNumberToObject(json, "frames", performance.frames);
+    cJSON_AddNumberToObject(json, "fps", (int)(performance.frames * 10000000LL / window_us) / 10.0);
+    if (performance.frames > 0) {
+        cJSON_AddNumberToObject(json, "avg_render_us", performance.render_time_us / performance.frames);
+        cJSON_AddNumberToObject(json, "max_render_us", performance.max_render_time_us);
+    }
+    cJSON_AddNumberToObject(json, "flushes", performance.flushes);
+    if (performance.flushes > 0) {
+        // Time spent in the flush callback, the transfer itself runs in the background
+        cJSON_AddNumberToObject(json, "avg_flush_us", performance.flush_time_us / performance.flushes);
+    }
+    // Time LVGL was blocked waiting for the panel transfers, high values call for double buffering
+    cJSON_AddNumberToObject(json, "flush_wait_ms", performance.flush_wait_time_us / 1000);
+    cJSON_AddNumberToObject(json, "flush_wait_percent", (int)(performance.flush_wait_time_us * 100 / window_us));
+
+    auto buffer = lv_display_get_buf_active(display_);
+    if (buffer != nullptr) {
+        cJSON_AddNumberToObject(json, "buffer_bytes", buffer->data_size);
+        cJSON_AddNumberToObject(json, "buffer_lines", buffer->header.h);
+    }
+    cJSON_AddBoolToObject(json, "double_buffer", lv_display_is_double_buffered(display_));
+
+    // From SetEmotion() until the refresh showing the new emoji is flushed
+    cJSON_AddNumberToObject(json, "emotion_switches", performance.emotion_switches);
+    if (performance.emotion_switches > 0) {
+        cJSON_AddNumberToObject(json, "avg_emotion_us", performance.emotion_time_us / performance.emotion_switches);
+        cJSON_AddNumberToObject(json, "max_emotion_us", performance.max_emotion_time_us);
+    }
+    auto lvgl_theme = static_cast<LvglTheme*>(current_theme_);
+    if (lvgl_theme != nullptr && lvgl_theme->emoji_collection() != nullptr) {
+        cJSON_AddItemToObject(json, "emoji_cache", lvgl_theme->emoji_collection()->GetCacheJson());
+    }
+
+    // Chat messages and the words appended to the subtitles, with the time they held the lock
+    cJSON_AddNumberToObject(json, "chat_message_updates", performance.chat_message_updates);
+    if (performance.chat_message_updates > 0) {
+        cJSON_AddNumberToObject(json, "avg_chat_message_lock_us", performance.chat_message_time_us / performance.chat_message_updates);
+        cJSON_AddNumberToObject(json, "max_chat_message_lock_us", performance.max_chat_message_time_us);
+    }
+    // Status bar updates that changed a label, with the time they held the lock
+    cJSON_AddNumberToObject(json, "status_bar_updates", performance.status_bar_updates);
+    if (performance.status_bar_updates > 0) {
+        cJSON_AddNumberToObject(json, "avg_status_bar_lock_us", performance.status_bar_lock_time_us / performance.status_bar_updates);
+        cJSON_AddNumberToObject(json, "max_status_bar_lock_us", performance.max_status_bar_lock_time_us);
+    }
+    // Register accesses of the I2C drivers (PMIC, charger, etc.) by all the tasks
+    uint32_t i2c_transactions = I2cDevice::GetTransactionCount() - performance.i2c_transactions_start;
+    cJSON_AddNumberToObject(json, "i2c_per_minute", (int)(i2c_transactions * 600000000LL / window_us) / 10.0);
+
+    if (reset) {
+        performance = {};
+        performance.start_time_us = esp_timer_get_time();
+        performance.i2c_transactions_start = I2cDevice::GetTransactionCount();
+    }
+    return json;
+}
+
+#if CONFIG_LV_USE_SNAPSHOT && !CONFIG_XIAOZHI_ENABLE_HARDWARE_JPEG_ENCODER
+// Render rows of the screen into data, the same way as lv_snapshot_take_to_draw_buf() without a buffer for the whole screen
+static bool RenderScreenRows(lv_obj_t* screen, int y, int rows, uint8_t* data) {
+    lv_area_t coords;
+    lv_obj_get_coords(screen, &coords);
+    int width = lv_area_get_width(&coords);
+    lv_draw_buf_t draw_buffer;
+    if (lv_draw_buf_init(&draw_buffer, width, rows, LV_COLOR_FORMAT_RGB565, width * 2, data, width * rows * 2) != LV_RESULT_OK) {
+        return false;
+    }
+    lv_draw_buf_clear(&draw_buffer, nullptr);
+
+    lv_area_t area = { coords.x1, (int32_t)(coords.y1 + y), coords.x2, (int32_t)(coords.y1 + y + rows - 1) };
+    lv_layer_t layer;
+    lv_layer_init(&layer);
+    layer.draw_buf = &draw_buffer;
+    layer.buf_area = area;
+    layer.color_format = LV_COLOR_FORMAT_RGB565;
+    layer._clip_area = area;
+    layer.phy_clip_area = area;
+
+    // The draw units take the tasks of the layers of the display being refreshed
+    lv_display_t* display = lv_obj_get_display(screen);
+    lv_display_t* display_old = lv_refr_get_disp_refreshing();
+    lv_layer_t* layer_old = display->layer_head;
+    display->layer_head = &layer;
+    lv_refr_set_disp_refreshing(display);
+    lv_obj_redraw(&layer, screen);
+    while (layer.draw_task_head) {
+        lv_draw_dispatch_wait_for_request();
+        lv_draw_dispatch();
+    }
+    display->layer_head = layer_old;
+    lv_refr_set_disp_refreshing(display_old);
+    return true;
+}
+#endif
+
 bool LvglDisplay::SnapshotToJpeg(std::string& jpeg_data, int quality) {
-#if CONFIG_LV_USE_SNAPSHOT
+#if CONFIG_LV_USE_SNAPSHOT && !CONFIG_XIAOZHI_ENABLE_HARDWARE_JPEG_ENCODER
+    DisplayLockGuard lock(this);
+
+    lv_obj_t* screen = lv_screen_active();
+    lv_obj_update_layout(screen);
+    jpeg_data.clear();
+
+    // The screen is rendered one MCU row at a time straight into the encoder input,
+    // the memory used does not depend on the height of the screen
+    bool ret = image_to_jpeg_stripes_cb(lv_obj_get_width(screen), lv_obj_get_height(screen), quality,
+        [](void* arg, uint16_t y, uint16_t rows, uint8_t* rgb565) -> bool {
+        return RenderScreenRows(static_cast<lv_obj_t*>(arg), y, rows, rgb565);
+    }, screen,
+        [](void *arg, size_t index, const void *data, size_t len) -> size_t {
+        std::string* output = static_cast<std::string*>(arg);
+        if (data && len > 0) {
+            output->append(static_cast<const char*>(data), len);
+        }
+        return len;
+    }, &jpeg_data);
+    if (!ret) {
+        ESP_LOGE(TAG, "Failed to convert image to JPEG");
+    }
+    return ret;
+#elif CONFIG_LV_USE_SNAPSHOT
+    // The hardware encoder takes the whole frame
     DisplayLockGuard lock(this);
 
     lv_obj_t* screen = lv_screen_active();
@@ -241,13 +496,9 @@ bool LvglDisplay::SnapshotToJpeg(std::string& jpeg_data, int quality) {
         ESP_LOGE(TAG, "Failed to take snapshot, draw_buffer is nullptr");
         return false;
     }
+    HeapTrackGuard heap_track(kHeapTagDisplay, draw_buffer->data_size);
 
-    // swap bytes
-    uint16_t* data = (uint16_t*)draw_buffer->data;
-    size_t pixel_count = draw_buffer->data_size / 2;
-    for (size_t i = 0; i < pixel_count; i++) {
-        data[i] = __builtin_bswap16(data[i]);
-    }
+    pixel_swap16(draw_buffer->data, draw_buffer->data, draw_buffer->data_size / 2);
 
     // Clear output string and use callback version to avoid pre-allocating large memory blocks
     jpeg_data.clear();
@@ -5,12 +5,19 @@
 #include "lvgl_image.h"
 
 #include <lvgl.h>
+#include <cJSON.h>
 #include <esp_timer.h>
 #include <esp_log.h>
 #include <esp_pm.h>
 
 #include <string>
 #include <chrono>
+#include <mutex>
+
+// Clock ticks (seconds) between the status bar polls of the battery, which is an I2C read on the PMIC boards
+#define STATUS_BAR_BATTERY_INTERVAL 30
+// The network is polled on its events, and this often to follow the signal strength
+#define STATUS_BAR_NETWORK_INTERVAL 60
 
 class LvglDisplay : public Display {
 public:
@@ -24,6 +31,8 @@ public:
     virtual void UpdateStatusBar(bool update_all = false);
     virtual void SetPowerSaveMode(bool on);
     virtual bool SnapshotToJpeg(std::string& jpeg_data, int quality = 80);
+    // Frame rate, render and flush times since the previous reset
+    cJSON* GetPerformanceJson(bool reset);
 
 protected:
     esp_pm_lock_handle_t pm_lock_ = nullptr;
@@ -37,13 +46,50 @@ protected:
     lv_obj_t* low_battery_popup_ = nullptr;
     lv_obj_t* low_battery_label_ = nullptr;
     
+    // What the status bar shows, UpdateStatusBar() only touches the labels whose value changed.
+    // Guarded by status_mutex_, which is taken after the display lock when both are held
+    std::mutex status_mutex_;
     const char* battery_icon_ = nullptr;
     const char* network_icon_ = nullptr;
     bool muted_ = false;
-
+    bool low_battery_shown_ = false;
+    char clock_text_[16] = "";      // Empty unless the status label shows the clock
+    uint32_t status_ticks_ = 0;
     std::chrono::system_clock::time_point last_status_update_time_;
+
     esp_timer_handle_t notification_timer_ = nullptr;
 
+    // Updated in the LVGL task, read with the display lock held
+    struct DisplayPerformance {
+        int64_t start_time_us;
+        uint32_t frames;
+        int64_t render_time_us;
+        int64_t max_render_time_us;
+        uint32_t flushes;
+        int64_t flush_time_us;
+        int64_t flush_wait_time_us;
+        uint32_t emotion_switches;
+        int64_t emotion_time_us;
+        int64_t max_emotion_time_us;
+        uint32_t chat_message_updates;
+        int64_t chat_message_time_us;
+        int64_t max_chat_message_time_us;
+        uint32_t status_bar_updates;
+        int64_t status_bar_lock_time_us;
+        int64_t max_status_bar_lock_time_us;
+        uint32_t i2c_transactions_start;
+    };
+    DisplayPerformance performance_ = {};
+    int64_t render_start_us_ = 0;
+    int64_t render_start_wait_us_ = 0;
+    int64_t flush_start_us_ = 0;
+    int64_t flush_wait_start_us_ = 0;
+    // Start of the last emotion switch, until the refresh that shows it
+    int64_t emotion_start_us_ = 0;
+
+    // Measure (and trace) the LVGL refreshes and flushes of display_, called from SetupUI() with the lock held
+    void AddDisplayEvents();
+
     friend class DisplayLockGuard;
     virtual bool Lock(int timeout_ms = 0) = 0;
     virtual void Unlock() = 0;
@@ -0,0 +1,214 @@
+#include "pixel_convert.h"
+
+#include <string.h>
+
+#if defined(ESP_PLATFORM) && !CONFIG_IDF_TARGET_ESP32
+#include <esp_log.h>
+
+#define TAG "pixel_convert"
+#endif
+
+// 32-bit accesses to buffers of bytes or 16-bit values
+typedef uint32_t __attribute__((may_alias)) pixel_word_t;
+
+// Swap the bytes of both 16-bit halves
+#define SWAP16X2(x) ((((x) & 0x00FF00FFu) << 8) | (((x) >> 8) & 0x00FF00FFu))
+
+void pixel_swap16(void *dst, const void *src, size_t count)
+{
+    const uint16_t *s = (const uint16_t *)src;
+    uint16_t *d = (uint16_t *)dst;
+
+    if (count > 0 && ((uintptr_t)s & 3) != 0) {
+        *d++ = __builtin_bswap16(*s++);
+        count--;
+    }
+    // Both are aligned when the buffers are, or when converting in place
+    if (((uintptr_t)d & 3) == 0) {
+        const pixel_word_t *s32 = (const pixel_word_t *)s;
+        pixel_word_t *d32 = (pixel_word_t *)d;
+        size_t words = count / 2;
+        size_t i = 0;
+        for (; i + 4 <= words; i += 4) {
+            uint32_t w0 = s32[i];
+            uint32_t w1 = s32[i + 1];
+            uint32_t w2 = s32[i + 2];
+            uint32_t w3 = s32[i + 3];
+            d32[i] = SWAP16X2(w0);
+            d32[i + 1] = SWAP16X2(w1);
+            d32[i + 2] = SWAP16X2(w2);
+            d32[i + 3] = SWAP16X2(w3);
+        }
+        for (; i < words; i++) {
+            uint32_t w = s32[i];
+            d32[i] = SWAP16X2(w);
+        }
+        s += words * 2;
+        d += words * 2;
+        count -= words * 2;
+    }
+    while (count-- > 0) {
+        *d++ = __builtin_bswap16(*s++);
+    }
+}
+
+void pixel_yuv422p_to_yuyv(uint8_t *dst, const uint8_t *src, int width, int height)
+{
+    const uint8_t *y_plane = src;
+    const uint8_t *u_plane = y_plane + width * height;
+    const uint8_t *v_plane = u_plane + (width / 2) * height;
+    bool aligned = ((uintptr_t)dst & 3) == 0;
+    for (int y = 0; y < height; y++) {
+        // The planes are read only, restrict lets the compiler keep the loads ahead of the word stores
+        const uint8_t *__restrict y_row = y_plane + y * width;
+        const uint8_t *__restrict u_row = u_plane + y * (width / 2);
+        const uint8_t *__restrict v_row = v_plane + y * (width / 2);
+        uint8_t *__restrict d = dst + y * width * 2;
+        int pairs = width / 2;
+        if (aligned) {
+            // One word per pair of pixels: Y0, Cb, Y1, Cr
+            pixel_word_t *__restrict d32 = (pixel_word_t *)d;
+            int x = 0;
+            for (; x + 2 <= pairs; x += 2) {
+                uint32_t y0 = y_row[2 * x], y1 = y_row[2 * x + 1], y2 = y_row[2 * x + 2], y3 = y_row[2 * x + 3];
+                uint32_t u0 = u_row[x], u1 = u_row[x + 1];
+                uint32_t v0 = v_row[x], v1 = v_row[x + 1];
+                d32[x] = y0 | (u0 << 8) | (y1 << 16) | (v0 << 24);
+                d32[x + 1] = y2 | (u1 << 8) | (y3 << 16) | (v1 << 24);
+            }
+            for (; x < pairs; x++) {
+                d32[x] = y_row[2 * x] | (u_row[x] << 8) | (y_row[2 * x + 1] << 16) | ((uint32_t)v_row[x] << 24);
+            }
+        } else {
+            for (int x = 0; x < pairs; x++) {
+                d[4 * x] = y_row[2 * x];
+                d[4 * x + 1] = u_row[x];
+                d[4 * x + 2] = y_row[2 * x + 1];
+                d[4 * x + 3] = v_row[x];
+            }
+        }
+    }
+}
+
+bool pixel_argb8888_to_rgb565a8(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    uint16_t *rgb = (uint16_t *)dst;
+    uint8_t *alpha = dst + count * 2;
+    uint32_t opaque = 0xFF;
+    if (((uintptr_t)src & 3) == 0) {
+        // A pixel is loaded as one word, A << 24 | R << 16 | G << 8 | B
+        const pixel_word_t *s32 = (const pixel_word_t *)src;
+        for (size_t i = 0; i < count; i++) {
+            uint32_t p = s32[i];
+            rgb[i] = ((p >> 8) & 0xF800) | ((p >> 5) & 0x07E0) | ((p >> 3) & 0x001F);
+            alpha[i] = p >> 24;
+            opaque &= p >> 24;
+        }
+    } else {
+        for (size_t i = 0; i < count; i++, src += 4) {
+            rgb[i] = ((src[2] & 0xF8) << 8) | ((src[1] & 0xFC) << 3) | (src[0] >> 3);
+            alpha[i] = src[3];
+            opaque &= src[3];
+        }
+    }
+    return opaque == 0xFF;
+}
+
+void pixel_rgb565_downscale(uint16_t *dst, const uint16_t *src, int width, int height, int src_stride, int factor)
+{
+    int dst_width = width / factor;
+    int dst_height = height / factor;
+    int area = factor * factor;
+    // The JPEG scale factors are powers of two, their averages are shifts instead of divisions
+    int shift = (factor & (factor - 1)) == 0 ? __builtin_ctz(area) : -1;
+    for (int y = 0; y < dst_height; y++) {
+        const uint8_t *rows = (const uint8_t *)src + (size_t)y * factor * src_stride;
+        if (factor == 2) {
+            // Both rows of a block are summed together, the channels do not overflow into each other
+            const uint16_t *row0 = (const uint16_t *)rows;
+            const uint16_t *row1 = (const uint16_t *)(rows + src_stride);
+            for (int x = 0; x < dst_width; x++) {
+                uint32_t c0 = row0[2 * x], c1 = row0[2 * x + 1], c2 = row1[2 * x], c3 = row1[2 * x + 1];
+                uint32_t rb = (c0 & 0xF81F) + (c1 & 0xF81F) + (c2 & 0xF81F) + (c3 & 0xF81F);
+                uint32_t g = (c0 & 0x07E0) + (c1 & 0x07E0) + (c2 & 0x07E0) + (c3 & 0x07E0);
+                dst[y * dst_width + x] = (((rb >> 2) & 0xF81F) | ((g >> 2) & 0x07E0)) & 0xFFFF;
+            }
+            continue;
+        }
+        for (int x = 0; x < dst_width; x++) {
+            uint32_t r = 0, g = 0, b = 0;
+            for (int dy = 0; dy < factor; dy++) {
+                const uint16_t *p = (const uint16_t *)(rows + dy * src_stride) + x * factor;
+                for (int dx = 0; dx < factor; dx++) {
+                    uint16_t c = p[dx];
+                    r += c >> 11;
+                    g += (c >> 5) & 0x3F;
+                    b += c & 0x1F;
+                }
+            }
+            if (shift >= 0) {
+                dst[y * dst_width + x] = ((r >> shift) << 11) | ((g >> shift) << 5) | (b >> shift);
+            } else {
+                dst[y * dst_width + x] = ((r / area) << 11) | ((g / area) << 5) | (b / area);
+            }
+        }
+    }
+}
+
+#if defined(ESP_PLATFORM) && !CONFIG_IDF_TARGET_ESP32
+pixel_converter_t pixel_converter_open(esp_imgfx_pixel_fmt_t in_fmt, esp_imgfx_pixel_fmt_t out_fmt,
+                                       int width, int height)
+{
+    esp_imgfx_color_convert_cfg_t convert_cfg = {
+        .in_res = {.width = (int16_t)width, .height = (int16_t)height},
+        .in_pixel_fmt = in_fmt,
+        .out_pixel_fmt = out_fmt,
+        .color_space_std = ESP_IMGFX_COLOR_SPACE_STD_BT601,
+    };
+    esp_imgfx_color_convert_handle_t convert_handle = NULL;
+    esp_imgfx_err_t err = esp_imgfx_color_convert_open(&convert_cfg, &convert_handle);
+    if (err != ESP_IMGFX_ERR_OK || convert_handle == NULL) {
+        ESP_LOGE(TAG, "esp_imgfx_color_convert_open failed: %d", (int)err);
+        return NULL;
+    }
+    return convert_handle;
+}
+
+bool pixel_converter_process(pixel_converter_t converter, const uint8_t *src, size_t src_len,
+                             uint8_t *dst, size_t dst_len)
+{
+    esp_imgfx_data_t input_data = {
+        .data = (uint8_t *)src,
+        .data_len = (uint32_t)src_len,
+    };
+    esp_imgfx_data_t output_data = {
+        .data = dst,
+        .data_len = (uint32_t)dst_len,
+    };
+    esp_imgfx_err_t err = esp_imgfx_color_convert_process(converter, &input_data, &output_data);
+    if (err != ESP_IMGFX_ERR_OK) {
+        ESP_LOGE(TAG, "esp_imgfx_color_convert_process failed: %d", (int)err);
+        return false;
+    }
+    return true;
+}
+
+void pixel_converter_close(pixel_converter_t converter)
+{
+    if (converter != NULL) {
+        esp_imgfx_color_convert_close(converter);
+    }
+}
+
+bool pixel_convert_imgfx(const uint8_t *src, size_t src_len, esp_imgfx_pixel_fmt_t in_fmt,
+                         uint8_t *dst, size_t dst_len, esp_imgfx_pixel_fmt_t out_fmt, int width, int height)
+{
+    pixel_converter_t converter = pixel_converter_open(in_fmt, out_fmt, width, height);
+    if (converter == NULL) {
+        return false;
+    }
+    bool ok = pixel_converter_process(converter, src, src_len, dst, dst_len);
+    pixel_converter_close(converter);
+    return ok;
+}
+#endif
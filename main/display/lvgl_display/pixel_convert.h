@@ -0,0 +1,103 @@
+// pixel_convert.h - Pixel format kernels shared by the camera, snapshot, JPEG and GIF code
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+#if defined(ESP_PLATFORM) && !CONFIG_IDF_TARGET_ESP32
+#include "esp_imgfx_color_convert.h"
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Swap the bytes of 16-bit values, RGB565 <-> RGB565X or YUYV <-> UYVY
+     *
+     * Two values are swapped per 32-bit word. dst may be the same as src.
+     *
+     * @param dst       Output, count 16-bit values
+     * @param src       Input, count 16-bit values
+     * @param count     Number of 16-bit values
+     */
+    void pixel_swap16(void *dst, const void *src, size_t count);
+
+    /**
+     * @brief Interleave planar YUV 4:2:2 into YUYV
+     *
+     * @param dst       Output, width * height * 2 bytes
+     * @param src       Y plane followed by the U and V planes of half width
+     * @param width     Image width, must be even
+     * @param height    Image height
+     */
+    void pixel_yuv422p_to_yuyv(uint8_t *dst, const uint8_t *src, int width, int height);
+
+    /**
+     * @brief Convert ARGB8888 (B, G, R, A in memory) to the layout of LV_COLOR_FORMAT_RGB565A8
+     *
+     * @param dst       Output, the RGB565 plane followed by the alpha plane, count * 3 bytes
+     * @param src       Input, count * 4 bytes
+     * @param count     Number of pixels
+     *
+     * @return true if every pixel is opaque, the alpha plane can then be dropped
+     */
+    bool pixel_argb8888_to_rgb565a8(uint8_t *dst, const uint8_t *src, size_t count);
+
+    /**
+     * @brief Shrink RGB565 by an integer factor, each output pixel is the average of factor x factor pixels
+     *
+     * dst may point into the same buffer at or before src, the output is written behind the input.
+     *
+     * @param dst       Output, (width / factor) * (height / factor) pixels without padding
+     * @param src       Input
+     * @param width     Input width
+     * @param height    Input height
+     * @param src_stride Input stride in bytes
+     * @param factor    Scale factor, 1 copies the image
+     */
+    void pixel_rgb565_downscale(uint16_t *dst, const uint16_t *src, int width, int height, int src_stride, int factor);
+
+#if defined(ESP_PLATFORM) && !CONFIG_IDF_TARGET_ESP32
+    /**
+     * @brief Convert between RGB and YUV formats with esp_image_effects
+     *
+     * esp_image_effects has SIMD code for the ESP32-S3 and ESP32-P4, this wraps the open, process and close calls.
+     *
+     * @return true on success
+     */
+    bool pixel_convert_imgfx(const uint8_t *src, size_t src_len, esp_imgfx_pixel_fmt_t in_fmt,
+                             uint8_t *dst, size_t dst_len, esp_imgfx_pixel_fmt_t out_fmt, int width, int height);
+
+    typedef esp_imgfx_color_convert_handle_t pixel_converter_t;
+
+    /**
+     * @brief Open a converter for several images of the same size and formats, e.g. the stripes of a frame
+     *
+     * @return The converter, NULL on failure
+     */
+    pixel_converter_t pixel_converter_open(esp_imgfx_pixel_fmt_t in_fmt, esp_imgfx_pixel_fmt_t out_fmt,
+                                           int width, int height);
+
+    /**
+     * @brief Convert one image with a converter from pixel_converter_open()
+     *
+     * @return true on success
+     */
+    bool pixel_converter_process(pixel_converter_t converter, const uint8_t *src, size_t src_len,
+                                 uint8_t *dst, size_t dst_len);
+
+    /**
+     * @brief Close a converter, NULL is ignored
+     */
+    void pixel_converter_close(pixel_converter_t converter);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -88,6 +88,10 @@ void OledDisplay::SetupUI() {
     }
     
     Display::SetupUI();  // Mark SetupUI as called
+    {
+        DisplayLockGuard lock(this);
+        AddDisplayEvents();
+    }
     if (height_ == 64) {
         SetupUI_128x64();
     } else {
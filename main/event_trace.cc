@@ -0,0 +1,175 @@
+#include "event_trace.h"
+
+#if CONFIG_USE_EVENT_TRACE
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <freertos/task.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#define TAG "EventTrace"
+
+static_assert((CONFIG_EVENT_TRACE_BUFFER_SIZE & (CONFIG_EVENT_TRACE_BUFFER_SIZE - 1)) == 0,
+    "EVENT_TRACE_BUFFER_SIZE must be a power of 2");
+
+std::atomic<bool> EventTrace::enabled_ = true;
+std::atomic<int> EventTrace::buffer_count_ = 0;
+std::atomic<EventTraceBuffer*> EventTrace::buffers_[EVENT_TRACE_MAX_TASKS] = {};
+EventTraceBuffer EventTrace::dropped_buffer_ = {};
+thread_local EventTraceBuffer* EventTrace::current_buffer_ = nullptr;
+
+EventTraceBuffer* EventTrace::RegisterTask() {
+    current_buffer_ = &dropped_buffer_;
+    int index = buffer_count_.fetch_add(1);
+    if (index >= EVENT_TRACE_MAX_TASKS) {
+        ESP_LOGW(TAG, "No trace buffer left for task %s", pcTaskGetName(nullptr));
+        return current_buffer_;
+    }
+
+    size_t events_size = CONFIG_EVENT_TRACE_BUFFER_SIZE * sizeof(EventTraceEvent);
+    auto events = (EventTraceEvent*)heap_caps_malloc(events_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (events == nullptr) {
+        events = (EventTraceEvent*)heap_caps_malloc(events_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    auto buffer = new EventTraceBuffer();
+    if (events == nullptr || buffer == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the trace buffer for task %s", pcTaskGetName(nullptr));
+        heap_caps_free(events);
+        delete buffer;
+        return current_buffer_;
+    }
+
+    // Task names end up in space separated lines
+    strncpy(buffer->task_name, pcTaskGetName(nullptr), sizeof(buffer->task_name) - 1);
+    buffer->task_name[sizeof(buffer->task_name) - 1] = '\0';
+    std::replace(buffer->task_name, buffer->task_name + strlen(buffer->task_name), ' ', '_');
+    buffer->head.store(0);
+    buffer->tail = 0;
+    buffer->events = events;
+    buffers_[index].store(buffer, std::memory_order_release);
+    current_buffer_ = buffer;
+    return buffer;
+}
+
+namespace {
+
+// Collects the trace lines and sends them in datagrams, or prints them one by one
+class EventTraceWriter {
+public:
+    bool Open() {
+        std::string server_addr = CONFIG_EVENT_TRACE_UDP_SERVER;
+        if (server_addr.empty()) {
+            return true;
+        }
+        size_t colon_pos = server_addr.find(':');
+        if (colon_pos == std::string::npos) {
+            ESP_LOGW(TAG, "Invalid server address: %s, should be IP:PORT", CONFIG_EVENT_TRACE_UDP_SERVER);
+            return false;
+        }
+        memset(&server_addr_, 0, sizeof(server_addr_));
+        server_addr_.sin_family = AF_INET;
+        server_addr_.sin_port = htons(std::stoi(server_addr.substr(colon_pos + 1)));
+        inet_pton(AF_INET, server_addr.substr(0, colon_pos).c_str(), &server_addr_.sin_addr);
+
+        sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sockfd_ < 0) {
+            ESP_LOGW(TAG, "Failed to create UDP socket: %d", errno);
+            return false;
+        }
+        packet_.reserve(EVENT_TRACE_UDP_PACKET_SIZE);
+        return true;
+    }
+
+    ~EventTraceWriter() {
+        if (sockfd_ >= 0) {
+            Flush();
+            close(sockfd_);
+        }
+    }
+
+    void WriteLine(const char* line, int length) {
+        if (sockfd_ < 0) {
+            printf("%s", line);
+            return;
+        }
+        if (packet_.size() + length > EVENT_TRACE_UDP_PACKET_SIZE) {
+            Flush();
+        }
+        packet_.append(line, length);
+    }
+
+private:
+    int sockfd_ = -1;
+    struct sockaddr_in server_addr_;
+    std::string packet_;
+
+    void Flush() {
+        if (packet_.empty()) {
+            return;
+        }
+        if (sendto(sockfd_, packet_.data(), packet_.size(), 0, (struct sockaddr*)&server_addr_, sizeof(server_addr_)) < 0) {
+            ESP_LOGW(TAG, "Failed to send trace to %s: %d", CONFIG_EVENT_TRACE_UDP_SERVER, errno);
+        }
+        packet_.clear();
+        // Do not overrun the receive buffer of the host and the lwIP pbufs
+        vTaskDelay(pdMS_TO_TICKS(2));
+    }
+};
+
+} // namespace
+
+int EventTrace::Dump(bool clear) {
+    EventTraceWriter writer;
+    if (!writer.Open()) {
+        return -1;
+    }
+    std::vector<EventTraceEvent> events(CONFIG_EVENT_TRACE_BUFFER_SIZE);
+    char line[128];
+    int64_t now = esp_timer_get_time();
+    int length = snprintf(line, sizeof(line), "@trace begin %lld %lu\n", (long long)now, (unsigned long)(uint32_t)now);
+    writer.WriteLine(line, length);
+
+    int total = 0;
+    int buffer_count = std::min(buffer_count_.load(), EVENT_TRACE_MAX_TASKS);
+    for (int i = 0; i < buffer_count; i++) {
+        auto buffer = buffers_[i].load(std::memory_order_acquire);
+        if (buffer == nullptr) {
+            continue;
+        }
+        // Copy first, the task keeps writing while the lines are sent
+        uint32_t head = buffer->head.load(std::memory_order_acquire);
+        uint32_t first = std::max(buffer->tail, head - std::min<uint32_t>(head, CONFIG_EVENT_TRACE_BUFFER_SIZE));
+        for (uint32_t index = first; index != head; index++) {
+            events[index - first] = buffer->events[index & (CONFIG_EVENT_TRACE_BUFFER_SIZE - 1)];
+        }
+        // The slot of the next event may be half written, drop everything it could have overwritten
+        uint32_t new_head = buffer->head.load(std::memory_order_acquire);
+        uint32_t valid = new_head + 1 > CONFIG_EVENT_TRACE_BUFFER_SIZE ? new_head + 1 - CONFIG_EVENT_TRACE_BUFFER_SIZE : 0;
+        for (uint32_t index = std::max(first, valid); index < head; index++) {
+            auto& event = events[index - first];
+            length = snprintf(line, sizeof(line), "@T %s %c %lu %ld %s\n", buffer->task_name, (char)event.type,
+                (unsigned long)event.time_us, (long)event.arg, event.name);
+            writer.WriteLine(line, std::min<int>(length, sizeof(line) - 1));
+            total++;
+        }
+        if (clear) {
+            buffer->tail = head;
+        }
+    }
+
+    length = snprintf(line, sizeof(line), "@trace end %d\n", total);
+    writer.WriteLine(line, length);
+    ESP_LOGI(TAG, "Dumped %d events to %s", total,
+        strlen(CONFIG_EVENT_TRACE_UDP_SERVER) > 0 ? CONFIG_EVENT_TRACE_UDP_SERVER : "console");
+    return total;
+}
+
+#endif // CONFIG_USE_EVENT_TRACE
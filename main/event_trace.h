@@ -0,0 +1,113 @@
+#ifndef EVENT_TRACE_H
+#define EVENT_TRACE_H
+
+#include <sdkconfig.h>
+
+#include <atomic>
+#include <cstdint>
+
+#include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+
+#if CONFIG_USE_EVENT_TRACE
+
+// Tasks with their own ring buffer, events of the other tasks are dropped
+#define EVENT_TRACE_MAX_TASKS 24
+// Bytes of trace lines sent in one UDP datagram
+#define EVENT_TRACE_UDP_PACKET_SIZE 1400
+
+enum EventTraceType : uint8_t {
+    kEventTraceBegin = 'B',
+    kEventTraceEnd = 'E',
+    kEventTraceInstant = 'I',
+};
+
+// The name must be a string literal or another string that is never freed,
+// only the pointer is recorded
+struct EventTraceEvent {
+    uint32_t time_us;           // Low 32 bits of esp_timer_get_time()
+    int32_t arg;
+    const char* name;
+    EventTraceType type;
+};
+
+// Written only by its own task, read by Dump() without stopping the writer
+struct EventTraceBuffer {
+    char task_name[configMAX_TASK_NAME_LEN];
+    std::atomic<uint32_t> head;     // Events written since the buffer was created
+    uint32_t tail;                  // Events before it were cleared, only used by Dump()
+    EventTraceEvent* events;
+};
+
+// Records begin, end and instant events into one lock-free ring buffer per task,
+// and dumps them as text lines over UDP or to the console for scripts/trace_to_chrome.py
+class EventTrace {
+public:
+    static void Record(EventTraceType type, const char* name, int32_t arg = 0) {
+        if (!enabled_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        auto buffer = current_buffer_;
+        if (buffer == nullptr) {
+            buffer = RegisterTask();
+        }
+        if (buffer == &dropped_buffer_) {
+            return;
+        }
+        uint32_t head = buffer->head.load(std::memory_order_relaxed);
+        auto& event = buffer->events[head & (CONFIG_EVENT_TRACE_BUFFER_SIZE - 1)];
+        event.time_us = (uint32_t)esp_timer_get_time();
+        event.arg = arg;
+        event.name = name;
+        event.type = type;
+        buffer->head.store(head + 1, std::memory_order_release);
+    }
+
+    static void SetEnabled(bool enabled) { enabled_.store(enabled); }
+    static bool enabled() { return enabled_.load(); }
+
+    // Send the recorded events to CONFIG_EVENT_TRACE_UDP_SERVER, or print them if it is empty.
+    // Returns the number of events dumped, or -1 if the UDP server is invalid.
+    static int Dump(bool clear);
+
+private:
+    static std::atomic<bool> enabled_;
+    static std::atomic<int> buffer_count_;
+    static std::atomic<EventTraceBuffer*> buffers_[EVENT_TRACE_MAX_TASKS];
+    // Marks a task that could not get a buffer, so it does not retry on every event
+    static EventTraceBuffer dropped_buffer_;
+    static thread_local EventTraceBuffer* current_buffer_;
+
+    static EventTraceBuffer* RegisterTask();
+};
+
+// Records a begin event now and the matching end event when it goes out of scope
+class EventTraceScope {
+public:
+    EventTraceScope(const char* name, int32_t arg = 0) : name_(name) {
+        EventTrace::Record(kEventTraceBegin, name_, arg);
+    }
+    ~EventTraceScope() {
+        EventTrace::Record(kEventTraceEnd, name_);
+    }
+
+private:
+    const char* name_;
+};
+
+#define EVENT_TRACE_CONCAT_(a, b) a##b
+#define EVENT_TRACE_CONCAT(a, b) EVENT_TRACE_CONCAT_(a, b)
+
+#define TRACE_BEGIN(name) EventTrace::Record(kEventTraceBegin, name)
+#define TRACE_END(name) EventTrace::Record(kEventTraceEnd, name)
+#define TRACE_INSTANT(name, arg) EventTrace::Record(kEventTraceInstant, name, arg)
+#define TRACE_SCOPE(name, arg) EventTraceScope EVENT_TRACE_CONCAT(event_trace_scope_, __LINE__)(name, arg)
+
+#else
+#define TRACE_BEGIN(name) do {} while (0)
+#define TRACE_END(name) do {} while (0)
+#define TRACE_INSTANT(name, arg) do {} while (0)
+#define TRACE_SCOPE(name, arg) do {} while (0)
+#endif // CONFIG_USE_EVENT_TRACE
+
+#endif // EVENT_TRACE_H
@@ -0,0 +1,218 @@
+#include "heap_monitor.h"
+#include "application.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <algorithm>
+
+#define TAG "HeapMonitor"
+
+static const char* const TAG_NAMES[] = {
+    "audio",
+    "protocol",
+    "display",
+    "mcp",
+    "assets",
+};
+
+static const char* const CAPABILITY_NAMES[] = {
+    "internal",
+    "dma",
+    "psram",
+};
+
+static const uint32_t CAPABILITIES[] = {
+    MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+    MALLOC_CAP_DMA,
+    MALLOC_CAP_SPIRAM,
+};
+
+static const size_t HISTOGRAM_BOUNDS[] = HEAP_MONITOR_HISTOGRAM_BOUNDS;
+static_assert(sizeof(HISTOGRAM_BOUNDS) / sizeof(HISTOGRAM_BOUNDS[0]) == HEAP_MONITOR_HISTOGRAM_BUCKETS - 1,
+    "The last histogram bucket has no bound");
+
+struct HeapHistogram {
+    uint32_t counts[HEAP_MONITOR_HISTOGRAM_BUCKETS];
+    uint32_t bytes[HEAP_MONITOR_HISTOGRAM_BUCKETS];
+};
+
+// Called with the heap locked, must not allocate or log
+static bool CountFreeBlock(walker_heap_into_t heap_info, walker_block_info_t block_info, void* user_data) {
+    if (!block_info.used) {
+        auto histogram = static_cast<HeapHistogram*>(user_data);
+        int bucket = 0;
+        while (bucket < HEAP_MONITOR_HISTOGRAM_BUCKETS - 1 && block_info.size >= HISTOGRAM_BOUNDS[bucket]) {
+            bucket++;
+        }
+        histogram->counts[bucket]++;
+        histogram->bytes[bucket] += block_info.size;
+    }
+    return true;
+}
+
+HeapMonitor::HeapMonitor() {
+    for (int i = 0; i < kHeapCapabilityCount; i++) {
+        min_largest_free_block_[i] = UINT32_MAX;
+    }
+}
+
+const char* HeapMonitor::GetTagName(HeapTag tag) {
+    if (tag >= 0 && tag < kHeapTagCount) {
+        return TAG_NAMES[tag];
+    }
+    return "unknown";
+}
+
+void HeapMonitor::Track(HeapTag tag, int bytes) {
+    auto& usage = tags_[tag];
+    int current = usage.current.fetch_add(bytes) + bytes;
+    int peak = usage.peak.load();
+    while (current > peak && !usage.peak.compare_exchange_weak(peak, current)) {
+    }
+}
+
+void HeapMonitor::TakeSample() {
+    HeapMonitorSample sample = {};
+    sample.time_us = esp_timer_get_time();
+    sample.device_state = Application::GetInstance().GetDeviceState();
+    for (int i = 0; i < kHeapCapabilityCount; i++) {
+        sample.free_bytes[i] = heap_caps_get_free_size(CAPABILITIES[i]);
+        sample.largest_free_block[i] = heap_caps_get_largest_free_block(CAPABILITIES[i]);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (samples_.empty()) {
+        samples_.resize(HEAP_MONITOR_HISTORY);
+    }
+    for (int i = 0; i < kHeapCapabilityCount; i++) {
+        min_largest_free_block_[i] = std::min(min_largest_free_block_[i], sample.largest_free_block[i]);
+    }
+    samples_[next_sample_] = sample;
+    next_sample_ = (next_sample_ + 1) % samples_.size();
+    sample_count_ = std::min(sample_count_ + 1, samples_.size());
+
+    auto internal_free = sample.free_bytes[kHeapCapabilityInternal];
+    auto internal_largest = sample.largest_free_block[kHeapCapabilityInternal];
+    if (internal_largest < HEAP_MONITOR_MIN_LARGEST_BLOCK && internal_free >= 2 * HEAP_MONITOR_MIN_LARGEST_BLOCK) {
+        ESP_LOGW(TAG, "Internal heap fragmented: free %lu, largest block %lu",
+            (unsigned long)internal_free, (unsigned long)internal_largest);
+    }
+}
+
+bool HeapMonitor::GetIdleSlope(bool largest_block, int capability, int& samples, float& slope) {
+    // The memory in use depends on the state, only the idle samples are comparable
+    samples = 0;
+    double sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+    for (size_t i = 0; i < sample_count_; i++) {
+        auto& sample = samples_[(next_sample_ + samples_.size() - sample_count_ + i) % samples_.size()];
+        if (sample.device_state != kDeviceStateIdle) {
+            continue;
+        }
+        double x = sample.time_us / 3600000000.0;
+        double y = largest_block ? sample.largest_free_block[capability] : sample.free_bytes[capability];
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+        samples++;
+    }
+    double denominator = samples * sum_xx - sum_x * sum_x;
+    if (samples < HEAP_MONITOR_MIN_TREND_SAMPLES || denominator <= 0) {
+        slope = 0;
+        return false;
+    }
+    slope = (samples * sum_xy - sum_x * sum_y) / denominator;
+    return true;
+}
+
+cJSON* HeapMonitor::GetReportJson(bool with_histogram) {
+    cJSON* json = cJSON_CreateObject();
+
+    cJSON* capabilities = cJSON_CreateObject();
+    for (int i = 0; i < kHeapCapabilityCount; i++) {
+        size_t total = heap_caps_get_total_size(CAPABILITIES[i]);
+        if (total == 0) {
+            continue;
+        }
+        multi_heap_info_t info;
+        heap_caps_get_info(&info, CAPABILITIES[i]);
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "total", total);
+        cJSON_AddNumberToObject(item, "free", info.total_free_bytes);
+        cJSON_AddNumberToObject(item, "min_free", info.minimum_free_bytes);
+        cJSON_AddNumberToObject(item, "peak_used", total - info.minimum_free_bytes);
+        cJSON_AddNumberToObject(item, "largest_free_block", info.largest_free_block);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (min_largest_free_block_[i] != UINT32_MAX) {
+                cJSON_AddNumberToObject(item, "min_largest_free_block", min_largest_free_block_[i]);
+            }
+        }
+        cJSON_AddNumberToObject(item, "free_blocks", info.free_blocks);
+        cJSON_AddNumberToObject(item, "allocated_blocks", info.allocated_blocks);
+        // Percentage of the free memory that is not in the largest block
+        int fragmentation = info.total_free_bytes > 0 ? 100 - info.largest_free_block * 100 / info.total_free_bytes : 0;
+        cJSON_AddNumberToObject(item, "fragmentation", fragmentation);
+        if (with_histogram) {
+            HeapHistogram histogram = {};
+            heap_caps_walk(CAPABILITIES[i], CountFreeBlock, &histogram);
+            cJSON_AddItemToObject(item, "histogram_counts", cJSON_CreateIntArray((const int*)histogram.counts, HEAP_MONITOR_HISTOGRAM_BUCKETS));
+            cJSON_AddItemToObject(item, "histogram_bytes", cJSON_CreateIntArray((const int*)histogram.bytes, HEAP_MONITOR_HISTOGRAM_BUCKETS));
+        }
+        cJSON_AddItemToObject(capabilities, CAPABILITY_NAMES[i], item);
+    }
+    cJSON_AddItemToObject(json, "capabilities", capabilities);
+    if (with_histogram) {
+        int bounds[HEAP_MONITOR_HISTOGRAM_BUCKETS - 1];
+        std::copy(std::begin(HISTOGRAM_BOUNDS), std::end(HISTOGRAM_BOUNDS), bounds);
+        cJSON_AddItemToObject(json, "histogram_bounds", cJSON_CreateIntArray(bounds, HEAP_MONITOR_HISTOGRAM_BUCKETS - 1));
+    }
+
+    cJSON* subsystems = cJSON_CreateObject();
+    for (int i = 0; i < kHeapTagCount; i++) {
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "current", tags_[i].current.load());
+        cJSON_AddNumberToObject(item, "peak", tags_[i].peak.load());
+        cJSON_AddItemToObject(subsystems, TAG_NAMES[i], item);
+    }
+    cJSON_AddItemToObject(json, "subsystems", subsystems);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    cJSON* trend = cJSON_CreateObject();
+    cJSON_AddNumberToObject(trend, "samples", sample_count_);
+    int idle_samples = 0;
+    float free_slope = 0, largest_slope = 0, psram_slope = 0;
+    bool has_trend = GetIdleSlope(false, kHeapCapabilityInternal, idle_samples, free_slope);
+    GetIdleSlope(true, kHeapCapabilityInternal, idle_samples, largest_slope);
+    GetIdleSlope(false, kHeapCapabilityPsram, idle_samples, psram_slope);
+    cJSON_AddNumberToObject(trend, "idle_samples", idle_samples);
+    if (has_trend) {
+        cJSON_AddNumberToObject(trend, "internal_free_per_hour", (int)free_slope);
+        cJSON_AddNumberToObject(trend, "internal_largest_block_per_hour", (int)largest_slope);
+        cJSON_AddNumberToObject(trend, "psram_free_per_hour", (int)psram_slope);
+    }
+    bool leak = has_trend && (free_slope < -HEAP_MONITOR_LEAK_BYTES_PER_HOUR || psram_slope < -HEAP_MONITOR_LEAK_BYTES_PER_HOUR);
+    // The free memory is stable but it is split into smaller and smaller blocks
+    bool fragmentation = has_trend && largest_slope < -HEAP_MONITOR_LEAK_BYTES_PER_HOUR && free_slope >= -HEAP_MONITOR_LEAK_BYTES_PER_HOUR;
+    if (sample_count_ > 0) {
+        auto& last = samples_[(next_sample_ + samples_.size() - 1) % samples_.size()];
+        if (last.largest_free_block[kHeapCapabilityInternal] < HEAP_MONITOR_MIN_LARGEST_BLOCK &&
+            last.free_bytes[kHeapCapabilityInternal] >= 2 * HEAP_MONITOR_MIN_LARGEST_BLOCK) {
+            fragmentation = true;
+        }
+    }
+    cJSON_AddBoolToObject(trend, "leak_suspected", leak);
+    cJSON_AddBoolToObject(trend, "fragmentation_suspected", fragmentation);
+    cJSON_AddItemToObject(json, "trend", trend);
+    return json;
+}
+
+HeapTagScope::HeapTagScope(HeapTag tag) : tag_(tag) {
+    free_bytes_ = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+}
+
+HeapTagScope::~HeapTagScope() {
+    int used = (int)free_bytes_ - (int)heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    HeapMonitor::GetInstance().Track(tag_, used);
+}
@@ -0,0 +1,116 @@
+#ifndef HEAP_MONITOR_H
+#define HEAP_MONITOR_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+#include <cJSON.h>
+
+// Trend samples, one per minute
+#define HEAP_MONITOR_HISTORY 60
+// Samples needed before reporting a trend
+#define HEAP_MONITOR_MIN_TREND_SAMPLES 10
+// A loss of free memory faster than this while idle is reported as a leak
+#define HEAP_MONITOR_LEAK_BYTES_PER_HOUR 4096
+// Largest free internal block below this is reported as fragmentation, e.g. the assets sector buffer
+#define HEAP_MONITOR_MIN_LARGEST_BLOCK (16 * 1024)
+// Upper bounds of the free block histogram buckets, the last bucket has no bound
+#define HEAP_MONITOR_HISTOGRAM_BOUNDS { 64, 256, 1024, 4096, 8192, 16384, 32768 }
+#define HEAP_MONITOR_HISTOGRAM_BUCKETS 8
+
+enum HeapTag {
+    kHeapTagAudio,
+    kHeapTagProtocol,
+    kHeapTagDisplay,
+    kHeapTagMcp,
+    kHeapTagAssets,
+    kHeapTagCount
+};
+
+enum HeapCapability {
+    kHeapCapabilityInternal,
+    kHeapCapabilityDma,
+    kHeapCapabilityPsram,
+    kHeapCapabilityCount
+};
+
+struct HeapMonitorSample {
+    int64_t time_us;
+    uint8_t device_state;
+    uint32_t free_bytes[kHeapCapabilityCount];
+    uint32_t largest_free_block[kHeapCapabilityCount];
+};
+
+// Heap usage per capability, attributed to the subsystems, with the trend of the free memory
+class HeapMonitor {
+public:
+    static HeapMonitor& GetInstance() {
+        static HeapMonitor instance;
+        return instance;
+    }
+    // Delete copy constructor and assignment operator
+    HeapMonitor(const HeapMonitor&) = delete;
+    HeapMonitor& operator=(const HeapMonitor&) = delete;
+
+    // Attribute allocated (positive) or freed (negative) bytes to a subsystem
+    void Track(HeapTag tag, int bytes);
+    // Called once a minute to follow the trend of the free memory
+    void TakeSample();
+
+    // The free block histograms walk all the heaps with their locks held, they are only built on request
+    cJSON* GetReportJson(bool with_histogram);
+
+    static const char* GetTagName(HeapTag tag);
+
+private:
+    HeapMonitor();
+    ~HeapMonitor() = default;
+
+    struct TagUsage {
+        std::atomic<int> current = 0;
+        std::atomic<int> peak = 0;
+    };
+    TagUsage tags_[kHeapTagCount];
+
+    std::mutex mutex_;
+    std::vector<HeapMonitorSample> samples_;
+    size_t next_sample_ = 0;
+    size_t sample_count_ = 0;
+    // Smallest largest free block seen in the samples
+    uint32_t min_largest_free_block_[kHeapCapabilityCount];
+
+    // Least squares slope of the free bytes or the largest free block in the idle samples, per hour
+    bool GetIdleSlope(bool largest_block, int capability, int& samples, float& slope);
+};
+
+// Attributes the net change of the used heap during its lifetime to a subsystem.
+// Other tasks allocating at the same time are counted as well, so it is meant for
+// the large one-off allocations: initialization, opening the audio channel, etc.
+class HeapTagScope {
+public:
+    explicit HeapTagScope(HeapTag tag);
+    ~HeapTagScope();
+
+private:
+    HeapTag tag_;
+    size_t free_bytes_;
+};
+
+// Attributes a known allocation to a subsystem during its lifetime
+class HeapTrackGuard {
+public:
+    HeapTrackGuard(HeapTag tag, int bytes) : tag_(tag), bytes_(bytes) {
+        HeapMonitor::GetInstance().Track(tag_, bytes_);
+    }
+    ~HeapTrackGuard() {
+        HeapMonitor::GetInstance().Track(tag_, -bytes_);
+    }
+
+private:
+    HeapTag tag_;
+    int bytes_;
+};
+
+#endif // HEAP_MONITOR_H
@@ -8,22 +8,55 @@
 #include <esp_app_desc.h>
 #include <algorithm>
 #include <cstring>
+#include <strings.h>
 #include <esp_pthread.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
 
 #include "application.h"
+#include "cpu_profiler.h"
+#include "event_trace.h"
+#include "heap_monitor.h"
 #include "display.h"
 #include "oled_display.h"
 #include "board.h"
 #include "settings.h"
 #include "lvgl_theme.h"
 #include "lvgl_display.h"
+#include "jpg/jpeg_to_image.h"
 
 #define TAG "MCP"
 
+// Maximum size of a tools/list reply
+#define MAX_TOOLS_LIST_PAYLOAD_SIZE 8000
+
+// Tool workers run the blocking tools, one call per tool at a time
+#define MCP_TOOL_WORKER_COUNT 2
+#define MCP_MAX_PENDING_TOOL_JOBS 4
+#define MCP_TOOL_WORKER_STACK_SIZE (4096 * 2)
+// Tools running in the main task longer than this are reported
+#define MCP_MAIN_TASK_STALL_WARNING_MS 50
+// Heap held by tool replies larger than this is logged
+#define MCP_LARGE_REPLY_SIZE 4096
+
 McpServer::McpServer() {
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            static_cast<McpServer*>(arg)->CheckToolTimeouts();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "mcp_tool_timeout",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&timer_args, &tool_timeout_timer_);
 }
 
 McpServer::~McpServer() {
+    if (tool_timeout_timer_ != nullptr) {
+        esp_timer_stop(tool_timeout_timer_);
+        esp_timer_delete(tool_timeout_timer_);
+    }
     for (auto tool : tools_) {
         delete tool;
     }
@@ -36,7 +69,12 @@ void McpServer::AddCommonTools() {
     // **重要** 为了提升响应速度，我们把常用的工具放在前面，利用 prompt cache 的特性。
 
     // Backup the original tools list and restore it after adding the common tools.
-    auto original_tools = std::move(tools_);
+    std::vector<McpTool*> original_tools;
+    {
+        std::lock_guard<std::mutex> lock(tools_mutex_);
+        original_tools = std::move(tools_);
+        tools_.clear();
+    }
     auto& board = Board::GetInstance();
 
     // Do not add custom tools here.
@@ -118,11 +156,15 @@ void McpServer::AddCommonTools() {
                 auto question = properties["question"].value<std::string>();
                 return camera->Explain(question);
             });
+        // Capture and upload take seconds, keep them out of the main task
+        SetToolBlocking("self.camera.take_photo");
     }
 #endif
 
     // Restore the original tools list to the end of the tools list
+    std::lock_guard<std::mutex> lock(tools_mutex_);
     tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
+    tools_cache_dirty_ = true;
 }
 
 void McpServer::AddUserOnlyTools() {
@@ -135,6 +177,130 @@ void McpServer::AddUserOnlyTools() {
             return board.GetSystemInfoJson();
         });
 
+    AddUserOnlyTool("self.get_network_stats",
+        "Get the transport statistics of the server connection, including round trip time, jitter, "
+        "the playout delay of the jitter buffer and packet counters",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            ProtocolStatistics stats;
+            if (!Application::GetInstance().GetProtocolStatistics(stats)) {
+                throw std::runtime_error("Protocol is not initialized");
+            }
+            cJSON *json = cJSON_CreateObject();
+            cJSON_AddNumberToObject(json, "tx_packets", stats.tx_packets);
+            cJSON_AddNumberToObject(json, "tx_bytes", stats.tx_bytes);
+            cJSON_AddNumberToObject(json, "tx_failures", stats.tx_failures);
+            cJSON_AddNumberToObject(json, "rx_packets", stats.rx_packets);
+            cJSON_AddNumberToObject(json, "rx_bytes", stats.rx_bytes);
+            cJSON_AddNumberToObject(json, "pings_sent", stats.pings_sent);
+            cJSON_AddNumberToObject(json, "pongs_received", stats.pongs_received);
+            cJSON_AddNumberToObject(json, "rtt_ms", stats.rtt_ms);
+            cJSON_AddNumberToObject(json, "rtt_variance_ms", stats.rtt_variance_ms);
+            cJSON_AddNumberToObject(json, "jitter_ms", stats.jitter_ms);
+            cJSON_AddNumberToObject(json, "jitter_buffer_ms", Application::GetInstance().GetAudioService().GetJitterBufferDepth());
+            cJSON_AddNumberToObject(json, "connections", stats.connections);
+            cJSON_AddNumberToObject(json, "connections_reused", stats.connections_reused);
+            cJSON_AddNumberToObject(json, "connect_ms", stats.connect_ms);
+            cJSON_AddNumberToObject(json, "hello_ms", stats.hello_ms);
+            cJSON_AddNumberToObject(json, "server_packet_loss", stats.server_packet_loss);
+            return json;
+        });
+
+    AddUserOnlyTool("self.get_mcp_stats",
+        "Get the statistics of the MCP tool calls: calls, errors, and the time spent on parsing the arguments, "
+        "executing and serializing the result (average, p50, p90 and max in microseconds, over the recent calls)",
+        PropertyList(),
+        [this](const PropertyList& properties) -> ReturnValue {
+            return GetToolStatsJson();
+        });
+
+    AddUserOnlyTool("self.cpu_profiler.get_samples",
+        "Get the most recent CPU usage samples, oldest first. Each sample has the device state, "
+        "the total CPU usage and the busiest tasks with their CPU usage in percent, core and free stack in bytes",
+        PropertyList({
+            Property("count", kPropertyTypeInteger, 10, 1, CPU_PROFILER_HISTORY)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            return CpuProfiler::GetInstance().GetSamplesJson(properties["count"].value<int>());
+        });
+
+    AddUserOnlyTool("self.cpu_profiler.set_period",
+        "Set the CPU usage sampling period in milliseconds (100 to 10000), 0 to stop sampling",
+        PropertyList({
+            Property("period_ms", kPropertyTypeInteger, 0, CPU_PROFILER_MAX_PERIOD_MS)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            if (!CpuProfiler::GetInstance().SetPeriod(properties["period_ms"].value<int>())) {
+                throw std::runtime_error("The period must be 0 or between 100 and 10000 ms");
+            }
+            return true;
+        });
+
+    AddUserOnlyTool("self.heap.get_report",
+        "Get the heap report: free memory, largest free block, high-water mark and fragmentation per capability "
+        "(internal, dma, psram), the memory attributed to the subsystems (audio, protocol, display, mcp, assets) "
+        "and the trend of the free memory while idle, with leak and fragmentation detection. "
+        "`histogram`: include the free block size histograms, the heaps are locked while they are counted",
+        PropertyList({
+            Property("histogram", kPropertyTypeBoolean, true)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            return HeapMonitor::GetInstance().GetReportJson(properties["histogram"].value<bool>());
+        });
+
+#if CONFIG_USE_EVENT_TRACE
+    AddUserOnlyTool("self.trace.dump",
+        "Send the recorded trace events to the trace UDP server, or print them to the console if none is configured. "
+        "Convert the output with scripts/trace_to_chrome.py. Returns the number of events dumped",
+        PropertyList({
+            Property("clear", kPropertyTypeBoolean, true)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            int count = EventTrace::Dump(properties["clear"].value<bool>());
+            if (count < 0) {
+                throw std::runtime_error("Invalid trace UDP server address");
+            }
+            return count;
+        });
+    // Printing thousands of lines to the console takes seconds
+    SetToolBlocking("self.trace.dump");
+#endif
+
+    AddUserOnlyTool("self.audio_encoder.get_status",
+        "Get the current Opus encoder settings chosen from the link quality, and the reconfiguration counters",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto status = Application::GetInstance().GetAudioService().GetEncoderStatus();
+            cJSON *json = cJSON_CreateObject();
+            cJSON_AddNumberToObject(json, "bitrate", status.settings.bitrate);
+            cJSON_AddNumberToObject(json, "complexity", status.settings.complexity);
+            cJSON_AddBoolToObject(json, "fec", status.settings.enable_fec);
+            cJSON_AddNumberToObject(json, "packet_loss", status.packet_loss);
+            cJSON_AddNumberToObject(json, "link_level", status.link_level);
+            cJSON_AddNumberToObject(json, "encode_load", status.encode_load);
+            cJSON_AddNumberToObject(json, "reconfigurations", status.reconfigurations);
+            cJSON_AddNumberToObject(json, "reconfigure_failures", status.reconfigure_failures);
+            cJSON_AddNumberToObject(json, "frame_duration", status.frame_duration);
+            cJSON_AddNumberToObject(json, "latency_frames", status.latency_frames);
+            cJSON_AddNumberToObject(json, "latency_average_ms", status.latency_average_ms);
+            cJSON_AddNumberToObject(json, "latency_max_ms", status.latency_max_ms);
+            return json;
+        });
+
+    AddUserOnlyTool("self.audio_encoder.set_frame_duration",
+        "Set the preferred Opus frame duration in milliseconds (10, 20, 40 or 60). Shorter frames lower the latency "
+        "at the cost of bandwidth. The duration is negotiated with the server when the next audio channel is opened.",
+        PropertyList({
+            Property("frame_duration", kPropertyTypeInteger, 10, 60)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            int frame_duration = properties["frame_duration"].value<int>();
+            if (!Application::GetInstance().SetFrameDuration(frame_duration)) {
+                throw std::runtime_error("Unsupported frame duration: " + std::to_string(frame_duration));
+            }
+            return true;
+        });
+
     AddUserOnlyTool("self.reboot", "Reboot the system",
         PropertyList(),
         [this](const PropertyList& properties) -> ReturnValue {
@@ -186,21 +352,44 @@ void McpServer::AddUserOnlyTools() {
                 return json;
             });
 
+        AddUserOnlyTool("self.screen.get_performance",
+            "Get the rendering performance of the screen since the previous call: frames per second, "
+            "render time, flush time, time spent waiting for the panel transfers, the draw buffer configuration, "
+            "the time to show a new emotion, the emoji image cache usage, the chat message and subtitle updates and "
+            "the status bar updates with the time they hold the display lock, and the I2C transactions per minute",
+            PropertyList({
+                Property("reset", kPropertyTypeBoolean, true)
+            }),
+            [display](const PropertyList& properties) -> ReturnValue {
+                auto json = display->GetPerformanceJson(properties["reset"].value<bool>());
+                if (json == nullptr) {
+                    throw std::runtime_error("The display is not initialized");
+                }
+                return json;
+            });
+
 #if CONFIG_LV_USE_SNAPSHOT
-        AddUserOnlyTool("self.screen.snapshot", "Snapshot the screen and upload it to a specific URL",
+        AddUserOnlyTool("self.screen.snapshot", "Snapshot the screen and upload it to a specific URL, or return the JPEG image if the URL is empty",
             PropertyList({
-                Property("url", kPropertyTypeString),
+                Property("url", kPropertyTypeString, std::string("")),
                 Property("quality", kPropertyTypeInteger, 80, 1, 100)
             }),
             [display](const PropertyList& properties) -> ReturnValue {
                 auto url = properties["url"].value<std::string>();
                 auto quality = properties["quality"].value<int>();
 
+                auto start_time = esp_timer_get_time();
                 std::string jpeg_data;
                 if (!display->SnapshotToJpeg(jpeg_data, quality)) {
                     throw std::runtime_error("Failed to snapshot screen");
                 }
 
+                if (url.empty()) {
+                    // The image is base64 encoded in chunks while the reply is sent
+                    ESP_LOGI(TAG, "Snapshot %u bytes in %lld ms", jpeg_data.size(), (esp_timer_get_time() - start_time) / 1000);
+                    return new ImageContent("image/jpeg", std::move(jpeg_data));
+                }
+
                 ESP_LOGI(TAG, "Upload snapshot %u bytes to %s", jpeg_data.size(), url.c_str());
                 
                 // 构造multipart/form-data请求体
@@ -276,10 +465,29 @@ void McpServer::AddUserOnlyTools() {
                 }
                 http->Close();
 
+#ifndef CONFIG_IDF_TARGET_ESP32
+                // Decode JPEG to the screen size, LVGL would decode it at full size on every redraw
+                if (total_read > 2 && (uint8_t)data[0] == 0xFF && (uint8_t)data[1] == 0xD8) {
+                    uint8_t* pixels = nullptr;
+                    size_t pixels_len, width, height, stride;
+                    esp_err_t err = jpeg_to_image_scaled((const uint8_t*)data, total_read, display->width(), display->height(),
+                        false, &pixels, &pixels_len, &width, &height, &stride);
+                    heap_caps_free(data);
+                    if (err != ESP_OK) {
+                        throw std::runtime_error("Failed to decode image: " + url);
+                    }
+                    display->SetPreviewImage(std::make_unique<LvglAllocatedImage>(pixels, pixels_len, width, height, stride,
+                        LV_COLOR_FORMAT_RGB565));
+                    return true;
+                }
+#endif
+
                 auto image = std::make_unique<LvglAllocatedImage>(data, content_length);
                 display->SetPreviewImage(std::move(image));
                 return true;
             });
+        SetToolBlocking("self.screen.snapshot");
+        SetToolBlocking("self.screen.preview_image");
 #endif // CONFIG_LV_USE_SNAPSHOT
     }
 #endif // HAVE_LVGL
@@ -301,14 +509,17 @@ void McpServer::AddUserOnlyTools() {
 }
 
 void McpServer::AddTool(McpTool* tool) {
+    std::lock_guard<std::mutex> lock(tools_mutex_);
     // Prevent adding duplicate tools
-    if (std::find_if(tools_.begin(), tools_.end(), [tool](const McpTool* t) { return t->name() == tool->name(); }) != tools_.end()) {
+    if (tool_index_.find(tool->name()) != tool_index_.end()) {
         ESP_LOGW(TAG, "Tool %s already added", tool->name().c_str());
         return;
     }
 
     ESP_LOGI(TAG, "Add tool: %s%s", tool->name().c_str(), tool->user_only() ? " [user]" : "");
     tools_.push_back(tool);
+    tool_index_[tool->name()] = tool;
+    tools_cache_dirty_ = true;
 }
 
 void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
@@ -321,6 +532,16 @@ void McpServer::AddUserOnlyTool(const std::string& name, const std::string& desc
     AddTool(tool);
 }
 
+void McpServer::SetToolBlocking(const std::string& name, int timeout_ms) {
+    std::lock_guard<std::mutex> lock(tools_mutex_);
+    auto it = tool_index_.find(name);
+    if (it == tool_index_.end()) {
+        ESP_LOGW(TAG, "Tool %s not found", name.c_str());
+        return;
+    }
+    it->second->set_blocking(true, timeout_ms);
+}
+
 void McpServer::ParseMessage(const std::string& message) {
     cJSON* json = cJSON_Parse(message.c_str());
     if (json == nullptr) {
@@ -351,6 +572,39 @@ void McpServer::ParseCapabilities(const cJSON* capabilities) {
 }
 
 void McpServer::ParseMessage(const cJSON* json) {
+    if (cJSON_IsArray(json)) {
+        // Handle the batch in the main task, where the tools run, so their results go into one reply
+        cJSON* batch = cJSON_Duplicate(json, true);
+        if (batch == nullptr) {
+            ESP_LOGE(TAG, "Failed to copy MCP batch");
+            return;
+        }
+        Application::GetInstance().Schedule([this, batch]() {
+            HandleBatch(batch);
+            cJSON_Delete(batch);
+        });
+        return;
+    }
+    HandleMessage(json, nullptr);
+}
+
+void McpServer::HandleBatch(const cJSON* json) {
+    std::string replies = "[";
+    int count = 0;
+    cJSON* item;
+    cJSON_ArrayForEach(item, json) {
+        HandleMessage(item, &replies);
+        count++;
+    }
+    ESP_LOGI(TAG, "Batch of %d messages, reply %u bytes", count, replies.size() + 1);
+    // Notifications and calls of blocking tools don't reply within the batch
+    if (replies.size() > 1) {
+        replies += ']';
+        Application::GetInstance().SendMcpMessage(std::move(replies));
+    }
+}
+
+void McpServer::HandleMessage(const cJSON* json, std::string* batch) {
     // Check JSONRPC version
     auto version = cJSON_GetObjectItem(json, "jsonrpc");
     if (version == nullptr || !cJSON_IsString(version) || strcmp(version->valuestring, "2.0") != 0) {
@@ -367,6 +621,13 @@ void McpServer::ParseMessage(const cJSON* json) {
     
     auto method_str = std::string(method->valuestring);
     if (method_str.find("notifications") == 0) {
+        if (method_str == "notifications/cancelled") {
+            auto params = cJSON_GetObjectItem(json, "params");
+            auto request_id = cJSON_GetObjectItem(params, "requestId");
+            if (cJSON_IsNumber(request_id)) {
+                CancelToolJob(request_id->valueint);
+            }
+        }
         return;
     }
     
@@ -392,14 +653,22 @@ void McpServer::ParseMessage(const cJSON* json) {
             }
         }
         auto app_desc = esp_app_get_description();
-        std::string message = "{\"protocolVersion\":\"2024-11-05\",\"capabilities\":{\"tools\":{}},\"serverInfo\":{\"name\":\"" BOARD_NAME "\",\"version\":\"";
-        message += app_desc->version;
-        message += "\"}}";
-        ReplyResult(id_int, message);
+        std::string message;
+        JsonWriter writer(message);
+        writer.StartObject().Key("protocolVersion").String("2024-11-05");
+        writer.Key("capabilities").StartObject().Key("tools").StartObject().Key("hash").String(GetToolsHash()).EndObject().EndObject();
+        writer.Key("serverInfo").StartObject().Key("name").String(BOARD_NAME).Key("version").String(app_desc->version).EndObject();
+        writer.EndObject();
+        ReplyResult(id_int, message, batch);
     } else if (method_str == "tools/list") {
         std::string cursor_str = "";
+        std::string if_none_match;
         bool list_user_only_tools = false;
         if (params != nullptr) {
+            auto hash = cJSON_GetObjectItem(params, "ifNoneMatch");
+            if (cJSON_IsString(hash)) {
+                if_none_match = std::string(hash->valuestring);
+            }
             auto cursor = cJSON_GetObjectItem(params, "cursor");
             if (cJSON_IsString(cursor)) {
                 cursor_str = std::string(cursor->valuestring);
@@ -409,155 +678,613 @@ void McpServer::ParseMessage(const cJSON* json) {
                 list_user_only_tools = with_user_tools->valueint == 1;
             }
         }
-        GetToolsList(id_int, cursor_str, list_user_only_tools);
+        GetToolsList(id_int, cursor_str, list_user_only_tools, if_none_match, batch);
     } else if (method_str == "tools/call") {
         if (!cJSON_IsObject(params)) {
             ESP_LOGE(TAG, "tools/call: Missing params");
-            ReplyError(id_int, "Missing params");
+            ReplyError(id_int, "Missing params", batch);
             return;
         }
         auto tool_name = cJSON_GetObjectItem(params, "name");
         if (!cJSON_IsString(tool_name)) {
             ESP_LOGE(TAG, "tools/call: Missing name");
-            ReplyError(id_int, "Missing name");
+            ReplyError(id_int, "Missing name", batch);
             return;
         }
         auto tool_arguments = cJSON_GetObjectItem(params, "arguments");
         if (tool_arguments != nullptr && !cJSON_IsObject(tool_arguments)) {
             ESP_LOGE(TAG, "tools/call: Invalid arguments");
-            ReplyError(id_int, "Invalid arguments");
+            ReplyError(id_int, "Invalid arguments", batch);
             return;
         }
-        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments);
+        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments, batch);
     } else {
         ESP_LOGE(TAG, "Method not implemented: %s", method_str.c_str());
-        ReplyError(id_int, "Method not implemented: " + method_str);
+        ReplyError(id_int, "Method not implemented: " + method_str, batch);
+    }
+}
+
+void McpServer::SendReply(std::string&& payload, std::string* batch) {
+    if (batch != nullptr) {
+        if (batch->size() > 1) {
+            *batch += ',';
+        }
+        batch->append(payload);
+        return;
     }
+    Application::GetInstance().SendMcpMessage(std::move(payload));
 }
 
-void McpServer::ReplyResult(int id, const std::string& result) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-    payload += std::to_string(id) + ",\"result\":";
-    payload += result;
-    payload += "}";
-    Application::GetInstance().SendMcpMessage(payload);
+void McpServer::SendReply(McpReply&& reply, std::string* batch) {
+    HeapTrackGuard heap_track(kHeapTagMcp, reply.json.capacity() + reply.blob.capacity());
+    if (reply.blob.empty()) {
+        SendReply(std::move(reply.json), batch);
+        return;
+    }
+    if (batch == nullptr) {
+        // The protocol encodes the blob while sending, in chunks if it can
+        Application::GetInstance().SendMcpMessage(std::move(reply.json), std::move(reply.blob), reply.blob_offset);
+        return;
+    }
+
+    // A batch reply is one string, encode the blob straight into it
+    size_t encoded_size = 0;
+    mbedtls_base64_encode(nullptr, 0, &encoded_size, (const unsigned char*)reply.blob.data(), reply.blob.size());
+    std::string payload;
+    payload.reserve(reply.json.size() + encoded_size);
+    payload.append(reply.json, 0, reply.blob_offset);
+    size_t offset = payload.size();
+    payload.resize(offset + encoded_size);
+    size_t written = 0;
+    mbedtls_base64_encode((unsigned char*)payload.data() + offset, encoded_size, &written,
+        (const unsigned char*)reply.blob.data(), reply.blob.size());
+    payload.resize(offset + written);
+    reply.blob.clear();
+    reply.blob.shrink_to_fit();
+    payload.append(reply.json, reply.blob_offset, std::string::npos);
+    SendReply(std::move(payload), batch);
 }
 
-void McpServer::ReplyError(int id, const std::string& message) {
-    std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
-    payload += std::to_string(id);
-    payload += ",\"error\":{\"message\":\"";
-    payload += message;
-    payload += "\"}}";
-    Application::GetInstance().SendMcpMessage(payload);
+std::string McpServer::BuildResultReply(int id, std::string_view result) {
+    std::string payload;
+    payload.reserve(result.size() + 40);
+    JsonWriter writer(payload);
+    writer.StartObject().Key("jsonrpc").String("2.0").Key("id").Int(id);
+    writer.Key("result").Raw(result).EndObject();
+    return payload;
 }
 
-void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_only_tools) {
-    const int max_payload_size = 8000;
-    std::string json = "{\"tools\":[";
-    
-    bool found_cursor = cursor.empty();
-    auto it = tools_.begin();
-    std::string next_cursor = "";
-    
-    while (it != tools_.end()) {
-        // 如果我们还没有找到起始位置，继续搜索
-        if (!found_cursor) {
-            if ((*it)->name() == cursor) {
-                found_cursor = true;
-            } else {
-                ++it;
+std::string McpServer::BuildErrorReply(int id, std::string_view message) {
+    std::string payload;
+    JsonWriter writer(payload);
+    writer.StartObject().Key("jsonrpc").String("2.0").Key("id").Int(id);
+    writer.Key("error").StartObject().Key("message").String(message).EndObject().EndObject();
+    return payload;
+}
+
+McpReply McpServer::BuildToolReply(int id, McpTool* tool, const PropertyList& arguments) {
+    // The result is written once, straight into the reply payload
+    size_t free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    auto start_time = esp_timer_get_time();
+    ReturnValue return_value;
+    try {
+        return_value = tool->Execute(arguments);
+    } catch (const std::exception& e) {
+        ESP_LOGE(TAG, "tools/call: %s", e.what());
+        RecordToolExec(tool, esp_timer_get_time() - start_time, 0, true);
+        return McpReply{BuildErrorReply(id, e.what())};
+    }
+    auto exec_end_time = esp_timer_get_time();
+
+    McpReply reply;
+    JsonWriter writer(reply.json);
+    writer.StartObject().Key("jsonrpc").String("2.0").Key("id").Int(id).Key("result");
+    McpTool::WriteResult(return_value, reply);
+    writer.EndObject();
+    RecordToolExec(tool, exec_end_time - start_time, esp_timer_get_time() - exec_end_time, false);
+
+    if (reply.json.size() + reply.blob.size() >= MCP_LARGE_REPLY_SIZE) {
+        int held = (int)free_heap - (int)heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        ESP_LOGI(TAG, "Tool %s reply: %u bytes, %u bytes of binary data, %d bytes of heap held", tool->name().c_str(),
+            reply.json.size(), reply.blob.size(), held);
+    }
+    return reply;
+}
+
+void McpServer::ReplyResult(int id, std::string_view result, std::string* batch) {
+    SendReply(BuildResultReply(id, result), batch);
+}
+
+void McpServer::ReplyError(int id, std::string_view message, std::string* batch) {
+    SendReply(BuildErrorReply(id, message), batch);
+}
+
+void McpServer::BuildToolsCache() {
+    auto start_time = esp_timer_get_time();
+    tools_json_.clear();
+    tool_json_ranges_.clear();
+    for (auto tool : tools_) {
+        auto tool_json = tool->to_json();
+        tool_json_ranges_.emplace_back(tools_json_.size(), tool_json.size());
+        tools_json_ += tool_json;
+    }
+    tools_json_.shrink_to_fit();
+
+    // FNV-1a over the schemas and the user only flags, the same tools always give the same hash
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto fnv1a = [&hash](const char* data, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            hash ^= (uint8_t)data[i];
+            hash *= 0x100000001b3ULL;
+        }
+    };
+    fnv1a(tools_json_.data(), tools_json_.size());
+    for (auto tool : tools_) {
+        fnv1a(tool->user_only() ? "u" : "c", 1);
+    }
+    char hash_str[17];
+    snprintf(hash_str, sizeof(hash_str), "%016llx", (unsigned long long)hash);
+    tools_hash_ = hash_str;
+
+    // Split the tools into pages, the same way as the size check of the reply
+    const size_t header_size = strlen("{\"tools\":[");
+    for (int with_user_tools = 0; with_user_tools < 2; with_user_tools++) {
+        auto& pages = tools_list_pages_[with_user_tools];
+        pages.clear();
+        size_t begin = 0;
+        size_t payload_size = header_size;
+        bool overflow = false;
+        for (size_t i = 0; i < tools_.size() && !overflow; i++) {
+            if (!with_user_tools && tools_[i]->user_only()) {
                 continue;
             }
+            size_t tool_size = tool_json_ranges_[i].second + 1;
+            if (payload_size + tool_size + 30 > MAX_TOOLS_LIST_PAYLOAD_SIZE) {
+                if (payload_size > header_size) {
+                    pages.push_back({begin, i});
+                }
+                begin = i;
+                payload_size = header_size;
+                // A tool too large for any page ends the list with an empty page, which is reported as an error
+                overflow = payload_size + tool_size + 30 > MAX_TOOLS_LIST_PAYLOAD_SIZE;
+            }
+            payload_size += tool_size;
         }
+        pages.push_back({begin, overflow ? begin : tools_.size()});
+    }
 
-        if (!list_user_only_tools && (*it)->user_only()) {
-            ++it;
-            continue;
+    tools_cache_dirty_ = false;
+    ESP_LOGI(TAG, "Tools cache built: %u tools, %u bytes, %u/%u pages, hash %s in %lld us", tools_.size(), tools_json_.size(),
+        tools_list_pages_[0].size(), tools_list_pages_[1].size(), tools_hash_.c_str(), esp_timer_get_time() - start_time);
+}
+
+std::string McpServer::GetToolsHash() {
+    std::lock_guard<std::mutex> lock(tools_mutex_);
+    if (tools_cache_dirty_) {
+        BuildToolsCache();
+    }
+    return tools_hash_;
+}
+
+void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_only_tools, const std::string& if_none_match, std::string* batch) {
+    // Released before replying, sending may wait for the network
+    std::unique_lock<std::mutex> lock(tools_mutex_);
+    if (tools_cache_dirty_) {
+        BuildToolsCache();
+    }
+
+    // The server already has this tools list
+    if (cursor.empty() && !if_none_match.empty() && if_none_match == tools_hash_) {
+        ESP_LOGI(TAG, "tools/list: unchanged, skipped %u bytes", tools_json_.size());
+        std::string json = "{\"unchanged\":true,\"hash\":\"" + tools_hash_ + "\"}";
+        lock.unlock();
+        ReplyResult(id, json, batch);
+        return;
+    }
+
+    const auto& pages = tools_list_pages_[list_user_only_tools ? 1 : 0];
+    auto page = pages.begin();
+    if (!cursor.empty()) {
+        // The cursor is the name of the first tool of the page
+        auto tool = tool_index_.find(cursor);
+        if (tool != tool_index_.end()) {
+            page = std::find_if(pages.begin(), pages.end(), [this, &tool](const McpToolsListPage& p) {
+                return p.begin < tools_.size() && tools_[p.begin] == tool->second;
+            });
         }
-        
-        // 添加tool前检查大小
-        std::string tool_json = (*it)->to_json() + ",";
-        if (json.length() + tool_json.length() + 30 > max_payload_size) {
-            // 如果添加这个tool会超出大小限制，设置next_cursor并退出循环
-            next_cursor = (*it)->name();
-            break;
+        if (tool == tool_index_.end() || page == pages.end()) {
+            // Unknown cursor, nothing to list from it
+            lock.unlock();
+            ReplyResult(id, "{\"tools\":[]}", batch);
+            return;
         }
-        
-        json += tool_json;
-        ++it;
     }
-    
+
+    std::string json = "{\"tools\":[";
+    json.reserve(MAX_TOOLS_LIST_PAYLOAD_SIZE);
+    for (size_t i = page->begin; i < page->end; i++) {
+        if (!list_user_only_tools && tools_[i]->user_only()) {
+            continue;
+        }
+        json.append(tools_json_, tool_json_ranges_[i].first, tool_json_ranges_[i].second);
+        json += ',';
+    }
+
+    std::string next_cursor = page->end < tools_.size() ? tools_[page->end]->name() : "";
     if (json.back() == ',') {
         json.pop_back();
     }
-    
+
     if (json.back() == '[' && !tools_.empty()) {
+        lock.unlock();
         // 如果没有添加任何tool，返回错误
         ESP_LOGE(TAG, "tools/list: Failed to add tool %s because of payload size limit", next_cursor.c_str());
-        ReplyError(id, "Failed to add tool " + next_cursor + " because of payload size limit");
+        ReplyError(id, "Failed to add tool " + next_cursor + " because of payload size limit", batch);
         return;
     }
 
     if (next_cursor.empty()) {
-        json += "]}";
+        // The last page carries the hash for the next conditional request
+        json += "],\"hash\":\"" + tools_hash_ + "\"}";
     } else {
         json += "],\"nextCursor\":\"" + next_cursor + "\"}";
     }
-    
-    ReplyResult(id, json);
+    lock.unlock();
+
+    ReplyResult(id, json, batch);
 }
 
-void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments) {
-    auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
-                                 [&tool_name](const McpTool* tool) { 
-                                     return tool->name() == tool_name; 
-                                 });
-    
-    if (tool_iter == tools_.end()) {
+void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, std::string* batch) {
+    McpTool* tool = nullptr;
+    {
+        // Tools are never removed, the pointer stays valid after the lock is released
+        std::lock_guard<std::mutex> lock(tools_mutex_);
+        auto tool_iter = tool_index_.find(tool_name);
+        if (tool_iter != tool_index_.end()) {
+            tool = tool_iter->second;
+        }
+    }
+    if (tool == nullptr) {
         ESP_LOGE(TAG, "tools/call: Unknown tool: %s", tool_name.c_str());
-        ReplyError(id, "Unknown tool: " + tool_name);
+        ReplyError(id, "Unknown tool: " + tool_name, batch);
         return;
     }
 
-    PropertyList arguments = (*tool_iter)->properties();
-    try {
-        for (auto& argument : arguments) {
-            bool found = false;
-            if (cJSON_IsObject(tool_arguments)) {
-                auto value = cJSON_GetObjectItem(tool_arguments, argument.name().c_str());
-                if (argument.type() == kPropertyTypeBoolean && cJSON_IsBool(value)) {
-                    argument.set_value<bool>(value->valueint == 1);
-                    found = true;
-                } else if (argument.type() == kPropertyTypeInteger && cJSON_IsNumber(value)) {
-                    argument.set_value<int>(value->valueint);
-                    found = true;
-                } else if (argument.type() == kPropertyTypeString && cJSON_IsString(value)) {
-                    argument.set_value<std::string>(value->valuestring);
-                    found = true;
-                }
-            }
+    auto parse_start_time = esp_timer_get_time();
+    PropertyList arguments = tool->AcquireArguments();
+    std::string error;
+    if (!tool->validator().Parse(tool_arguments, arguments, error)) {
+        ESP_LOGE(TAG, "tools/call: %s", error.c_str());
+        RecordToolParse(tool, esp_timer_get_time() - parse_start_time, true);
+        tool->ReleaseArguments(std::move(arguments));
+        ReplyError(id, error, batch);
+        return;
+    }
+    RecordToolParse(tool, esp_timer_get_time() - parse_start_time, false);
 
-            if (!argument.has_default_value() && !found) {
-                ESP_LOGE(TAG, "tools/call: Missing valid argument: %s", argument.name().c_str());
-                ReplyError(id, "Missing valid argument: " + argument.name());
-                return;
-            }
-        }
-    } catch (const std::exception& e) {
-        ESP_LOGE(TAG, "tools/call: %s", e.what());
-        ReplyError(id, e.what());
+    if (tool->blocking()) {
+        StartToolJob(id, tool, std::move(arguments));
+        return;
+    }
+
+    // A batch is already handled in the main task
+    if (batch != nullptr) {
+        CallToolInMainTask(id, tool, arguments, batch);
+        tool->ReleaseArguments(std::move(arguments));
         return;
     }
 
     // Use main thread to call the tool
     auto& app = Application::GetInstance();
-    app.Schedule([this, id, tool_iter, arguments = std::move(arguments)]() {
-        try {
-            ReplyResult(id, (*tool_iter)->Call(arguments));
-        } catch (const std::exception& e) {
-            ESP_LOGE(TAG, "tools/call: %s", e.what());
-            ReplyError(id, e.what());
+    app.Schedule([this, id, tool, arguments = std::move(arguments)]() mutable {
+        CallToolInMainTask(id, tool, arguments, nullptr);
+        tool->ReleaseArguments(std::move(arguments));
+    });
+}
+
+void McpServer::CallToolInMainTask(int id, McpTool* tool, const PropertyList& arguments, std::string* batch) {
+    auto start_time = esp_timer_get_time();
+    SendReply(BuildToolReply(id, tool, arguments), batch);
+    int stall_ms = (esp_timer_get_time() - start_time) / 1000;
+    if (stall_ms > MCP_MAIN_TASK_STALL_WARNING_MS) {
+        ESP_LOGW(TAG, "Tool %s stalled the main task for %d ms", tool->name().c_str(), stall_ms);
+    }
+}
+
+void McpServer::StartToolJob(int id, McpTool* tool, PropertyList&& arguments) {
+    auto job = std::make_shared<McpToolJob>();
+    job->id = id;
+    job->tool = tool;
+    job->arguments = std::move(arguments);
+    job->enqueue_time_us = esp_timer_get_time();
+    job->deadline_us = job->enqueue_time_us + (int64_t)tool->timeout_ms() * 1000;
+
+    std::lock_guard<std::mutex> lock(tool_jobs_mutex_);
+    if (pending_tool_jobs_.size() >= MCP_MAX_PENDING_TOOL_JOBS) {
+        ESP_LOGW(TAG, "tools/call: Too many pending tool calls, rejecting %s", tool->name().c_str());
+        RecordToolError(tool);
+        ReplyError(id, "Too many pending tool calls");
+        return;
+    }
+    pending_tool_jobs_.push_back(job);
+
+    // Start the workers on demand
+    if (tool_workers_ < MCP_TOOL_WORKER_COUNT && tool_workers_ < (int)(pending_tool_jobs_.size() + running_tool_jobs_.size())) {
+        char name[16];
+        snprintf(name, sizeof(name), "mcp_tool_%d", tool_workers_);
+        if (xTaskCreate([](void* arg) {
+            static_cast<McpServer*>(arg)->ToolWorkerTask();
+            vTaskDelete(NULL);
+        }, name, MCP_TOOL_WORKER_STACK_SIZE, this, 2, NULL) == pdPASS) {
+            tool_workers_++;
+        } else {
+            ESP_LOGE(TAG, "Failed to create tool worker");
+        }
+    }
+    if (!esp_timer_is_active(tool_timeout_timer_)) {
+        esp_timer_start_periodic(tool_timeout_timer_, 1000 * 1000);
+    }
+    tool_jobs_cv_.notify_one();
+}
+
+void McpServer::ToolWorkerTask() {
+    std::unique_lock<std::mutex> lock(tool_jobs_mutex_);
+    while (true) {
+        // Take the first job whose tool is not running, so the same tool never runs twice at a time
+        std::deque<std::shared_ptr<McpToolJob>>::iterator it;
+        tool_jobs_cv_.wait(lock, [this, &it]() {
+            it = std::find_if(pending_tool_jobs_.begin(), pending_tool_jobs_.end(), [this](const std::shared_ptr<McpToolJob>& job) {
+                return std::none_of(running_tool_jobs_.begin(), running_tool_jobs_.end(), [&job](const std::shared_ptr<McpToolJob>& running) {
+                    return running->tool == job->tool;
+                });
+            });
+            return it != pending_tool_jobs_.end();
+        });
+        auto job = *it;
+        pending_tool_jobs_.erase(it);
+        running_tool_jobs_.push_back(job);
+        lock.unlock();
+
+        auto start_time = esp_timer_get_time();
+        auto reply = BuildToolReply(job->id, job->tool, job->arguments);
+        auto end_time = esp_timer_get_time();
+
+        if (!job->finished.exchange(true)) {
+            SendReply(std::move(reply), nullptr);
+            ESP_LOGI(TAG, "Tool %s finished in %d ms (queued %d ms)", job->tool->name().c_str(),
+                (int)((end_time - start_time) / 1000), (int)((start_time - job->enqueue_time_us) / 1000));
+        } else {
+            ESP_LOGW(TAG, "Tool %s finished after %d ms, the call was already cancelled or timed out",
+                job->tool->name().c_str(), (int)((end_time - start_time) / 1000));
         }
+
+        lock.lock();
+        running_tool_jobs_.erase(std::find(running_tool_jobs_.begin(), running_tool_jobs_.end(), job));
+        // Another job of the same tool may be runnable now
+        tool_jobs_cv_.notify_all();
+    }
+}
+
+void McpServer::CancelToolJob(int id) {
+    std::lock_guard<std::mutex> lock(tool_jobs_mutex_);
+    auto pending = std::find_if(pending_tool_jobs_.begin(), pending_tool_jobs_.end(), [id](const std::shared_ptr<McpToolJob>& job) {
+        return job->id == id;
     });
+    if (pending != pending_tool_jobs_.end()) {
+        ESP_LOGI(TAG, "Cancel pending tool call %d: %s", id, (*pending)->tool->name().c_str());
+        pending_tool_jobs_.erase(pending);
+        return;
+    }
+    for (auto& job : running_tool_jobs_) {
+        if (job->id == id) {
+            // The tool cannot be interrupted, its result is dropped when it returns
+            ESP_LOGI(TAG, "Cancel running tool call %d: %s", id, job->tool->name().c_str());
+            job->finished = true;
+            return;
+        }
+    }
+}
+
+void McpServer::CheckToolTimeouts() {
+    std::lock_guard<std::mutex> lock(tool_jobs_mutex_);
+    auto now = esp_timer_get_time();
+    for (auto it = pending_tool_jobs_.begin(); it != pending_tool_jobs_.end();) {
+        if (now >= (*it)->deadline_us) {
+            ESP_LOGW(TAG, "Tool call %d timed out in the queue: %s", (*it)->id, (*it)->tool->name().c_str());
+            RecordToolError((*it)->tool);
+            ReplyError((*it)->id, "Tool call timed out");
+            it = pending_tool_jobs_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (auto& job : running_tool_jobs_) {
+        if (now >= job->deadline_us && !job->finished.exchange(true)) {
+            ESP_LOGW(TAG, "Tool call %d timed out: %s", job->id, job->tool->name().c_str());
+            RecordToolError(job->tool);
+            ReplyError(job->id, "Tool call timed out");
+        }
+    }
+    if (pending_tool_jobs_.empty() && running_tool_jobs_.empty()) {
+        esp_timer_stop(tool_timeout_timer_);
+    }
+}
+
+McpArgumentValidator::McpArgumentValidator(const PropertyList& properties) {
+    if (properties.size() > 64) {
+        ESP_LOGE(TAG, "Too many properties: %u, only the first 64 are checked", properties.size());
+    }
+    for (size_t i = 0; i < properties.size() && i < 64; i++) {
+        auto& property = properties.at(i);
+        Slot slot = {
+            .name_length = (uint8_t)std::min(property.name().size(), (size_t)UINT8_MAX),
+            .type = property.type(),
+            .required = !property.has_default_value(),
+            .has_range = property.has_range(),
+            .min_value = property.min_value(),
+            .max_value = property.max_value(),
+        };
+        slots_.push_back(slot);
+        if (slot.required) {
+            required_mask_ |= 1ULL << i;
+        }
+    }
+}
+
+bool McpArgumentValidator::Parse(const cJSON* arguments, PropertyList& arguments_out, std::string& error) const {
+    uint64_t found_mask = 0;
+    if (cJSON_IsObject(arguments)) {
+        for (const cJSON* item = arguments->child; item != nullptr; item = item->next) {
+            if (item->string == nullptr) {
+                continue;
+            }
+            // Names match case insensitively and the first one wins, the same as cJSON_GetObjectItem
+            size_t name_length = strlen(item->string);
+            for (size_t i = 0; i < slots_.size(); i++) {
+                auto& slot = slots_[i];
+                auto& property = arguments_out.at(i);
+                if (slot.name_length != name_length || (found_mask & (1ULL << i)) ||
+                    strcasecmp(property.name().c_str(), item->string) != 0) {
+                    continue;
+                }
+                if (slot.type == kPropertyTypeBoolean && cJSON_IsBool(item)) {
+                    property.set_value<bool>(item->valueint == 1);
+                } else if (slot.type == kPropertyTypeInteger && cJSON_IsNumber(item)) {
+                    if (slot.has_range && item->valueint < slot.min_value) {
+                        error = "Value is below minimum allowed: " + std::to_string(slot.min_value);
+                        return false;
+                    }
+                    if (slot.has_range && item->valueint > slot.max_value) {
+                        error = "Value exceeds maximum allowed: " + std::to_string(slot.max_value);
+                        return false;
+                    }
+                    property.set_value<int>(item->valueint);
+                } else if (slot.type == kPropertyTypeString && cJSON_IsString(item)) {
+                    property.set_value<std::string>(item->valuestring);
+                } else {
+                    // A value of the wrong type is ignored, the default value is used if there is one
+                    break;
+                }
+                found_mask |= 1ULL << i;
+                break;
+            }
+        }
+    }
+
+    uint64_t missing_mask = required_mask_ & ~found_mask;
+    if (missing_mask != 0) {
+        error = "Missing valid argument: " + arguments_out.at(__builtin_ctzll(missing_mask)).name();
+        return false;
+    }
+    return true;
+}
+
+void McpDurationHistogram::Add(int64_t duration_us) {
+    int bucket = 0;
+    int64_t limit = 100;
+    while (bucket < MCP_STATS_BUCKETS - 1 && duration_us >= limit) {
+        bucket++;
+        limit *= 4;
+    }
+    buckets_[bucket]++;
+    count_++;
+    total_us_ += duration_us;
+    max_us_ = std::max(max_us_, duration_us);
+
+    if (count_ >= MCP_STATS_WINDOW) {
+        uint32_t count = 0;
+        for (auto& value : buckets_) {
+            value /= 2;
+            count += value;
+        }
+        total_us_ = total_us_ * count / count_;
+        count_ = count;
+    }
+}
+
+int64_t McpDurationHistogram::Percentile(int percent) const {
+    if (count_ == 0) {
+        return 0;
+    }
+    uint32_t target = (count_ * percent + 99) / 100;
+    uint32_t count = 0;
+    int64_t limit = 100;
+    for (int i = 0; i < MCP_STATS_BUCKETS - 1; i++) {
+        count += buckets_[i];
+        if (count >= target) {
+            return std::min(limit, max_us_);
+        }
+        limit *= 4;
+    }
+    return max_us_;
+}
+
+cJSON* McpDurationHistogram::ToJson() const {
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "average_us", average_us());
+    cJSON_AddNumberToObject(json, "p50_us", Percentile(50));
+    cJSON_AddNumberToObject(json, "p90_us", Percentile(90));
+    cJSON_AddNumberToObject(json, "max_us", max_us_);
+    return json;
+}
+
+void McpServer::RecordToolParse(McpTool* tool, int64_t parse_us, bool failed) {
+    std::lock_guard<std::mutex> lock(tool_stats_mutex_);
+    auto& stats = tool->stats();
+    stats.calls++;
+    if (failed) {
+        stats.errors++;
+    }
+    stats.parse.Add(parse_us);
+}
+
+void McpServer::RecordToolExec(McpTool* tool, int64_t exec_us, int64_t serialize_us, bool failed) {
+    std::lock_guard<std::mutex> lock(tool_stats_mutex_);
+    auto& stats = tool->stats();
+    stats.exec.Add(exec_us);
+    if (failed) {
+        stats.errors++;
+    } else {
+        stats.serialize.Add(serialize_us);
+    }
+}
+
+void McpServer::RecordToolError(McpTool* tool) {
+    std::lock_guard<std::mutex> lock(tool_stats_mutex_);
+    tool->stats().errors++;
+}
+
+cJSON* McpServer::GetToolStatsJson() {
+    std::lock_guard<std::mutex> tools_lock(tools_mutex_);
+    std::lock_guard<std::mutex> lock(tool_stats_mutex_);
+    cJSON* json = cJSON_CreateArray();
+    for (auto tool : tools_) {
+        auto& stats = tool->stats();
+        if (stats.calls == 0) {
+            continue;
+        }
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddStringToObject(item, "name", tool->name().c_str());
+        cJSON_AddNumberToObject(item, "calls", stats.calls);
+        cJSON_AddNumberToObject(item, "errors", stats.errors);
+        cJSON_AddItemToObject(item, "parse", stats.parse.ToJson());
+        cJSON_AddItemToObject(item, "exec", stats.exec.ToJson());
+        cJSON_AddItemToObject(item, "serialize", stats.serialize.ToJson());
+        cJSON_AddItemToArray(json, item);
+    }
+    return json;
+}
+
+void McpServer::PrintToolStats() {
+    std::lock_guard<std::mutex> tools_lock(tools_mutex_);
+    std::lock_guard<std::mutex> lock(tool_stats_mutex_);
+    for (auto tool : tools_) {
+        auto& stats = tool->stats();
+        if (stats.calls == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%s: calls %lu errors %lu parse %lld us exec %lld/%lld/%lld us serialize %lld us",
+            tool->name().c_str(), stats.calls, stats.errors, stats.parse.average_us(),
+            stats.exec.Percentile(50), stats.exec.Percentile(90), stats.exec.max_us(), stats.serialize.average_us());
+    }
 }
@@ -4,46 +4,141 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <functional>
 #include <variant>
 #include <optional>
 #include <stdexcept>
 #include <thread>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <string_view>
+#include <cstdio>
 #include <mbedtls/base64.h>
+#include <esp_timer.h>
 
 #include <cJSON.h>
 
+// Writes JSON text straight into a string without building a cJSON tree.
+// Commas between values are inserted automatically.
+class JsonWriter {
+private:
+    std::string& out_;
+
+    void Separate() {
+        if (!out_.empty()) {
+            char last = out_.back();
+            if (last != '{' && last != '[' && last != ':' && last != ',') {
+                out_ += ',';
+            }
+        }
+    }
+
+    void AppendString(std::string_view value) {
+        out_ += '"';
+        size_t start = 0;
+        for (size_t i = 0; i < value.size(); i++) {
+            unsigned char c = value[i];
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
+            }
+            out_.append(value.data() + start, i - start);
+            start = i + 1;
+            switch (c) {
+            case '"': out_ += "\\\""; break;
+            case '\\': out_ += "\\\\"; break;
+            case '\n': out_ += "\\n"; break;
+            case '\r': out_ += "\\r"; break;
+            case '\t': out_ += "\\t"; break;
+            case '\b': out_ += "\\b"; break;
+            case '\f': out_ += "\\f"; break;
+            default: {
+                char escaped[7];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out_ += escaped;
+                break;
+            }
+            }
+        }
+        out_.append(value.data() + start, value.size() - start);
+        out_ += '"';
+    }
+
+public:
+    explicit JsonWriter(std::string& out) : out_(out) {}
+
+    JsonWriter& StartObject() { Separate(); out_ += '{'; return *this; }
+    JsonWriter& EndObject() { out_ += '}'; return *this; }
+    JsonWriter& StartArray() { Separate(); out_ += '['; return *this; }
+    JsonWriter& EndArray() { out_ += ']'; return *this; }
+    JsonWriter& Key(std::string_view key) { Separate(); AppendString(key); out_ += ':'; return *this; }
+    JsonWriter& String(std::string_view value) { Separate(); AppendString(value); return *this; }
+    JsonWriter& Int(long long value) { Separate(); out_ += std::to_string(value); return *this; }
+    JsonWriter& Bool(bool value) { Separate(); out_ += value ? "true" : "false"; return *this; }
+    // Append an already serialized JSON value
+    JsonWriter& Raw(std::string_view json) { Separate(); out_.append(json); return *this; }
+    // Write an empty string value and return the offset inside its quotes
+    size_t StringPlaceholder() { Separate(); out_ += "\"\""; return out_.size() - 1; }
+    // Reserve room for the next bytes to avoid growing the buffer several times
+    void Reserve(size_t size) { out_.reserve(out_.size() + size); }
+};
+
+// Image returned by a tool, the data is base64 encoded only while the reply is sent
 class ImageContent {
 private:
-    std::string encoded_data_;
     std::string mime_type_;
+    std::string data_;
 
-    static std::string Base64Encode(const std::string& data) {
-        size_t dlen = 0, olen = 0;
-        mbedtls_base64_encode((unsigned char*)nullptr, 0, &dlen, (const unsigned char*)data.data(), data.size());
-        std::string result(dlen, 0);
-        mbedtls_base64_encode((unsigned char*)result.data(), result.size(), &olen, (const unsigned char*)data.data(), data.size());
-        return result;
-    }
+public:
+    ImageContent(const std::string& mime_type, std::string data)
+        : mime_type_(mime_type), data_(std::move(data)) {}
+
+    inline const std::string& mime_type() const { return mime_type_; }
+    inline std::string& data() { return data_; }
+};
+
+// A reply payload, with optional binary data that goes base64 encoded into it at blob_offset
+struct McpReply {
+    std::string json;
+    std::string blob;
+    size_t blob_offset = 0;
+};
+
+// Blocking tools run in the tool workers instead of the main task
+#define MCP_TOOL_DEFAULT_TIMEOUT_MS 30000
+// Argument lists kept per tool for reuse, more concurrent calls copy the property list
+#define MCP_TOOL_SPARE_ARGUMENTS 2
+
+// Bucket i of the duration histograms counts durations below 100 us * 4^i
+#define MCP_STATS_BUCKETS 10
+// The buckets are halved when this many calls are counted, so old calls fade out
+#define MCP_STATS_WINDOW 64
+
+class McpDurationHistogram {
+private:
+    uint32_t buckets_[MCP_STATS_BUCKETS] = {};
+    uint32_t count_ = 0;
+    int64_t total_us_ = 0;
+    int64_t max_us_ = 0;
 
 public:
-    ImageContent(const std::string& mime_type, const std::string& data) {
-        mime_type_ = mime_type;
-        // base64 encode data
-        encoded_data_ = Base64Encode(data);
-    }
+    void Add(int64_t duration_us);
+    // Upper bound of the bucket holding the percentile
+    int64_t Percentile(int percent) const;
+    inline int64_t average_us() const { return count_ > 0 ? total_us_ / count_ : 0; }
+    inline int64_t max_us() const { return max_us_; }
+    cJSON* ToJson() const;
+};
 
-    std::string to_json() const {
-        cJSON *json = cJSON_CreateObject();
-        cJSON_AddStringToObject(json, "type", "image");
-        cJSON_AddStringToObject(json, "mimeType", mime_type_.c_str());
-        cJSON_AddStringToObject(json, "data", encoded_data_.c_str());
-        char* json_str = cJSON_PrintUnformatted(json);
-        std::string result(json_str);
-        cJSON_free(json_str);
-        cJSON_Delete(json);
-        return result;
-    }
+struct McpToolStats {
+    uint32_t calls = 0;
+    uint32_t errors = 0;
+    McpDurationHistogram parse;       // Arguments validation
+    McpDurationHistogram exec;        // Tool callback
+    McpDurationHistogram serialize;   // Writing the result into the reply
 };
 
 // 添加类型别名
@@ -120,6 +215,11 @@ public:
         value_ = value;
     }
 
+    // Restore the default value of the schema property this one was copied from
+    inline void reset_value(const Property& schema) {
+        value_ = schema.value_;
+    }
+
     std::string to_json() const {
         cJSON *json = cJSON_CreateObject();
         
@@ -177,6 +277,9 @@ public:
 
     auto begin() { return properties_.begin(); }
     auto end() { return properties_.end(); }
+    inline size_t size() const { return properties_.size(); }
+    inline Property& at(size_t index) { return properties_[index]; }
+    inline const Property& at(size_t index) const { return properties_[index]; }
 
     std::vector<std::string> GetRequired() const {
         std::vector<std::string> required;
@@ -205,13 +308,41 @@ public:
     }
 };
 
+// Argument checks of a tool, compiled once from its PropertyList when the tool is created
+class McpArgumentValidator {
+private:
+    struct Slot {
+        uint8_t name_length;
+        PropertyType type;
+        bool required;
+        bool has_range;
+        int min_value;
+        int max_value;
+    };
+    std::vector<Slot> slots_;
+    uint64_t required_mask_ = 0;
+
+public:
+    explicit McpArgumentValidator(const PropertyList& properties);
+
+    // Decode the arguments into arguments_out, an argument list of the tool, in one pass over the JSON object.
+    // Returns false with the error message instead of throwing if they are invalid.
+    bool Parse(const cJSON* arguments, PropertyList& arguments_out, std::string& error) const;
+};
+
 class McpTool {
 private:
     std::string name_;
     std::string description_;
     PropertyList properties_;
+    McpArgumentValidator validator_;
     std::function<ReturnValue(const PropertyList&)> callback_;
     bool user_only_ = false;
+    bool blocking_ = false;
+    int timeout_ms_ = 0;
+    McpToolStats stats_;
+    std::mutex spare_arguments_mutex_;
+    std::vector<PropertyList> spare_arguments_;
 
 public:
     McpTool(const std::string& name, 
@@ -221,13 +352,41 @@ public:
         : name_(name), 
         description_(description), 
         properties_(properties), 
+        validator_(properties),
         callback_(callback) {}
 
     void set_user_only(bool user_only) { user_only_ = user_only; }
+    void set_blocking(bool blocking, int timeout_ms) { blocking_ = blocking; timeout_ms_ = timeout_ms; }
     inline const std::string& name() const { return name_; }
     inline const std::string& description() const { return description_; }
     inline const PropertyList& properties() const { return properties_; }
+    inline const McpArgumentValidator& validator() const { return validator_; }
     inline bool user_only() const { return user_only_; }
+    inline bool blocking() const { return blocking_; }
+    inline int timeout_ms() const { return timeout_ms_; }
+    // Guarded by the stats mutex of McpServer
+    inline McpToolStats& stats() { return stats_; }
+
+    // Take an argument list holding the default values, a finished call's list is reused instead of copying the properties
+    PropertyList AcquireArguments() {
+        std::lock_guard<std::mutex> lock(spare_arguments_mutex_);
+        if (spare_arguments_.empty()) {
+            return properties_;
+        }
+        PropertyList arguments = std::move(spare_arguments_.back());
+        spare_arguments_.pop_back();
+        for (size_t i = 0; i < arguments.size(); i++) {
+            arguments.at(i).reset_value(properties_.at(i));
+        }
+        return arguments;
+    }
+
+    void ReleaseArguments(PropertyList&& arguments) {
+        std::lock_guard<std::mutex> lock(spare_arguments_mutex_);
+        if (arguments.size() == properties_.size() && spare_arguments_.size() < MCP_TOOL_SPARE_ARGUMENTS) {
+            spare_arguments_.push_back(std::move(arguments));
+        }
+    }
 
     std::string to_json() const {
         std::vector<std::string> required = properties_.GetRequired();
@@ -269,48 +428,67 @@ public:
         return result;
     }
 
-    std::string Call(const PropertyList& properties) {
-        ReturnValue return_value = callback_(properties);
-        // 返回结果
-        cJSON* result = cJSON_CreateObject();
-        cJSON* content = cJSON_CreateArray();
+    inline ReturnValue Execute(const PropertyList& properties) {
+        return callback_(properties);
+    }
 
+    // Write the result object into the reply, image data is moved into the reply blob instead of being encoded here
+    static void WriteResult(ReturnValue& return_value, McpReply& reply) {
+        JsonWriter writer(reply.json);
+        writer.StartObject().Key("content").StartArray().StartObject();
         if (std::holds_alternative<ImageContent*>(return_value)) {
-            auto image_content = std::get<ImageContent*>(return_value);
-            cJSON* image = cJSON_CreateObject();
-            cJSON_AddStringToObject(image, "type", "image");
-            cJSON_AddStringToObject(image, "image", image_content->to_json().c_str());
-            cJSON_AddItemToArray(content, image);
-            delete image_content;
+            std::unique_ptr<ImageContent> image_content(std::get<ImageContent*>(return_value));
+            writer.Key("type").String("image").Key("mimeType").String(image_content->mime_type());
+            writer.Key("data");
+            reply.blob_offset = writer.StringPlaceholder();
+            reply.blob = std::move(image_content->data());
         } else {
-            cJSON* text = cJSON_CreateObject();
-            cJSON_AddStringToObject(text, "type", "text");
+            writer.Key("type").String("text").Key("text");
             if (std::holds_alternative<std::string>(return_value)) {
-                cJSON_AddStringToObject(text, "text", std::get<std::string>(return_value).c_str());
+                auto& text = std::get<std::string>(return_value);
+                writer.Reserve(text.size() + 32);
+                writer.String(text);
             } else if (std::holds_alternative<bool>(return_value)) {
-                cJSON_AddStringToObject(text, "text", std::get<bool>(return_value) ? "true" : "false");
+                writer.String(std::get<bool>(return_value) ? "true" : "false");
             } else if (std::holds_alternative<int>(return_value)) {
-                cJSON_AddStringToObject(text, "text", std::to_string(std::get<int>(return_value)).c_str());
+                writer.String(std::to_string(std::get<int>(return_value)));
             } else if (std::holds_alternative<cJSON*>(return_value)) {
                 cJSON* json = std::get<cJSON*>(return_value);
                 char* json_str = cJSON_PrintUnformatted(json);
-                cJSON_AddStringToObject(text, "text", json_str);
-                cJSON_free(json_str);
                 cJSON_Delete(json);
+                std::string_view text(json_str != nullptr ? json_str : "");
+                writer.Reserve(text.size() + 32);
+                writer.String(text);
+                cJSON_free(json_str);
             }
-            cJSON_AddItemToArray(content, text);
         }
-        cJSON_AddItemToObject(result, "content", content);
-        cJSON_AddBoolToObject(result, "isError", false);
+        writer.EndObject().EndArray();
+        writer.Key("isError").Bool(false).EndObject();
+    }
+};
 
-        auto json_str = cJSON_PrintUnformatted(result);
-        std::string result_str(json_str);
-        cJSON_free(json_str);
-        cJSON_Delete(result);
-        return result_str;
+// A tools/call running or waiting in the tool workers
+struct McpToolJob {
+    int id;
+    McpTool* tool = nullptr;
+    PropertyList arguments;
+    int64_t enqueue_time_us;
+    int64_t deadline_us;
+    std::atomic<bool> finished = false;   // Set by whoever replies first: the worker, the timeout or the cancellation
+
+    ~McpToolJob() {
+        if (tool != nullptr) {
+            tool->ReleaseArguments(std::move(arguments));
+        }
     }
 };
 
+// A page of the tools/list reply, tools in [begin, end) of the tools list
+struct McpToolsListPage {
+    size_t begin;
+    size_t end;
+};
+
 class McpServer {
 public:
     static McpServer& GetInstance() {
@@ -323,6 +501,12 @@ public:
     void AddTool(McpTool* tool);
     void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
     void AddUserOnlyTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
+    // Run the tool in the tool workers, so it does not stall the main task
+    void SetToolBlocking(const std::string& name, int timeout_ms = MCP_TOOL_DEFAULT_TIMEOUT_MS);
+    cJSON* GetToolStatsJson();
+    void PrintToolStats();
+    // Hash of the tool schemas, it changes whenever the tools list changes
+    std::string GetToolsHash();
     void ParseMessage(const cJSON* json);
     void ParseMessage(const std::string& message);
 
@@ -332,13 +516,52 @@ private:
 
     void ParseCapabilities(const cJSON* capabilities);
 
-    void ReplyResult(int id, const std::string& result);
-    void ReplyError(int id, const std::string& message);
-
-    void GetToolsList(int id, const std::string& cursor, bool list_user_only_tools);
-    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments);
-
+    // Replies go into batch when it is not null, otherwise they are sent at once
+    void HandleMessage(const cJSON* json, std::string* batch);
+    void HandleBatch(const cJSON* json);
+    void SendReply(std::string&& payload, std::string* batch);
+    void SendReply(McpReply&& reply, std::string* batch);
+    std::string BuildResultReply(int id, std::string_view result);
+    std::string BuildErrorReply(int id, std::string_view message);
+    McpReply BuildToolReply(int id, McpTool* tool, const PropertyList& arguments);
+    void ReplyResult(int id, std::string_view result, std::string* batch = nullptr);
+    void ReplyError(int id, std::string_view message, std::string* batch = nullptr);
+
+    void GetToolsList(int id, const std::string& cursor, bool list_user_only_tools, const std::string& if_none_match, std::string* batch);
+    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, std::string* batch);
+    void CallToolInMainTask(int id, McpTool* tool, const PropertyList& arguments, std::string* batch);
+    void RecordToolParse(McpTool* tool, int64_t parse_us, bool failed);
+    void RecordToolExec(McpTool* tool, int64_t exec_us, int64_t serialize_us, bool failed);
+    void RecordToolError(McpTool* tool);
+    // Called with tools_mutex_ held
+    void BuildToolsCache();
+    void StartToolJob(int id, McpTool* tool, PropertyList&& arguments);
+    void CancelToolJob(int id);
+    void CheckToolTimeouts();
+    void ToolWorkerTask();
+
+    // Guards the tools and their cache, tools are added by the boards while the protocol may be listing them
+    std::mutex tools_mutex_;
     std::vector<McpTool*> tools_;
+    std::unordered_map<std::string, McpTool*> tool_index_;
+
+    // Tool schemas serialized back to back, with the page boundaries for the tools/list payload limit.
+    // Rebuilt on the first tools/list after the tools are changed.
+    bool tools_cache_dirty_ = true;
+    std::string tools_json_;
+    std::vector<std::pair<size_t, size_t>> tool_json_ranges_;  // Offset and length in tools_json_
+    std::vector<McpToolsListPage> tools_list_pages_[2];        // Without / with user only tools
+    std::string tools_hash_;
+
+    // Tool workers for blocking tools
+    std::mutex tool_jobs_mutex_;
+    std::condition_variable tool_jobs_cv_;
+    std::deque<std::shared_ptr<McpToolJob>> pending_tool_jobs_;
+    std::vector<std::shared_ptr<McpToolJob>> running_tool_jobs_;
+    int tool_workers_ = 0;
+    esp_timer_handle_t tool_timeout_timer_ = nullptr;
+
+    std::mutex tool_stats_mutex_;
 };
 
 #endif // MCP_SERVER_H
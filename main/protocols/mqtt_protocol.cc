@@ -2,6 +2,9 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "event_trace.h"
+#include "heap_monitor.h"
+#include "mcp_server.h"
 
 #include <esp_log.h>
 #include <cstring>
@@ -98,6 +101,7 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     });
 
     mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
+        RecordIncoming(payload.size());
         cJSON* root = cJSON_Parse(payload.c_str());
         if (root == nullptr) {
             ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
@@ -112,6 +116,8 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
 
         if (strcmp(type->valuestring, "hello") == 0) {
             ParseServerHello(root);
+        } else if (strcmp(type->valuestring, "pong") == 0) {
+            ParsePong(root);
         } else if (strcmp(type->valuestring, "goodbye") == 0) {
             auto session_id = cJSON_GetObjectItem(root, "session_id");
             ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
@@ -141,13 +147,16 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     } else {
         broker_address = endpoint;
     }
+    auto connect_start_time = esp_timer_get_time();
     if (!mqtt_->Connect(broker_address, broker_port, client_id, username, password)) {
         ESP_LOGE(TAG, "Failed to connect to endpoint, code=%d", mqtt_->GetLastError());
         SetError(Lang::Strings::SERVER_NOT_CONNECTED);
         return false;
     }
 
-    ESP_LOGI(TAG, "Connected to endpoint");
+    int connect_ms = (int)((esp_timer_get_time() - connect_start_time) / 1000);
+    ESP_LOGI(TAG, "Connected to endpoint in %d ms", connect_ms);
+    RecordConnect(connect_ms, false);
     return true;
 }
 
@@ -157,9 +166,11 @@ bool MqttProtocol::SendText(const std::string& text) {
     }
     if (!mqtt_->Publish(publish_topic_, text)) {
         ESP_LOGE(TAG, "Failed to publish message: %s", text.c_str());
+        RecordOutgoing(text.size(), false);
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
     }
+    RecordOutgoing(text.size(), true);
     return true;
 }
 
@@ -168,6 +179,7 @@ bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
     if (udp_ == nullptr) {
         return false;
     }
+    TRACE_SCOPE("protocol.send_audio", packet->payload.size());
 
     std::string nonce(aes_nonce_);
     *(uint16_t*)&nonce[2] = htons(packet->payload.size());
@@ -186,10 +198,13 @@ bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         return false;
     }
 
-    return udp_->Send(encrypted) > 0;
+    bool success = udp_->Send(encrypted) > 0;
+    RecordOutgoing(encrypted.size(), success);
+    return success;
 }
 
 void MqttProtocol::CloseAudioChannel(bool send_goodbye) {
+    HeapTagScope heap_scope(kHeapTagProtocol);
     {
         std::lock_guard<std::mutex> lock(channel_mutex_);
         udp_.reset();
@@ -212,18 +227,34 @@ void MqttProtocol::CloseAudioChannel(bool send_goodbye) {
     }
 }
 
+bool MqttProtocol::ReopenAudioChannel() {
+    // The MQTT and UDP clients are bound to the previous network interface, create them again
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        udp_.reset();
+    }
+    if (!StartMqttClient(true)) {
+        return false;
+    }
+    return OpenAudioChannel();
+}
+
 bool MqttProtocol::OpenAudioChannel() {
+    HeapTagScope heap_scope(kHeapTagProtocol);
     if (mqtt_ == nullptr || !mqtt_->IsConnected()) {
         ESP_LOGI(TAG, "MQTT is not connected, try to connect now");
         if (!StartMqttClient(true)) {
             return false;
         }
+    } else {
+        RecordConnect(0, true);
     }
 
     error_occurred_ = false;
     session_id_ = "";
     xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 
+    auto hello_start_time = esp_timer_get_time();
     auto message = GetHelloMessage();
     if (!SendText(message)) {
         return false;
@@ -236,6 +267,9 @@ bool MqttProtocol::OpenAudioChannel() {
         SetError(Lang::Strings::SERVER_TIMEOUT);
         return false;
     }
+    int hello_ms = (int)((esp_timer_get_time() - hello_start_time) / 1000);
+    ESP_LOGI(TAG, "Server hello received in %d ms", hello_ms);
+    RecordHello(hello_ms);
 
     std::lock_guard<std::mutex> lock(channel_mutex_);
     auto network = Board::GetInstance().GetNetwork();
@@ -254,6 +288,7 @@ bool MqttProtocol::OpenAudioChannel() {
             ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
             return;
         }
+        RecordIncomingAudio(data.size(), server_frame_duration_);
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
         if (sequence < remote_sequence_) {
@@ -305,12 +340,18 @@ std::string MqttProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    // Taken for every hello, the tools may have changed since the last one. The server can skip tools/list if it knows the hash
+    auto mcp_tools_hash = McpServer::GetInstance().GetToolsHash();
+    if (!mcp_tools_hash.empty()) {
+        cJSON_AddStringToObject(features, "mcp_tools_hash", mcp_tools_hash.c_str());
+    }
+    cJSON_AddBoolToObject(features, "ping", true);
     cJSON_AddItemToObject(root, "features", features);
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", frame_duration_);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -332,7 +373,12 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
+    auto features = cJSON_GetObjectItem(root, "features");
+    auto ping = cJSON_GetObjectItem(features, "ping");
+    ping_supported_ = cJSON_IsTrue(ping);
+
     // Get sample rate from hello message
+    uplink_frame_duration_ = frame_duration_;
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
@@ -343,6 +389,10 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        auto uplink_frame_duration = cJSON_GetObjectItem(audio_params, "uplink_frame_duration");
+        if (cJSON_IsNumber(uplink_frame_duration)) {
+            uplink_frame_duration_ = uplink_frame_duration->valueint;
+        }
     }
 
     auto udp = cJSON_GetObjectItem(root, "udp");
@@ -32,6 +32,7 @@ public:
     bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel(bool send_goodbye = true) override;
+    bool ReopenAudioChannel() override;
     bool IsAudioChannelOpened() const override;
 
 private:
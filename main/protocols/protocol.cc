@@ -1,6 +1,10 @@
 #include "protocol.h"
+#include "event_trace.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <mbedtls/base64.h>
+#include <cstdlib>
 
 #define TAG "Protocol"
 
@@ -74,7 +78,35 @@ void Protocol::SendStopListening() {
 }
 
 void Protocol::SendMcpMessage(const std::string& payload) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":" + payload + "}";
+    // Payloads can be large, copy them once into the outgoing message
+    std::string message;
+    message.reserve(payload.size() + session_id_.size() + 48);
+    message += "{\"session_id\":\"";
+    message += session_id_;
+    message += "\",\"type\":\"mcp\",\"payload\":";
+    message += payload;
+    message += '}';
+    SendText(message);
+}
+
+void Protocol::SendMcpMessage(const std::string& payload, const std::string& data, size_t data_offset) {
+    // Encode the data straight into the outgoing message, without a separate base64 copy
+    size_t encoded_size = 0;
+    mbedtls_base64_encode(nullptr, 0, &encoded_size, (const unsigned char*)data.data(), data.size());
+    std::string message;
+    message.reserve(payload.size() + encoded_size + session_id_.size() + 48);
+    message += "{\"session_id\":\"";
+    message += session_id_;
+    message += "\",\"type\":\"mcp\",\"payload\":";
+    message.append(payload, 0, data_offset);
+    size_t offset = message.size();
+    message.resize(offset + encoded_size);
+    size_t written = 0;
+    mbedtls_base64_encode((unsigned char*)message.data() + offset, encoded_size, &written,
+        (const unsigned char*)data.data(), data.size());
+    message.resize(offset + written);
+    message.append(payload, data_offset, std::string::npos);
+    message += '}';
     SendText(message);
 }
 
@@ -88,3 +120,103 @@ bool Protocol::IsTimeout() const {
     }
     return timeout;
 }
+
+bool Protocol::SendPing() {
+    if (!ping_supported_) {
+        return false;
+    }
+    uint32_t timestamp = (uint32_t)(esp_timer_get_time() / 1000);
+    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"ping\",\"timestamp\":" + std::to_string(timestamp) + "}";
+    if (!SendText(message)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(statistics_mutex_);
+    statistics_.pings_sent++;
+    return true;
+}
+
+void Protocol::ParsePong(const cJSON* root) {
+    auto timestamp = cJSON_GetObjectItem(root, "timestamp");
+    if (!cJSON_IsNumber(timestamp)) {
+        ESP_LOGW(TAG, "Pong without timestamp");
+        return;
+    }
+    uint32_t now = (uint32_t)(esp_timer_get_time() / 1000);
+    int rtt = (int)(now - (uint32_t)timestamp->valuedouble);
+    if (rtt < 0) {
+        return;
+    }
+
+    // Smoothed RTT and mean deviation as in RFC 6298
+    std::lock_guard<std::mutex> lock(statistics_mutex_);
+    statistics_.pongs_received++;
+    auto packet_loss = cJSON_GetObjectItem(root, "packet_loss");
+    if (cJSON_IsNumber(packet_loss)) {
+        statistics_.server_packet_loss = packet_loss->valueint;
+    }
+    if (statistics_.rtt_ms < 0) {
+        statistics_.rtt_ms = rtt;
+        statistics_.rtt_variance_ms = rtt / 2;
+    } else {
+        statistics_.rtt_variance_ms = (3 * statistics_.rtt_variance_ms + std::abs(statistics_.rtt_ms - rtt)) / 4;
+        statistics_.rtt_ms = (7 * statistics_.rtt_ms + rtt) / 8;
+    }
+}
+
+void Protocol::RecordOutgoing(size_t bytes, bool success) {
+    TRACE_INSTANT(success ? "protocol.send" : "protocol.send_failed", bytes);
+    std::lock_guard<std::mutex> lock(statistics_mutex_);
+    if (success) {
+        statistics_.tx_packets++;
+        statistics_.tx_bytes += bytes;
+    } else {
+        statistics_.tx_failures++;
+    }
+}
+
+void Protocol::RecordIncoming(size_t bytes) {
+    TRACE_INSTANT("protocol.recv", bytes);
+    std::lock_guard<std::mutex> lock(statistics_mutex_);
+    statistics_.rx_packets++;
+    statistics_.rx_bytes += bytes;
+}
+
+void Protocol::RecordIncomingAudio(size_t bytes, int frame_duration) {
+    TRACE_INSTANT("protocol.recv_audio", bytes);
+    int64_t now = esp_timer_get_time();
+    std::lock_guard<std::mutex> lock(statistics_mutex_);
+    statistics_.rx_packets++;
+    statistics_.rx_bytes += bytes;
+
+    // Interarrival jitter as in RFC 3550, the nominal interval is one frame.
+    // Gaps longer than a second are pauses between sentences, not jitter.
+    if (last_audio_arrival_us_ > 0) {
+        int64_t interval_us = now - last_audio_arrival_us_;
+        if (interval_us < 1000000) {
+            float deviation = std::abs(interval_us / 1000.0f - frame_duration);
+            jitter_ms_ += (deviation - jitter_ms_) / 16.0f;
+            statistics_.jitter_ms = (int)jitter_ms_;
+        }
+    }
+    last_audio_arrival_us_ = now;
+}
+
+void Protocol::RecordConnect(int connect_ms, bool reused) {
+    std::lock_guard<std::mutex> lock(statistics_mutex_);
+    if (reused) {
+        statistics_.connections_reused++;
+    } else {
+        statistics_.connections++;
+        statistics_.connect_ms = connect_ms;
+    }
+}
+
+void Protocol::RecordHello(int hello_ms) {
+    std::lock_guard<std::mutex> lock(statistics_mutex_);
+    statistics_.hello_ms = hello_ms;
+}
+
+ProtocolStatistics Protocol::GetStatistics() const {
+    std::lock_guard<std::mutex> lock(statistics_mutex_);
+    return statistics_;
+}
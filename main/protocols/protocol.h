@@ -6,12 +6,15 @@
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <mutex>
 
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
     std::vector<uint8_t> payload;
+    int64_t capture_time_us = 0;    // Local capture time of the first sample, 0 if unknown
+    int64_t playback_position_ms = 0;   // End of the packet in the playback stream, set when it is queued for decoding
 };
 
 struct BinaryProtocol2 {
@@ -30,6 +33,24 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+struct ProtocolStatistics {
+    uint32_t tx_packets = 0;
+    uint32_t tx_bytes = 0;
+    uint32_t tx_failures = 0;
+    uint32_t rx_packets = 0;
+    uint32_t rx_bytes = 0;
+    uint32_t pings_sent = 0;
+    uint32_t pongs_received = 0;
+    int rtt_ms = -1;            // Smoothed round trip time, -1 if no sample yet
+    int rtt_variance_ms = 0;    // Mean deviation of the round trip time
+    int jitter_ms = 0;          // Interarrival jitter of the incoming audio packets
+    uint32_t connections = 0;   // Connections established to the server
+    uint32_t connections_reused = 0;
+    int connect_ms = -1;        // Time of the last connection setup (TCP, TLS and upgrade)
+    int hello_ms = -1;          // Time from sending hello to receiving the server hello
+    int server_packet_loss = -1; // Uplink packet loss percentage reported in pong, -1 if unknown
+};
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -51,9 +72,24 @@ public:
     inline int server_frame_duration() const {
         return server_frame_duration_;
     }
+    // Uplink frame duration accepted by the server, the proposed one unless the hello names another
+    inline int uplink_frame_duration() const {
+        return uplink_frame_duration_;
+    }
     inline const std::string& session_id() const {
         return session_id_;
     }
+    inline bool ping_supported() const {
+        return ping_supported_;
+    }
+    // Uplink frame duration proposed in the hello
+    inline int frame_duration() const {
+        return frame_duration_;
+    }
+    inline void SetFrameDuration(int frame_duration) {
+        frame_duration_ = frame_duration;
+    }
+    ProtocolStatistics GetStatistics() const;
 
     void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
@@ -66,6 +102,8 @@ public:
     virtual bool Start() = 0;
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel(bool send_goodbye = true) = 0;
+    // Open the audio channel again over the current network interface, without reporting it as closed
+    virtual bool ReopenAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
     virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
     virtual void SendWakeWordDetected(const std::string& wake_word);
@@ -73,6 +111,9 @@ public:
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
     virtual void SendMcpMessage(const std::string& message);
+    // Send a MCP payload with binary data base64 encoded into it at data_offset
+    virtual void SendMcpMessage(const std::string& message, const std::string& data, size_t data_offset);
+    virtual bool SendPing();
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
@@ -85,13 +126,29 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int frame_duration_ = 60;
+    int uplink_frame_duration_ = 60;
     bool error_occurred_ = false;
+    bool ping_supported_ = false;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
 
     virtual bool SendText(const std::string& text) = 0;
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
+
+    void RecordOutgoing(size_t bytes, bool success);
+    void RecordIncoming(size_t bytes);
+    void RecordIncomingAudio(size_t bytes, int frame_duration);
+    void RecordConnect(int connect_ms, bool reused);
+    void RecordHello(int hello_ms);
+    void ParsePong(const cJSON* root);
+
+private:
+    mutable std::mutex statistics_mutex_;
+    ProtocolStatistics statistics_;
+    int64_t last_audio_arrival_us_ = 0;
+    float jitter_ms_ = 0;
 };
 
 #endif // PROTOCOL_H
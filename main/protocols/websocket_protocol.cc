@@ -3,10 +3,16 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "event_trace.h"
+#include "heap_monitor.h"
+#include "mcp_server.h"
 
 #include <cstring>
+#include <algorithm>
 #include <cJSON.h>
 #include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <mbedtls/base64.h>
 #include <arpa/inet.h>
 #include "assets/lang_config.h"
 
@@ -14,9 +20,33 @@
 
 WebsocketProtocol::WebsocketProtocol() {
     event_group_handle_ = xEventGroupCreate();
+
+    esp_timer_create_args_t idle_timer_args = {
+        .callback = [](void* arg) {
+            WebsocketProtocol* protocol = (WebsocketProtocol*)arg;
+            auto alive = protocol->alive_;  // Capture alive flag
+            Application::GetInstance().Schedule([protocol, alive]() {
+                if (*alive && protocol->idle_) {
+                    ESP_LOGI(TAG, "Closing idle websocket connection");
+                    protocol->websocket_.reset();
+                    protocol->idle_ = false;
+                }
+            });
+        },
+        .arg = this,
+    };
+    esp_timer_create(&idle_timer_args, &idle_timer_);
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
+    // Mark as dead first to prevent any pending scheduled tasks from executing
+    *alive_ = false;
+
+    if (idle_timer_ != nullptr) {
+        esp_timer_stop(idle_timer_);
+        esp_timer_delete(idle_timer_);
+    }
+    websocket_.reset();
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -29,7 +59,10 @@ bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
+    TRACE_SCOPE("protocol.send_audio", packet->payload.size());
 
+    bool success = false;
+    size_t size = 0;
     if (version_ == 2) {
         std::string serialized;
         serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
@@ -41,7 +74,8 @@ bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         bp2->payload_size = htonl(packet->payload.size());
         memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        size = serialized.size();
+        success = websocket_->Send(serialized.data(), serialized.size(), true);
     } else if (version_ == 3) {
         std::string serialized;
         serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
@@ -51,10 +85,14 @@ bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         bp3->payload_size = htons(packet->payload.size());
         memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        size = serialized.size();
+        success = websocket_->Send(serialized.data(), serialized.size(), true);
     } else {
-        return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
+        size = packet->payload.size();
+        success = websocket_->Send(packet->payload.data(), packet->payload.size(), true);
     }
+    RecordOutgoing(size, success);
+    return success;
 }
 
 bool WebsocketProtocol::SendText(const std::string& text) {
@@ -64,23 +102,95 @@ bool WebsocketProtocol::SendText(const std::string& text) {
 
     if (!websocket_->Send(text)) {
         ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
+        RecordOutgoing(text.size(), false);
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
     }
 
+    RecordOutgoing(text.size(), true);
     return true;
 }
 
+void WebsocketProtocol::SendMcpMessage(const std::string& payload, const std::string& data, size_t data_offset) {
+    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+        return;
+    }
+
+    // One text message in several frames, only one chunk of the data is encoded at a time.
+    // All text and audio are sent from the main task, so no other frame can come in between.
+    auto start_time = esp_timer_get_time();
+    size_t free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    std::string head = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":";
+    head.append(payload, 0, data_offset);
+    bool success = websocket_->Send(head.data(), head.size(), false, false);
+    size_t sent = head.size();
+    int frames = 1;
+
+    std::string chunk(WEBSOCKET_MCP_DATA_CHUNK_SIZE / 3 * 4 + 1, 0);
+    for (size_t offset = 0; success && offset < data.size(); offset += WEBSOCKET_MCP_DATA_CHUNK_SIZE) {
+        size_t size = std::min((size_t)WEBSOCKET_MCP_DATA_CHUNK_SIZE, data.size() - offset);
+        size_t encoded_size = 0;
+        mbedtls_base64_encode((unsigned char*)chunk.data(), chunk.size(), &encoded_size,
+            (const unsigned char*)data.data() + offset, size);
+        success = websocket_->Send(chunk.data(), encoded_size, false, false);
+        sent += encoded_size;
+        frames++;
+    }
+    int held = (int)free_heap - (int)heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+    if (success) {
+        std::string tail = payload.substr(data_offset) + "}";
+        success = websocket_->Send(tail.data(), tail.size(), false, true);
+        sent += tail.size();
+        frames++;
+    }
+    RecordOutgoing(sent, success);
+    if (!success) {
+        ESP_LOGE(TAG, "Failed to send MCP message with %u bytes of data", data.size());
+        SetError(Lang::Strings::SERVER_ERROR);
+        return;
+    }
+    ESP_LOGI(TAG, "Sent MCP message: %u bytes in %d frames, %d ms, %d bytes of heap held", sent, frames,
+        (int)((esp_timer_get_time() - start_time) / 1000), held);
+}
+
 bool WebsocketProtocol::IsAudioChannelOpened() const {
-    return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
+    return websocket_ != nullptr && websocket_->IsConnected() && !idle_ && !error_occurred_ && !IsTimeout();
 }
 
 void WebsocketProtocol::CloseAudioChannel(bool send_goodbye) {
-    (void)send_goodbye;  // Websocket doesn't need to send goodbye message
+    HeapTagScope heap_scope(kHeapTagProtocol);
+    if (idle_timeout_seconds_ <= 0 || websocket_ == nullptr || !websocket_->IsConnected() || error_occurred_) {
+        // Websocket doesn't need to send goodbye message, the server ends the session on disconnection
+        websocket_.reset();
+        return;
+    }
+
+    // Keep the connection for the next conversation, the server ends the session on goodbye
+    if (send_goodbye) {
+        SendText("{\"session_id\":\"" + session_id_ + "\",\"type\":\"goodbye\"}");
+    }
+    idle_ = true;
+    esp_timer_stop(idle_timer_);
+    esp_timer_start_once(idle_timer_, (uint64_t)idle_timeout_seconds_ * 1000000);
+    ESP_LOGI(TAG, "Keep websocket connection for %d seconds", idle_timeout_seconds_);
+
+    if (on_audio_channel_closed_ != nullptr) {
+        on_audio_channel_closed_();
+    }
+}
+
+bool WebsocketProtocol::ReopenAudioChannel() {
+    // Drop the connection of the previous network interface, the idle flag keeps OnDisconnected quiet
+    esp_timer_stop(idle_timer_);
+    idle_ = true;
     websocket_.reset();
+    idle_ = false;
+    return OpenAudioChannel();
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
+    HeapTagScope heap_scope(kHeapTagProtocol);
     Settings settings("websocket", false);
     std::string url = settings.GetString("url");
     std::string token = settings.GetString("token");
@@ -88,6 +198,22 @@ bool WebsocketProtocol::OpenAudioChannel() {
     if (version != 0) {
         version_ = version;
     }
+    idle_timeout_seconds_ = settings.GetInt("idle_timeout", 0);
+
+    // Reuse the connection kept from the last conversation, only the hello exchange is needed
+    if (idle_ && websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_) {
+        esp_timer_stop(idle_timer_);
+        idle_ = false;
+        ESP_LOGI(TAG, "Reusing websocket connection");
+        RecordConnect(0, true);
+        return SendHelloAndWait();
+    }
+    esp_timer_stop(idle_timer_);
+    if (idle_) {
+        // The kept connection is no longer usable
+        websocket_.reset();
+        idle_ = false;
+    }
 
     error_occurred_ = false;
 
@@ -111,6 +237,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
+            RecordIncomingAudio(len, server_frame_duration_);
             if (on_incoming_audio_ != nullptr) {
                 if (version_ == 2) {
                     BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
@@ -147,11 +274,14 @@ bool WebsocketProtocol::OpenAudioChannel() {
             }
         } else {
             // Parse JSON data
+            RecordIncoming(len);
             auto root = cJSON_ParseWithLength(data, len);
             auto type = cJSON_GetObjectItem(root, "type");
             if (cJSON_IsString(type)) {
                 if (strcmp(type->valuestring, "hello") == 0) {
                     ParseServerHello(root);
+                } else if (strcmp(type->valuestring, "pong") == 0) {
+                    ParsePong(root);
                 } else {
                     if (on_incoming_json_ != nullptr) {
                         on_incoming_json_(root);
@@ -167,19 +297,33 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     websocket_->OnDisconnected([this]() {
         ESP_LOGI(TAG, "Websocket disconnected");
+        if (idle_) {
+            // The conversation has already been closed
+            return;
+        }
         if (on_audio_channel_closed_ != nullptr) {
             on_audio_channel_closed_();
         }
     });
 
     ESP_LOGI(TAG, "Connecting to websocket server: %s with version: %d", url.c_str(), version_);
+    auto connect_start_time = esp_timer_get_time();
     if (!websocket_->Connect(url.c_str())) {
         ESP_LOGE(TAG, "Failed to connect to websocket server, code=%d", websocket_->GetLastError());
         SetError(Lang::Strings::SERVER_NOT_CONNECTED);
         return false;
     }
+    int connect_ms = (int)((esp_timer_get_time() - connect_start_time) / 1000);
+    ESP_LOGI(TAG, "Websocket connected in %d ms", connect_ms);
+    RecordConnect(connect_ms, false);
+
+    return SendHelloAndWait();
+}
 
+bool WebsocketProtocol::SendHelloAndWait() {
     // Send hello message to describe the client
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
+    auto hello_start_time = esp_timer_get_time();
     auto message = GetHelloMessage();
     if (!SendText(message)) {
         return false;
@@ -192,6 +336,9 @@ bool WebsocketProtocol::OpenAudioChannel() {
         SetError(Lang::Strings::SERVER_TIMEOUT);
         return false;
     }
+    int hello_ms = (int)((esp_timer_get_time() - hello_start_time) / 1000);
+    ESP_LOGI(TAG, "Server hello received in %d ms", hello_ms);
+    RecordHello(hello_ms);
 
     if (on_audio_channel_opened_ != nullptr) {
         on_audio_channel_opened_();
@@ -210,13 +357,19 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    // Taken for every hello, the tools may have changed since the last one. The server can skip tools/list if it knows the hash
+    auto mcp_tools_hash = McpServer::GetInstance().GetToolsHash();
+    if (!mcp_tools_hash.empty()) {
+        cJSON_AddStringToObject(features, "mcp_tools_hash", mcp_tools_hash.c_str());
+    }
+    cJSON_AddBoolToObject(features, "ping", true);
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
     cJSON_AddNumberToObject(audio_params, "channels", 1);
-    cJSON_AddNumberToObject(audio_params, "frame_duration", OPUS_FRAME_DURATION_MS);
+    cJSON_AddNumberToObject(audio_params, "frame_duration", frame_duration_);
     cJSON_AddItemToObject(root, "audio_params", audio_params);
     auto json_str = cJSON_PrintUnformatted(root);
     std::string message(json_str);
@@ -238,6 +391,11 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
+    auto features = cJSON_GetObjectItem(root, "features");
+    auto ping = cJSON_GetObjectItem(features, "ping");
+    ping_supported_ = cJSON_IsTrue(ping);
+
+    uplink_frame_duration_ = frame_duration_;
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
@@ -248,6 +406,10 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         if (cJSON_IsNumber(frame_duration)) {
             server_frame_duration_ = frame_duration->valueint;
         }
+        auto uplink_frame_duration = cJSON_GetObjectItem(audio_params, "uplink_frame_duration");
+        if (cJSON_IsNumber(uplink_frame_duration)) {
+            uplink_frame_duration_ = uplink_frame_duration->valueint;
+        }
     }
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
@@ -7,8 +7,14 @@
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <esp_timer.h>
+
+#include <memory>
+#include <atomic>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+// Binary data of MCP messages is base64 encoded and sent in frames of this size, must be a multiple of 3
+#define WEBSOCKET_MCP_DATA_CHUNK_SIZE 3072
 
 class WebsocketProtocol : public Protocol {
 public:
@@ -19,14 +25,26 @@ public:
     bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel(bool send_goodbye = true) override;
+    bool ReopenAudioChannel() override;
     bool IsAudioChannelOpened() const override;
+    using Protocol::SendMcpMessage;
+    void SendMcpMessage(const std::string& payload, const std::string& data, size_t data_offset) override;
 
 private:
+    // Alive flag for safe scheduled callbacks - set to false in destructor
+    std::shared_ptr<std::atomic<bool>> alive_ = std::make_shared<std::atomic<bool>>(true);
+
     EventGroupHandle_t event_group_handle_;
     std::unique_ptr<WebSocket> websocket_;
     int version_ = 1;
+    // Seconds to keep the connection after a conversation so the next one can reuse it, 0 to disable
+    int idle_timeout_seconds_ = 0;
+    // Written on the main task, read by the disconnect handler of the websocket task
+    std::atomic<bool> idle_ = false;
+    esp_timer_handle_t idle_timer_ = nullptr;
 
     void ParseServerHello(const cJSON* root);
+    bool SendHelloAndWait();
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
 };
@@ -0,0 +1,192 @@
+#include "subtitle_player.h"
+#include "application.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cctype>
+
+#define TAG "SubtitlePlayer"
+
+SubtitlePlayer::SubtitlePlayer(AudioService& audio_service, Display* display)
+    : audio_service_(audio_service), display_(display) {
+    esp_timer_create_args_t timer_args = {
+        .callback = [](void* arg) {
+            auto player = static_cast<SubtitlePlayer*>(arg);
+            // At most one update is pending when the main task is busy
+            if (!player->update_scheduled_.exchange(true)) {
+                Application::GetInstance().Schedule([player]() {
+                    player->update_scheduled_ = false;
+                    player->Update();
+                });
+            }
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "subtitle_player",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer_));
+}
+
+SubtitlePlayer::~SubtitlePlayer() {
+    if (timer_ != nullptr) {
+        esp_timer_stop(timer_);
+        esp_timer_delete(timer_);
+    }
+}
+
+void SubtitlePlayer::AddSentence(const std::string& text, int64_t start_ms) {
+    auto words = SplitWords(text);
+    if (words.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!sentences_.empty() && sentences_.back().end_ms < 0) {
+        sentences_.back().end_ms = start_ms;
+    }
+    sentences_.push_back({text, std::move(words), start_ms, -1, 0});
+    // The audio of the sentence may still be on its way
+    last_progress_time_us_ = esp_timer_get_time();
+    if (!esp_timer_is_active(timer_)) {
+        esp_timer_start_periodic(timer_, SUBTITLE_UPDATE_INTERVAL_MS * 1000);
+    }
+}
+
+void SubtitlePlayer::Finish(int64_t end_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!sentences_.empty() && sentences_.back().end_ms < 0) {
+        sentences_.back().end_ms = end_ms;
+    }
+}
+
+void SubtitlePlayer::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!sentences_.empty()) {
+        ESP_LOGI(TAG, "Drop %u sentences with their audio", (unsigned)sentences_.size());
+        sentences_.clear();
+    }
+    esp_timer_stop(timer_);
+}
+
+// Runs in the main task like Clear(), so a sentence dropped by Clear() is never shown afterwards
+void SubtitlePlayer::Update() {
+    int64_t played_ms = audio_service_.GetPlaybackPosition();
+    int64_t queued_ms = audio_service_.GetQueuedPosition();
+    int64_t now = esp_timer_get_time();
+    bool append_words = display_->SupportsAppendChatMessage();
+
+    // The texts to show are picked with the mutex held and shown after it is released, one update per sentence
+    // reached, so a sentence finished in this tick is completed before the next one starts
+    struct Reveal {
+        std::string content;
+        size_t shown_length;    // Bytes already shown, 0 starts a new message
+    };
+    std::vector<Reveal> reveals;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (played_ms != last_played_ms_) {
+            last_played_ms_ = played_ms;
+            last_progress_time_us_ = now;
+        }
+        bool idle = played_ms >= queued_ms && now - last_progress_time_us_ >= SUBTITLE_IDLE_TIMEOUT_MS * 1000;
+
+        while (!sentences_.empty()) {
+            auto& sentence = sentences_.front();
+            if (played_ms < sentence.start_ms) {
+                break;
+            }
+
+            size_t shown_words = sentence.shown_words;
+            if (!append_words || idle || (sentence.end_ms >= 0 && played_ms >= sentence.end_ms)) {
+                // Nothing more to wait for, or the display would set the whole text again for every word
+                shown_words = sentence.words.size();
+            } else {
+                // Until the end is known, the audio received so far is the best guess of the length of the sentence
+                int64_t end_ms = sentence.end_ms >= 0 ? sentence.end_ms : queued_ms;
+                int64_t duration_ms = std::max<int64_t>(end_ms - sentence.start_ms, 1);
+                int64_t spoken_chars = sentence.words.back().chars * (played_ms - sentence.start_ms) / duration_ms;
+                // Show the words whose audio has started
+                while (shown_words < sentence.words.size() &&
+                       (shown_words == 0 || sentence.words[shown_words - 1].chars <= spoken_chars)) {
+                    shown_words++;
+                }
+            }
+            if (shown_words > sentence.shown_words) {
+                size_t shown_length = sentence.shown_words > 0 ? sentence.words[sentence.shown_words - 1].end : 0;
+                reveals.push_back({sentence.text.substr(0, sentence.words[shown_words - 1].end), shown_length});
+                sentence.shown_words = shown_words;
+            }
+
+            if (sentence.shown_words < sentence.words.size()) {
+                break;
+            }
+            sentences_.pop_front();
+        }
+
+        if (sentences_.empty()) {
+            esp_timer_stop(timer_);
+        }
+    }
+
+    for (auto& reveal : reveals) {
+        if (reveal.shown_length > 0) {
+            display_->AppendChatMessage("assistant", reveal.content.c_str(), reveal.shown_length);
+        } else {
+            display_->SetChatMessage("assistant", reveal.content.c_str());
+        }
+    }
+}
+
+static uint32_t DecodeUtf8(const std::string& text, size_t& pos) {
+    uint8_t c = text[pos];
+    int length = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 1;
+    uint32_t code = length == 1 ? c : c & (0x7F >> length);
+    for (int i = 1; i < length && pos + i < text.size(); i++) {
+        code = (code << 6) | (text[pos + i] & 0x3F);
+    }
+    pos = std::min(pos + length, text.size());
+    return code;
+}
+
+static bool IsPunctuation(uint32_t c) {
+    return (c < 0x80 && ispunct(c)) || (c >= 0x2000 && c <= 0x206F) || (c >= 0x3000 && c <= 0x303F) ||
+        (c >= 0xFF01 && c <= 0xFF0F) || (c >= 0xFF1A && c <= 0xFF20);
+}
+
+// A word is a character of the scripts written without spaces (CJK, kana, emoji), or a run of letters.
+// The spaces and punctuation that follow are part of the word.
+std::vector<SubtitlePlayer::Word> SubtitlePlayer::SplitWords(const std::string& text) {
+    enum { kNone, kLetter, kWide, kSpace, kPunctuation } previous = kNone;
+    bool wide_word = false;
+    std::vector<Word> words;
+    size_t pos = 0;
+    int chars = 0;
+    while (pos < text.size()) {
+        size_t start = pos;
+        uint32_t c = DecodeUtf8(text, pos);
+        bool space = c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        bool punctuation = !space && IsPunctuation(c);
+        bool wide = !space && !punctuation && c >= 0x2E80;
+
+        bool new_word = false;
+        if (wide) {
+            new_word = previous != kNone;
+        } else if (!space && !punctuation) {
+            new_word = previous == kWide || previous == kSpace || (previous == kPunctuation && wide_word);
+        }
+        if (new_word) {
+            words.push_back({start, chars});
+        }
+        if (new_word || previous == kNone) {
+            wide_word = wide;
+        }
+
+        previous = wide ? kWide : space ? kSpace : punctuation ? kPunctuation : kLetter;
+        chars++;
+    }
+    if (chars > 0) {
+        words.push_back({text.size(), chars});
+    }
+    return words;
+}
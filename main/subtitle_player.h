@@ -0,0 +1,62 @@
+#ifndef SUBTITLE_PLAYER_H
+#define SUBTITLE_PLAYER_H
+
+#include <esp_timer.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+
+#include "audio_service.h"
+#include "display.h"
+
+// Period of the subtitle updates while a sentence is being revealed
+#define SUBTITLE_UPDATE_INTERVAL_MS 100
+// A sentence is shown in full when no audio has been played for this long, e.g. a reply without audio
+#define SUBTITLE_IDLE_TIMEOUT_MS 1000
+
+// Shows the sentences of the assistant word by word while their audio is played.
+// The text of a sentence arrives before its audio, up to MAX_DECODE_QUEUE_DURATION_MS of audio can be queued
+// ahead of it, so each sentence is timed against the playback position of the audio service.
+// The display is updated from the main task, the timer only schedules the updates.
+class SubtitlePlayer {
+public:
+    SubtitlePlayer(AudioService& audio_service, Display* display);
+    ~SubtitlePlayer();
+
+    // A sentence whose audio starts at start_ms in the playback stream
+    void AddSentence(const std::string& text, int64_t start_ms);
+    // The audio of the last sentence ends at end_ms, otherwise it ends where the next sentence starts
+    void Finish(int64_t end_ms);
+    // Drop the sentences not shown yet, called when the audio they belong to is dropped
+    void Clear();
+
+private:
+    struct Word {
+        size_t end;         // Byte offset in the text after the word
+        int chars;          // Characters from the start of the text to the end of the word
+    };
+    struct Sentence {
+        std::string text;
+        std::vector<Word> words;
+        int64_t start_ms;
+        int64_t end_ms;     // -1 until the next sentence or Finish()
+        size_t shown_words;
+    };
+
+    AudioService& audio_service_;
+    Display* display_;
+    esp_timer_handle_t timer_ = nullptr;
+    std::atomic<bool> update_scheduled_ = false;
+    std::mutex mutex_;
+    std::deque<Sentence> sentences_;
+    int64_t last_played_ms_ = -1;
+    int64_t last_progress_time_us_ = 0;    // When the playback position last moved
+
+    void Update();
+    static std::vector<Word> SplitWords(const std::string& text);
+};
+
+#endif // SUBTITLE_PLAYER_H
@@ -0,0 +1,124 @@
+/*
+ * Decode GIFs with the firmware's gifdec.c on the host and report the time per frame.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -I scripts/gif_benchmark/shim -I main/display/lvgl_display/gif scripts/gif_benchmark/gif_benchmark.c \
+ *       main/display/lvgl_display/gif/gifdec.c -o gif_benchmark
+ *
+ * Run on the emoji GIFs downloaded by the component manager:
+ *   ./gif_benchmark $(find managed_components/txp666__otto-emoji-gif-component -name '*.gif')
+ *
+ * The checksum covers every composed frame, it must not change when the decoder is optimized.
+ */
+
+#include "gifdec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static char * read_file(const char * path)
+{
+    FILE * fp = fopen(path, "rb");
+    if(fp == NULL) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char * data = malloc(size);
+    if(data != NULL && fread(data, 1, size, fp) != (size_t) size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    return data;
+}
+
+/* FNV-1a */
+static uint32_t checksum(uint32_t hash, const uint8_t * data, size_t size)
+{
+    for(size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* Decode and compose one loop of the animation, return the number of frames */
+static int decode_loop(gd_GIF * gif, uint32_t * hash)
+{
+    int frames = 0;
+    gd_rewind(gif);
+    /* Stop at the trailer instead of looping forever */
+    gif->loop_count = 1;
+    while(gd_get_frame(gif) == 1) {
+        gd_render_frame(gif, gif->canvas);
+        if(hash != NULL) {
+            *hash = checksum(*hash, gif->canvas, gif->width * gif->height * 4);
+        }
+        frames++;
+    }
+    return frames;
+}
+
+int main(int argc, char * argv[])
+{
+    int loops = 20;
+    int first = 1;
+    if(argc > 2 && strcmp(argv[1], "-n") == 0) {
+        loops = atoi(argv[2]);
+        first = 3;
+    }
+    if(first >= argc || loops <= 0) {
+        fprintf(stderr, "Usage: %s [-n loops] file.gif...\n", argv[0]);
+        return 1;
+    }
+
+    double total_us = 0;
+    int total_frames = 0;
+    printf("%-40s %9s %6s %10s %10s %10s\n", "file", "size", "frames", "us/frame", "ms/loop", "checksum");
+    for(int i = first; i < argc; i++) {
+        char * data = read_file(argv[i]);
+        if(data == NULL) {
+            fprintf(stderr, "Failed to read %s\n", argv[i]);
+            continue;
+        }
+        gd_GIF * gif = gd_open_gif_data(data);
+        if(gif == NULL) {
+            fprintf(stderr, "Failed to open %s\n", argv[i]);
+            free(data);
+            continue;
+        }
+
+        uint32_t hash = 2166136261u;
+        int frames = decode_loop(gif, &hash);
+        double start = now_us();
+        for(int loop = 0; loop < loops; loop++) {
+            decode_loop(gif, NULL);
+        }
+        double elapsed = now_us() - start;
+
+        const char * name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+        char size[16];
+        snprintf(size, sizeof(size), "%dx%d", gif->width, gif->height);
+        printf("%-40s %9s %6d %10.1f %10.2f   %08x\n", name, size, frames,
+               frames > 0 ? elapsed / loops / frames : 0, elapsed / loops / 1000, hash);
+        total_us += elapsed / loops;
+        total_frames += frames;
+
+        gd_close_gif(gif);
+        free(data);
+    }
+    if(total_frames > 0) {
+        printf("total: %d frames, %.1f us/frame\n", total_frames, total_us / total_frames);
+    }
+    return 0;
+}
@@ -0,0 +1,11 @@
+#ifndef GIF_BENCHMARK_ESP_LOG_H
+#define GIF_BENCHMARK_ESP_LOG_H
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) fprintf(stderr, "I %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) do {} while (0)
+
+#endif /* GIF_BENCHMARK_ESP_LOG_H */
@@ -0,0 +1,68 @@
+#ifndef GIF_BENCHMARK_LVGL_H
+#define GIF_BENCHMARK_LVGL_H
+
+/* The parts of LVGL used by gifdec.c, backed by stdio and malloc on the host */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LV_USE_DRAW_SW_ASM      0
+#define LV_DRAW_SW_ASM_HELIUM   2
+
+typedef enum {
+    LV_FS_RES_OK = 0,
+    LV_FS_RES_UNKNOWN,
+} lv_fs_res_t;
+
+typedef enum {
+    LV_FS_MODE_RD = 0x02,
+} lv_fs_mode_t;
+
+typedef enum {
+    LV_FS_SEEK_SET = 0,
+    LV_FS_SEEK_CUR = 1,
+    LV_FS_SEEK_END = 2,
+} lv_fs_whence_t;
+
+typedef struct {
+    FILE * fp;
+} lv_fs_file_t;
+
+static inline lv_fs_res_t lv_fs_open(lv_fs_file_t * file, const char * path, lv_fs_mode_t mode)
+{
+    (void) mode;
+    file->fp = fopen(path, "rb");
+    return file->fp ? LV_FS_RES_OK : LV_FS_RES_UNKNOWN;
+}
+
+static inline lv_fs_res_t lv_fs_read(lv_fs_file_t * file, void * buf, uint32_t btr, uint32_t * br)
+{
+    size_t n = fread(buf, 1, btr, file->fp);
+    if(br) *br = (uint32_t) n;
+    return LV_FS_RES_OK;
+}
+
+static inline lv_fs_res_t lv_fs_seek(lv_fs_file_t * file, uint32_t pos, lv_fs_whence_t whence)
+{
+    return fseek(file->fp, pos, whence) == 0 ? LV_FS_RES_OK : LV_FS_RES_UNKNOWN;
+}
+
+static inline lv_fs_res_t lv_fs_tell(lv_fs_file_t * file, uint32_t * pos)
+{
+    *pos = (uint32_t) ftell(file->fp);
+    return LV_FS_RES_OK;
+}
+
+static inline lv_fs_res_t lv_fs_close(lv_fs_file_t * file)
+{
+    fclose(file->fp);
+    return LV_FS_RES_OK;
+}
+
+#define lv_malloc   malloc
+#define lv_realloc  realloc
+#define lv_free     free
+
+#endif /* GIF_BENCHMARK_LVGL_H */
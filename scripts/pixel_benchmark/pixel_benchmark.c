@@ -0,0 +1,255 @@
+/*
+ * Check the pixel kernels of pixel_convert.c against plain per-pixel loops on the host
+ * and report their throughput.
+ *
+ * Build from the repository root:
+ *   gcc -O2 -I main/display/lvgl_display scripts/pixel_benchmark/pixel_benchmark.c \
+ *       main/display/lvgl_display/pixel_convert.c -o pixel_benchmark
+ *
+ * Run:
+ *   ./pixel_benchmark [-n loops]
+ *
+ * Add -fno-tree-vectorize to compare the kernels the way the ESP32 runs them: GCC auto-vectorizes the
+ * reference loops on a desktop CPU, which the Xtensa compiler does not do.
+ *
+ * Every kernel is checked with aligned and unaligned buffers and odd sizes before it is timed,
+ * the program exits with an error if any output differs from the reference.
+ */
+
+#include "pixel_convert.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WIDTH 320
+#define HEIGHT 240
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void fill_random(uint8_t * data, size_t size)
+{
+    for(size_t i = 0; i < size; i++) {
+        data[i] = rand();
+    }
+}
+
+/* The loops the kernels replaced */
+
+static void ref_swap16(uint16_t * dst, const uint16_t * src, size_t count)
+{
+    for(size_t i = 0; i < count; i++) {
+        dst[i] = __builtin_bswap16(src[i]);
+    }
+}
+
+static void ref_yuv422p_to_yuyv(uint8_t * dst, const uint8_t * src, int width, int height)
+{
+    const uint8_t * y_plane = src;
+    const uint8_t * u_plane = y_plane + width * height;
+    const uint8_t * v_plane = u_plane + (width / 2) * height;
+    for(int y = 0; y < height; y++) {
+        for(int x = 0; x < width / 2; x++) {
+            uint8_t * d = dst + (y * width + 2 * x) * 2;
+            d[0] = y_plane[y * width + 2 * x];
+            d[1] = u_plane[y * (width / 2) + x];
+            d[2] = y_plane[y * width + 2 * x + 1];
+            d[3] = v_plane[y * (width / 2) + x];
+        }
+    }
+}
+
+static bool ref_argb8888_to_rgb565a8(uint8_t * dst, const uint8_t * src, size_t count)
+{
+    uint16_t rgb;
+    bool opaque = true;
+    for(size_t i = 0; i < count; i++) {
+        const uint8_t * p = src + i * 4;
+        rgb = ((p[2] >> 3) << 11) | ((p[1] >> 2) << 5) | (p[0] >> 3);
+        memcpy(dst + i * 2, &rgb, 2);
+        dst[count * 2 + i] = p[3];
+        if(p[3] != 0xFF) {
+            opaque = false;
+        }
+    }
+    return opaque;
+}
+
+static void ref_rgb565_downscale(uint16_t * dst, const uint16_t * src, int width, int height, int src_stride,
+                                 int factor)
+{
+    int dst_width = width / factor;
+    for(int y = 0; y < height / factor; y++) {
+        for(int x = 0; x < dst_width; x++) {
+            int r = 0, g = 0, b = 0;
+            for(int dy = 0; dy < factor; dy++) {
+                for(int dx = 0; dx < factor; dx++) {
+                    const uint8_t * row = (const uint8_t *)src + (y * factor + dy) * src_stride;
+                    uint16_t c;
+                    memcpy(&c, row + (x * factor + dx) * 2, 2);
+                    r += c >> 11;
+                    g += (c >> 5) & 0x3F;
+                    b += c & 0x1F;
+                }
+            }
+            int area = factor * factor;
+            dst[y * dst_width + x] = ((r / area) << 11) | ((g / area) << 5) | (b / area);
+        }
+    }
+}
+
+static int failures = 0;
+
+static void check(const char * name, int offset, const void * a, const void * b, size_t size)
+{
+    if(memcmp(a, b, size) != 0) {
+        printf("FAIL %s, offset %d\n", name, offset);
+        failures++;
+    }
+}
+
+static void verify(void)
+{
+    size_t size = WIDTH * HEIGHT * 4 + 16;
+    uint8_t * src = malloc(size);
+    uint8_t * out = malloc(size);
+    uint8_t * ref = malloc(size);
+    fill_random(src, size);
+
+    /* Offsets of 0 and 2 bytes cover the aligned and unaligned paths of the 16-bit kernels, odd counts the tails */
+    for(int offset = 0; offset < 4; offset += 2) {
+        for(size_t count = 0; count < 40; count++) {
+            memset(out, 0, size);
+            memset(ref, 0, size);
+            pixel_swap16(out + offset, src + offset, count);
+            ref_swap16((uint16_t *)(ref + offset), (const uint16_t *)(src + offset), count);
+            check("swap16", offset, out, ref, count * 2 + 4);
+        }
+        /* In place */
+        memcpy(out, src, size);
+        memcpy(ref, src, size);
+        pixel_swap16(out + offset, out + offset, 1001);
+        ref_swap16((uint16_t *)(ref + offset), (const uint16_t *)(ref + offset), 1001);
+        check("swap16 in place", offset, out, ref, size);
+        /* Source and destination with different alignments */
+        pixel_swap16(out + offset, src + 2, 1001);
+        ref_swap16((uint16_t *)(ref + offset), (const uint16_t *)(src + 2), 1001);
+        check("swap16 mixed", offset, out, ref, size);
+    }
+    /* The byte kernels take any alignment */
+    for(int offset = 0; offset < 4; offset++) {
+        pixel_yuv422p_to_yuyv(out + offset, src, 34, 7);
+        ref_yuv422p_to_yuyv(ref + offset, src, 34, 7);
+        check("yuv422p_to_yuyv", offset, out + offset, ref + offset, 34 * 7 * 2);
+
+        for(size_t count = 1; count < 40; count += 3) {
+            bool a = pixel_argb8888_to_rgb565a8(out, src + offset, count);
+            bool b = ref_argb8888_to_rgb565a8(ref, src + offset, count);
+            check("argb8888_to_rgb565a8", offset, out, ref, count * 3);
+            if(a != b) {
+                printf("FAIL argb8888_to_rgb565a8 opaque, offset %d\n", offset);
+                failures++;
+            }
+        }
+    }
+
+    /* Opaque detection */
+    uint8_t * argb = malloc(64 * 4);
+    memset(argb, 0xFF, 64 * 4);
+    if(!pixel_argb8888_to_rgb565a8(out, argb, 64)) {
+        printf("FAIL argb8888_to_rgb565a8 opaque image\n");
+        failures++;
+    }
+    argb[63 * 4 + 3] = 0xFE;
+    if(pixel_argb8888_to_rgb565a8(out, argb, 64)) {
+        printf("FAIL argb8888_to_rgb565a8 transparent pixel\n");
+        failures++;
+    }
+    free(argb);
+
+    for(int factor = 1; factor <= 8; factor *= 2) {
+        /* Odd sizes drop the partial blocks, the stride has padding */
+        int width = 37, height = 29, stride = 40 * 2;
+        pixel_rgb565_downscale((uint16_t *)out, (const uint16_t *)src, width, height, stride, factor);
+        ref_rgb565_downscale((uint16_t *)ref, (const uint16_t *)src, width, height, stride, factor);
+        check("rgb565_downscale", factor, out, ref, (width / factor) * (height / factor) * 2);
+    }
+
+    free(src);
+    free(out);
+    free(ref);
+}
+
+/* Best of BENCH_ROUNDS alternating rounds, so the caches and the CPU clock affect both sides alike */
+#define BENCH_ROUNDS 7
+
+#define BENCH(name, bytes, kernel, reference)                                   \
+    do {                                                                        \
+        double kernel_us = 1e12, reference_us = 1e12;                           \
+        for(int round = 0; round < BENCH_ROUNDS; round++) {                     \
+            double start = now_us();                                            \
+            for(int loop = 0; loop < loops; loop++) {                           \
+                kernel;                                                         \
+            }                                                                   \
+            double us = (now_us() - start) / loops;                             \
+            kernel_us = us < kernel_us ? us : kernel_us;                        \
+            start = now_us();                                                   \
+            for(int loop = 0; loop < loops; loop++) {                           \
+                reference;                                                      \
+            }                                                                   \
+            us = (now_us() - start) / loops;                                    \
+            reference_us = us < reference_us ? us : reference_us;               \
+        }                                                                       \
+        printf("%-24s %10.1f %10.1f %10.1f %10.1f %7.2fx\n", name, kernel_us,   \
+               (bytes) / kernel_us, reference_us, (bytes) / reference_us,       \
+               reference_us / kernel_us);                                       \
+    } while(0)
+
+int main(int argc, char * argv[])
+{
+    int loops = 200;
+    if(argc > 2 && strcmp(argv[1], "-n") == 0) {
+        loops = atoi(argv[2]);
+    }
+    if(loops <= 0) {
+        fprintf(stderr, "Usage: %s [-n loops]\n", argv[0]);
+        return 1;
+    }
+
+    verify();
+    if(failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n\n");
+
+    size_t pixels = WIDTH * HEIGHT;
+    uint8_t * src = malloc(pixels * 4);
+    uint8_t * dst = malloc(pixels * 4);
+    fill_random(src, pixels * 4);
+
+    /* Throughput is in MB/s of input */
+    printf("%dx%d, best of %d rounds of %d loops\n", WIDTH, HEIGHT, BENCH_ROUNDS, loops);
+    printf("%-24s %10s %10s %10s %10s %8s\n", "kernel", "us", "MB/s", "ref us", "ref MB/s", "speedup");
+    BENCH("swap16", pixels * 2, pixel_swap16(dst, src, pixels),
+          ref_swap16((uint16_t *)dst, (const uint16_t *)src, pixels));
+    BENCH("swap16 in place", pixels * 2, pixel_swap16(dst, dst, pixels),
+          ref_swap16((uint16_t *)dst, (const uint16_t *)dst, pixels));
+    BENCH("yuv422p_to_yuyv", pixels * 2, pixel_yuv422p_to_yuyv(dst, src, WIDTH, HEIGHT),
+          ref_yuv422p_to_yuyv(dst, src, WIDTH, HEIGHT));
+    BENCH("argb8888_to_rgb565a8", pixels * 4, pixel_argb8888_to_rgb565a8(dst, src, pixels),
+          ref_argb8888_to_rgb565a8(dst, src, pixels));
+    BENCH("rgb565_downscale /2", pixels * 2,
+          pixel_rgb565_downscale((uint16_t *)dst, (const uint16_t *)src, WIDTH, HEIGHT, WIDTH * 2, 2),
+          ref_rgb565_downscale((uint16_t *)dst, (const uint16_t *)src, WIDTH, HEIGHT, WIDTH * 2, 2));
+
+    free(src);
+    free(dst);
+    return 0;
+}
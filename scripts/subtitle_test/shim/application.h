@@ -0,0 +1,30 @@
+#ifndef SUBTITLE_TEST_APPLICATION_H
+#define SUBTITLE_TEST_APPLICATION_H
+
+// The main task queue, run by the test after each timer tick
+
+#include <functional>
+#include <vector>
+
+class Application {
+public:
+    static Application& GetInstance() {
+        static Application instance;
+        return instance;
+    }
+
+    void Schedule(std::function<void()>&& callback) { tasks_.push_back(std::move(callback)); }
+
+    void RunScheduled() {
+        auto tasks = std::move(tasks_);
+        tasks_.clear();
+        for (auto& task : tasks) {
+            task();
+        }
+    }
+
+private:
+    std::vector<std::function<void()>> tasks_;
+};
+
+#endif // SUBTITLE_TEST_APPLICATION_H
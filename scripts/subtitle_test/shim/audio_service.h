@@ -0,0 +1,17 @@
+#ifndef SUBTITLE_TEST_AUDIO_SERVICE_H
+#define SUBTITLE_TEST_AUDIO_SERVICE_H
+
+// The playback positions set by the test
+
+#include <cstdint>
+
+class AudioService {
+public:
+    int64_t queued_ms = 0;
+    int64_t played_ms = 0;
+
+    int64_t GetQueuedPosition() { return queued_ms; }
+    int64_t GetPlaybackPosition() { return played_ms; }
+};
+
+#endif // SUBTITLE_TEST_AUDIO_SERVICE_H
@@ -0,0 +1,33 @@
+#ifndef SUBTITLE_TEST_DISPLAY_H
+#define SUBTITLE_TEST_DISPLAY_H
+
+// Records the messages like the chat bubbles of the wechat layout, one per SetChatMessage
+
+#include <string>
+#include <vector>
+
+class Display {
+public:
+    bool supports_append = true;
+    std::vector<std::string> messages;
+    int set_calls = 0;
+    int append_calls = 0;
+    bool append_mismatch = false;
+
+    void SetChatMessage(const char* role, const char* content) {
+        set_calls++;
+        messages.push_back(content);
+    }
+    void AppendChatMessage(const char* role, const char* content, size_t shown_length) {
+        append_calls++;
+        if (messages.empty() || messages.back() != std::string(content, shown_length)) {
+            append_mismatch = true;
+        }
+        if (!messages.empty()) {
+            messages.back() = content;
+        }
+    }
+    bool SupportsAppendChatMessage() const { return supports_append; }
+};
+
+#endif // SUBTITLE_TEST_DISPLAY_H
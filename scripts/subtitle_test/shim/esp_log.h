@@ -0,0 +1,11 @@
+#ifndef SUBTITLE_TEST_ESP_LOG_H
+#define SUBTITLE_TEST_ESP_LOG_H
+
+#include <cstdio>
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) fprintf(stderr, "I %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) do {} while (0)
+
+#endif // SUBTITLE_TEST_ESP_LOG_H
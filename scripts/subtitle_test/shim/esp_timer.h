@@ -0,0 +1,51 @@
+#ifndef SUBTITLE_TEST_ESP_TIMER_H
+#define SUBTITLE_TEST_ESP_TIMER_H
+
+// A manual clock and a periodic timer that fires when the test steps it
+
+#include <cstdint>
+
+typedef struct subtitle_test_timer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+
+enum { ESP_TIMER_TASK };
+
+typedef struct {
+    esp_timer_cb_t callback;
+    void* arg;
+    int dispatch_method;
+    const char* name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+struct subtitle_test_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+    bool active;
+};
+
+inline int64_t& subtitle_test_now_us() {
+    static int64_t now = 0;
+    return now;
+}
+
+inline subtitle_test_timer*& subtitle_test_last_timer() {
+    static subtitle_test_timer* timer = nullptr;
+    return timer;
+}
+
+inline int64_t esp_timer_get_time() { return subtitle_test_now_us(); }
+
+inline int esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle) {
+    *handle = new subtitle_test_timer{args->callback, args->arg, false};
+    subtitle_test_last_timer() = *handle;
+    return 0;
+}
+inline bool esp_timer_is_active(esp_timer_handle_t timer) { return timer->active; }
+inline int esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t) { timer->active = true; return 0; }
+inline int esp_timer_stop(esp_timer_handle_t timer) { timer->active = false; return 0; }
+inline int esp_timer_delete(esp_timer_handle_t timer) { delete timer; return 0; }
+
+#define ESP_ERROR_CHECK(x) (void)(x)
+
+#endif // SUBTITLE_TEST_ESP_TIMER_H
@@ -0,0 +1,183 @@
+/*
+ * Check the subtitle timing of main/subtitle_player.cc on the host, with the clock, the audio positions
+ * and the display replaced by the shims.
+ *
+ * Build from the repository root. subtitle_player.cc is read from stdin, otherwise its includes would find
+ * application.h next to it instead of the shim:
+ *   g++ -std=c++17 -Wall -I scripts/subtitle_test/shim -I main -c -x c++ - -o subtitle_player.o < main/subtitle_player.cc
+ *   g++ -std=c++17 -Wall -I scripts/subtitle_test/shim -I main scripts/subtitle_test/subtitle_test.cc \
+ *       subtitle_player.o -o subtitle_test
+ *
+ * Run:
+ *   ./subtitle_test
+ *
+ * The program exits with an error if any check fails.
+ */
+
+#include "subtitle_player.h"
+#include "application.h"
+
+#include <cstdio>
+#include <string>
+
+static int failures = 0;
+
+#define CHECK(condition)                                                    \
+    do {                                                                    \
+        if (!(condition)) {                                                 \
+            printf("FAIL %s:%d: %s\n", __func__, __LINE__, #condition);     \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+// One timer period: the clock advances, the timer schedules the update and the main task runs it
+static void Tick(AudioService& audio, int64_t played_step_ms) {
+    subtitle_test_now_us() += SUBTITLE_UPDATE_INTERVAL_MS * 1000;
+    audio.played_ms += played_step_ms;
+    auto timer = subtitle_test_last_timer();
+    if (timer->active) {
+        timer->callback(timer->arg);
+    }
+    Application::GetInstance().RunScheduled();
+}
+
+static bool TimerActive() {
+    return subtitle_test_last_timer()->active;
+}
+
+static void TestWordByWord() {
+    AudioService audio;
+    Display display;
+    SubtitlePlayer player(audio, &display);
+
+    player.AddSentence("Hello there, how are you today?", 0);
+    audio.queued_ms = 2000;
+    player.Finish(2000);
+    Tick(audio, 100);
+    CHECK(display.messages.size() == 1 && display.messages[0] == "Hello ");
+    for (int i = 0; i < 20; i++) {
+        Tick(audio, 100);
+    }
+    CHECK(display.messages.size() == 1 && display.messages[0] == "Hello there, how are you today?");
+    CHECK(display.append_calls > 1);
+    CHECK(!display.append_mismatch);
+    CHECK(!TimerActive());
+}
+
+// A tick that passes the end of a sentence and the start of the next one shows the rest of the first first
+static void TestSentenceBoundaryInOneTick() {
+    AudioService audio;
+    Display display;
+    SubtitlePlayer player(audio, &display);
+
+    player.AddSentence("One two three four.", 0);
+    player.AddSentence("Five six.", 1000);
+    audio.queued_ms = 2000;
+    player.Finish(2000);
+
+    Tick(audio, 100);
+    CHECK(display.messages.size() == 1 && display.messages[0] == "One ");
+    // From 100 ms to 1200 ms in one step
+    Tick(audio, 1100);
+    CHECK(display.messages.size() == 2);
+    CHECK(display.messages.size() >= 1 && display.messages[0] == "One two three four.");
+    CHECK(display.messages.size() >= 2 && display.messages[1].rfind("Five ", 0) == 0);
+    CHECK(!display.append_mismatch);
+}
+
+// Without audio every sentence is shown in full once playback is idle, none of them is dropped
+static void TestIdleShowsEverySentence() {
+    AudioService audio;
+    Display display;
+    SubtitlePlayer player(audio, &display);
+
+    player.AddSentence("First sentence.", 0);
+    player.AddSentence("Second sentence.", 0);
+    player.AddSentence("Third sentence.", 0);
+    for (int i = 0; i < SUBTITLE_IDLE_TIMEOUT_MS / SUBTITLE_UPDATE_INTERVAL_MS + 1; i++) {
+        Tick(audio, 0);
+    }
+    CHECK(display.messages.size() == 3);
+    CHECK(display.messages.size() == 3 && display.messages[0] == "First sentence." &&
+        display.messages[1] == "Second sentence." && display.messages[2] == "Third sentence.");
+    CHECK(!TimerActive());
+}
+
+// A reply without audio ends at tts stop, the sentence is shown at once
+static void TestTextOnlyReply() {
+    AudioService audio;
+    Display display;
+    SubtitlePlayer player(audio, &display);
+
+    player.AddSentence("No audio here.", 0);
+    player.Finish(0);
+    Tick(audio, 0);
+    CHECK(display.messages.size() == 1 && display.messages[0] == "No audio here.");
+    CHECK(!TimerActive());
+}
+
+// Displays that set the whole text on every append get each sentence once
+static void TestDisplayWithoutAppend() {
+    AudioService audio;
+    Display display;
+    display.supports_append = false;
+    SubtitlePlayer player(audio, &display);
+
+    player.AddSentence("Whole sentence at once.", 0);
+    audio.queued_ms = 1000;
+    for (int i = 0; i < 12; i++) {
+        Tick(audio, 100);
+    }
+    CHECK(display.set_calls == 1 && display.append_calls == 0);
+    CHECK(display.messages.size() == 1 && display.messages[0] == "Whole sentence at once.");
+}
+
+static void TestClearDropsPendingSentences() {
+    AudioService audio;
+    Display display;
+    SubtitlePlayer player(audio, &display);
+
+    player.AddSentence("Dropped with its audio.", 500);
+    audio.queued_ms = 1500;
+    Tick(audio, 100);
+    player.Clear();
+    audio.played_ms = audio.queued_ms;
+    Tick(audio, 0);
+    CHECK(display.messages.empty());
+    CHECK(!TimerActive());
+}
+
+// Chinese characters are words of their own
+static void TestCjkWords() {
+    AudioService audio;
+    Display display;
+    SubtitlePlayer player(audio, &display);
+
+    player.AddSentence("你好，世界。", 0);
+    audio.queued_ms = 400;
+    player.Finish(400);
+    Tick(audio, 100);
+    CHECK(display.messages.size() == 1 && display.messages[0] == "你好，");
+    for (int i = 0; i < 4; i++) {
+        Tick(audio, 100);
+    }
+    CHECK(display.messages.size() == 1 && display.messages[0] == "你好，世界。");
+    CHECK(!display.append_mismatch);
+}
+
+int main() {
+    TestWordByWord();
+    TestSentenceBoundaryInOneTick();
+    TestIdleShowsEverySentence();
+    TestTextOnlyReply();
+    TestDisplayWithoutAppend();
+    TestClearDropsPendingSentences();
+    TestCjkWords();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
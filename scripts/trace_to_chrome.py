@@ -0,0 +1,111 @@
+import socket
+import json
+import argparse
+
+
+'''
+  Convert the event trace dumped by the self.trace.dump MCP tool to the Chrome trace format,
+  which can be opened in chrome://tracing or https://ui.perfetto.dev
+
+  The dump is read from files (e.g. a saved serial log) or received over UDP:
+    @trace begin <now_us> <now_us low 32 bits>
+    @T <task> <B|E|I> <time_us low 32 bits> <arg> <name>
+    @trace end <count>
+'''
+def receive_udp(port):
+    server_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    server_socket.bind(('0.0.0.0', port))
+    print(f"Waiting for the trace on 0.0.0.0:{port}...")
+
+    lines = []
+    pending = ''
+    try:
+        while True:
+            message, address = server_socket.recvfrom(2048)
+            pending += message.decode('utf-8', errors='replace')
+            *complete, pending = pending.split('\n')
+            lines.extend(complete)
+            if any(line.startswith('@trace end') for line in complete):
+                break
+    except KeyboardInterrupt:
+        print("\nStopped before the end of the trace")
+    finally:
+        server_socket.close()
+    return lines
+
+
+def read_files(filenames):
+    lines = []
+    for filename in filenames:
+        with open(filename, 'r', encoding='utf-8', errors='replace') as f:
+            lines.extend(f.read().splitlines())
+    return lines
+
+
+def convert(lines):
+    events = []
+    tids = {}
+    now_us = None
+    now_low = None
+    for line in lines:
+        # Serial logs may have other output or color codes around the trace lines
+        start = line.find('@')
+        if start < 0:
+            continue
+        fields = line[start:].strip().split(' ', 5)
+        if fields[0] == '@trace' and len(fields) >= 4 and fields[1] == 'begin':
+            now_us = int(fields[2])
+            now_low = int(fields[3])
+            continue
+        if fields[0] != '@T' or len(fields) < 6 or now_us is None:
+            continue
+
+        task, phase, time_low, arg, name = fields[1], fields[2], int(fields[3]), int(fields[4]), fields[5]
+        # The device only keeps the low 32 bits, they wrap every 71 minutes
+        ts = now_us - ((now_low - time_low) & 0xffffffff)
+        tid = tids.setdefault(task, len(tids) + 1)
+        event = {'name': name, 'ts': ts, 'pid': 1, 'tid': tid}
+        if phase == 'I':
+            event.update({'ph': 'i', 's': 't', 'args': {'arg': arg}})
+        else:
+            event['ph'] = phase
+            if phase == 'B' and arg != 0:
+                event['args'] = {'arg': arg}
+        events.append(event)
+
+    events.sort(key=lambda e: e['ts'])
+
+    # The begin of the oldest events may have been overwritten in the ring buffer
+    stacks = {}
+    balanced = []
+    for event in events:
+        stack = stacks.setdefault(event['tid'], [])
+        if event['ph'] == 'B':
+            stack.append(event['name'])
+        elif event['ph'] == 'E':
+            if not stack or stack[-1] != event['name']:
+                continue
+            stack.pop()
+        balanced.append(event)
+
+    metadata = [{'name': 'process_name', 'ph': 'M', 'pid': 1, 'args': {'name': 'xiaozhi'}}]
+    for task, tid in tids.items():
+        metadata.append({'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': tid, 'args': {'name': task}})
+    return {'traceEvents': metadata + balanced, 'displayTimeUnit': 'ms'}
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='将设备的事件跟踪转换为 Chrome/Perfetto 跟踪 JSON')
+    parser.add_argument('inputs', nargs='*',
+                        help='包含跟踪输出的文件 (例如串口日志)，不指定时通过 UDP 接收')
+    parser.add_argument('--port', '-p', type=int, default=8001,
+                        help='UDP 接收端口 (默认: 8001)')
+    parser.add_argument('--output', '-o', default='trace.json',
+                        help='输出文件 (默认: trace.json)')
+
+    args = parser.parse_args()
+    lines = read_files(args.inputs) if args.inputs else receive_udp(args.port)
+    trace = convert(lines)
+    with open(args.output, 'w') as f:
+        json.dump(trace, f)
+    print(f"Saved {len(trace['traceEvents'])} events to {args.output}")